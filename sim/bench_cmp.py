@@ -0,0 +1,47 @@
+import sys
+
+# 对比两次基准测试的结果(epd_sim -b 或目标板0x9c命令在串口打印的BENCH行)
+# 用法: python3 bench_cmp.py old.txt new.txt [阈值%]
+
+def load(path):
+    res = {}
+    with open(path, encoding="utf-8", errors="ignore") as f:
+        for line in f:
+            v = line.split()
+            # BENCH <名称> <次数> <平均> <最小> <单位>
+            if len(v) == 6 and v[0] == "BENCH":
+                res[v[1]] = (int(v[3]), int(v[4]), v[5])
+    return res
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: bench_cmp.py old.txt new.txt [threshold%]")
+        return 1
+    old = load(sys.argv[1])
+    new = load(sys.argv[2])
+    limit = float(sys.argv[3]) if len(sys.argv) > 3 else 10.0
+
+    worse = 0
+    print("%-24s %10s %10s %8s" % ("name", "old", "new", "diff"))
+    for name in new:
+        if name not in old:
+            print("%-24s %10s %10d %8s" % (name, "-", new[name][1], "new"))
+            continue
+        # 用最小值比较，受干扰最小
+        a, b = old[name][1], new[name][1]
+        diff = 100.0 * (b - a) / a if a else 0.0
+        mark = ""
+        if diff > limit:
+            mark = "  <-- slower"
+            worse += 1
+        print("%-24s %10d %10d %+7.1f%%%s" % (name, a, b, diff, mark))
+    for name in old:
+        if name not in new:
+            print("%-24s %10d %10s %8s" % (name, old[name][1], "-", "gone"))
+
+    return 1 if worse else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,158 @@
+/*
+ * Host stand-ins for the parts of the DA1458x SDK that the display code touches.
+ * Only what is needed to compile src/ on Linux; nothing here talks to hardware.
+ */
+#ifndef _SIM_SDK_H_
+#define _SIM_SDK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define printk printf
+#define arch_printf printf
+
+#define __SECTION_ZERO(sec)
+#define __REV(x)            __builtin_bswap32((uint32_t)(x))
+#define __asm(x)
+#define GLOBAL_INT_DISABLE() do{
+#define GLOBAL_INT_RESTORE() }while(0)
+#define ASSERT_WARNING(x)   ((void)(x))
+#define ASSERT_ERROR(x)     ((void)(x))
+#define ARRAY_LEN(a)        (sizeof(a)/sizeof((a)[0]))
+
+#define SetBits16(reg, field, val)   ((void)0)
+#define GetBits16(reg, field)        (0)
+#define SetWord16(reg, val)          sim_set_word16(reg, val)
+void sim_set_word16(int reg, int val);
+
+/* system control: only the software reset is modelled */
+#define SYS_CTRL_REG  0x50000012
+#define REMAP_ADR0    0x0003
+#define SW_RESET      0x8000
+#define GetWord16(reg)               (0)
+
+/* arch */
+enum { ARCH_SLEEP_OFF, ARCH_EXT_SLEEP_ON, ARCH_EXT_SLEEP_OTP_COPY_ON };
+void arch_set_sleep_mode(int mode);
+int  arch_get_sleep_mode(void);
+
+/* gpio */
+typedef enum { GPIO_PORT_0, GPIO_PORT_1, GPIO_PORT_2, GPIO_PORT_3 } GPIO_PORT;
+typedef int GPIO_PIN;
+#define PID_GPIO 0
+void GPIO_ConfigurePin(int port, int pin, int mode, int function, bool high);
+void GPIO_SetActive(int port, int pin);
+void GPIO_SetInactive(int port, int pin);
+bool GPIO_GetPinStatus(int port, int pin);
+
+/* kernel / messages */
+typedef uint16_t ke_msg_id_t;
+typedef uint16_t ke_task_id_t;
+typedef uint8_t  timer_hnd;
+#define EASY_TIMER_INVALID_TIMER  (0)
+timer_hnd app_easy_timer(const uint32_t delay, void (*fn)(void));
+void app_easy_timer_cancel(const timer_hnd timer_id);
+timer_hnd app_easy_timer_modify(const timer_hnd timer_id, uint32_t delay);
+
+void *sim_msg_alloc(int id, int size);
+void  sim_msg_send(void *msg);
+#define KE_MSG_ALLOC(id, dest, src, type)  ((struct type *)sim_msg_alloc(id, sizeof(struct type)))
+#define KE_MSG_ALLOC_DYN(id, dest, src, type, len)  ((struct type *)sim_msg_alloc(id, sizeof(struct type)+(len)))
+#define KE_MSG_SEND(msg)  sim_msg_send(msg)
+
+enum { TASK_APP = 1, TASK_ID_CUSTS1 = 2 };
+ke_task_id_t prf_get_task_from_id(int id);
+
+struct app_env_tag { uint8_t conidx; };
+extern struct app_env_tag app_env[1];
+#define GAP_INVALID_CONIDX  0xff
+
+/* custs1 messages */
+enum {
+	CUSTS1_VAL_SET_REQ = 1, CUSTS1_VAL_NTF_REQ, CUSTS1_VAL_IND_REQ, CUSTS1_VAL_WRITE_IND,
+	CUSTS1_VAL_NTF_CFM, CUSTS1_VAL_IND_CFM, CUSTS1_ATT_INFO_REQ, CUSTS1_ATT_INFO_RSP,
+	CUSTS1_VALUE_REQ_IND, CUSTS1_VALUE_REQ_RSP,
+	GAPC_PARAM_UPDATED_IND, GATTC_EVENT_REQ_IND, GATTC_EVENT_CFM, GATTC_MTU_CHANGED_IND,
+};
+struct custs1_val_set_req   { uint8_t conidx; uint16_t handle; uint16_t length; uint8_t value[]; };
+struct custs1_val_ntf_ind_req { uint8_t conidx; bool notification; uint16_t handle; uint16_t length; uint8_t value[]; };
+struct custs1_val_write_ind { uint8_t conidx; uint16_t handle; uint16_t length; uint8_t value[]; };
+struct custs1_att_info_req  { uint8_t conidx; uint16_t att_idx; };
+struct custs1_att_info_rsp  { uint8_t conidx; uint16_t att_idx; uint16_t length; uint8_t status; };
+struct custs1_value_req_ind { uint8_t conidx; uint16_t att_idx; };
+struct custs1_value_req_rsp { uint8_t conidx; uint16_t att_idx; uint16_t length; uint8_t status; uint8_t value[]; };
+#define ATT_ERR_NO_ERROR            0x00
+#define ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define ATT_ERR_APP_ERROR           0x80
+
+/* gap */
+struct gapc_connection_req_ind { uint16_t conhdl; uint16_t con_interval; uint16_t con_latency; uint16_t sup_to; };
+struct gapc_disconnect_ind { uint16_t conhdl; uint8_t reason; };
+struct gapc_param_updated_ind { uint16_t con_interval; uint16_t con_latency; uint16_t sup_to; };
+struct gattc_event_ind { uint8_t type; uint16_t length; uint16_t handle; };
+struct gattc_event_cfm { uint16_t handle; };
+struct gattc_mtu_changed_ind { uint16_t mtu; uint8_t seq_num; };
+#define ADV_DATA_LEN       31
+#define SCAN_RSP_DATA_LEN  31
+struct gapm_adv_host { uint8_t adv_data_len; uint8_t adv_data[ADV_DATA_LEN]; uint8_t scan_rsp_data_len; uint8_t scan_rsp_data[SCAN_RSP_DATA_LEN]; };
+struct gapm_start_advertise_cmd { uint16_t intv_min; uint16_t intv_max; uint8_t channel_map; union { struct gapm_adv_host host; } info; };
+#define GAP_AD_TYPE_COMPLETE_NAME       0x09
+#define GAP_AD_TYPE_MANU_SPECIFIC_DATA  0xff
+#define CO_ERROR_REMOTE_USER_TERM_CON   0x13
+#define MS_TO_BLESLOTS(x)     ((int)((x)/0.625))
+#define MS_TO_TIMERUNITS(x)   ((int)((x)/10))
+#define MS_TO_DOUBLESLOTS(x)  ((int)((x)/1.25))
+
+struct gapm_start_advertise_cmd *app_easy_gap_undirected_advertise_get_active(void);
+void app_easy_gap_undirected_advertise_with_timeout_start(uint16_t delay, void (*timeout_callback)(void));
+void app_easy_gap_advertise_stop(void);
+void app_easy_gap_param_update_start(uint8_t conidx);
+void app_easy_gap_disconnect(uint8_t conidx);
+
+struct default_handlers_configuration { int adv_scenario; int advertise_period; };
+extern const struct default_handlers_configuration user_default_hnd_conf;
+struct connection_param_configuration { uint16_t intv_min; uint16_t intv_max; uint16_t latency; uint16_t time_out; };
+extern const struct connection_param_configuration user_connection_param_conf;
+struct device_name { uint8_t length; uint8_t name[32]; };
+struct device_info_tag { struct device_name dev_name; };
+extern struct device_info_tag device_info;
+void default_app_on_init(void);
+void default_app_on_connection(uint8_t connection_idx, struct gapc_connection_req_ind const *param);
+
+/* otp / adc */
+void hw_otpc_init(void);
+void hw_otpc_manual_read_on(bool spi_en);
+void hw_otpc_disable(void);
+#define ADC_INPUT_MODE_SINGLE_ENDED 0
+void adc_offset_calibrate(int mode);
+uint16_t adc_get_vbat_sample(bool sample_vbat1v);
+
+/* wake-up controller */
+#define WKUPCT_PIN_SELECT(port, pin)        (1u << ((port)*8 + (pin)))
+#define WKUPCT_PIN_POLARITY_HIGH            0
+#define WKUPCT_PIN_POLARITY_LOW             1
+#define WKUPCT_PIN_POLARITY(port, pin, pol) ((uint32_t)(pol) << ((port)*8 + (pin)))
+void wkupct_register_callback(void (*callback)(void));
+void wkupct_enable_irq(uint32_t sel_pins, uint32_t pol_pins, uint16_t events_num, uint16_t deb_time);
+void wkupct_disable_irq(void);
+void app_easy_wakeup_set(void (*fn)(void));
+void app_easy_wakeup(void);
+bool arch_ble_ext_wakeup_get(void);
+void arch_ble_force_wakeup(void);
+void arch_ble_ext_wakeup_off(void);
+
+/* Cortex-M0 SysTick (only declared, the simulator times with clock_gettime) */
+typedef struct { volatile uint32_t CTRL, LOAD, VAL, CALIB; } SysTick_Type;
+extern SysTick_Type sim_systick;
+#define SysTick                      (&sim_systick)
+#define SysTick_CTRL_CLKSOURCE_Msk   (1u << 2)
+#define SysTick_CTRL_ENABLE_Msk      (1u << 0)
+
+/* BLE base time (625us slots) */
+uint32_t lld_evt_time_get(void);
+
+#endif
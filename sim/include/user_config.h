@@ -0,0 +1,5 @@
+#ifndef _USER_CONFIG_H_
+#define _USER_CONFIG_H_
+#include "sim_sdk.h"
+#define EPD_VERSION 0xA50f0007
+#endif
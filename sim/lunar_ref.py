@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+# 生成农历测试的参考数据(lunar_ref.txt)，和固件里的农历表无关，从天文算法直接推算:
+#   朔: Meeus《Astronomical Algorithms》第49章，包括全部周期项和附加项，误差在1分钟以内
+#   中气: 第25章的太阳视黄经(低精度公式，约0.01度，也就是15分钟左右)
+#   ΔT: Espenak-Meeus的多项式
+# 按GB/T 33661-2017《农历的编算和颁行》的规则，时间用北京时间(UTC+8):
+#   朔所在的日期是初一；含冬至的月是十一月；两个冬至之间有13个月时，
+#   第一个不含中气的月是闰月，月份和前一个月相同。
+#
+# 输出每个农历月的第一天: 公历日期 农历年 月(1-12) 是否闰月。范围是固件农历表的
+# 2020-01-25到2052-01-31，最后多一行2052年的正月初一，作为2051年腊月的结束
+# 日期可能因为算法的误差而差一天的情况在stderr上提示，这些月要另外核对:
+# 朔离午夜不到5分钟，或者中气离午夜不到30分钟而且当天或第二天就是初一。
+#
+#   python3 lunar_ref.py > lunar_ref.txt
+
+import math
+import sys
+from datetime import date, timedelta
+
+J2000 = 2451545.0
+
+
+def sind(x):
+    return math.sin(math.radians(x))
+
+
+def delta_t(year):
+    # 秒
+    if year < 2050:
+        t = year - 2000
+        return 62.92 + 0.32217 * t + 0.005589 * t * t
+    return -20 + 32 * ((year - 1820) / 100) ** 2 - 0.5628 * (2150 - year)
+
+
+def new_moon(k):
+    # 第k个朔(k=0是2000-01-06)的力学时JDE
+    T = k / 1236.85
+    jde = (2451550.09766 + 29.530588861 * k + 0.00015437 * T**2
+           - 0.000000150 * T**3 + 0.00000000073 * T**4)
+    E = 1 - 0.002516 * T - 0.0000074 * T**2
+    M = 2.5534 + 29.10535670 * k - 0.0000014 * T**2 - 0.00000011 * T**3
+    Mp = (201.5643 + 385.81693528 * k + 0.0107582 * T**2
+          + 0.00001238 * T**3 - 0.000000058 * T**4)
+    F = (160.7108 + 390.67050284 * k - 0.0016118 * T**2
+         - 0.00000227 * T**3 + 0.000000011 * T**4)
+    O = 124.7746 - 1.56375588 * k + 0.0020672 * T**2 + 0.00000215 * T**3
+
+    c = (-0.40720 * sind(Mp)
+         + 0.17241 * E * sind(M)
+         + 0.01608 * sind(2 * Mp)
+         + 0.01039 * sind(2 * F)
+         + 0.00739 * E * sind(Mp - M)
+         - 0.00514 * E * sind(Mp + M)
+         + 0.00208 * E * E * sind(2 * M)
+         - 0.00111 * sind(Mp - 2 * F)
+         - 0.00057 * sind(Mp + 2 * F)
+         + 0.00056 * E * sind(2 * Mp + M)
+         - 0.00042 * sind(3 * Mp)
+         + 0.00042 * E * sind(M + 2 * F)
+         + 0.00038 * E * sind(M - 2 * F)
+         - 0.00024 * E * sind(2 * Mp - M)
+         - 0.00017 * sind(O)
+         - 0.00007 * sind(Mp + 2 * M)
+         + 0.00004 * sind(2 * Mp - 2 * F)
+         + 0.00004 * sind(3 * M)
+         + 0.00003 * sind(Mp + M - 2 * F)
+         + 0.00003 * sind(2 * Mp + 2 * F)
+         - 0.00003 * sind(Mp + M + 2 * F)
+         + 0.00003 * sind(Mp - M + 2 * F)
+         - 0.00002 * sind(Mp - M - 2 * F)
+         - 0.00002 * sind(3 * Mp + M)
+         + 0.00002 * sind(4 * Mp))
+
+    A = [299.77 + 0.107408 * k - 0.009173 * T**2,
+         251.88 + 0.016321 * k,
+         251.83 + 26.651886 * k,
+         349.42 + 36.412478 * k,
+         84.66 + 18.206239 * k,
+         141.74 + 53.303771 * k,
+         207.14 + 2.453732 * k,
+         154.84 + 7.306860 * k,
+         34.52 + 27.261239 * k,
+         207.19 + 0.121824 * k,
+         291.34 + 1.844379 * k,
+         161.72 + 24.198154 * k,
+         239.56 + 25.513099 * k,
+         331.55 + 3.592518 * k]
+    W = [0.000325, 0.000165, 0.000164, 0.000126, 0.000110, 0.000062, 0.000060,
+         0.000056, 0.000047, 0.000042, 0.000040, 0.000037, 0.000035, 0.000023]
+    c += sum(w * sind(a) for w, a in zip(W, A))
+    return jde + c
+
+
+def sun_longitude(jde):
+    # 太阳视黄经，度
+    T = (jde - J2000) / 36525
+    L0 = 280.46646 + 36000.76983 * T + 0.0003032 * T * T
+    M = 357.52911 + 35999.05029 * T - 0.0001537 * T * T
+    C = ((1.914602 - 0.004817 * T - 0.000014 * T * T) * sind(M)
+         + (0.019993 - 0.000101 * T) * sind(2 * M)
+         + 0.000289 * sind(3 * M))
+    O = 125.04 - 1934.136 * T
+    return (L0 + C - 0.00569 - 0.00478 * sind(O)) % 360
+
+
+def solar_term(year, lon):
+    # 公历year年里太阳视黄经到达lon的力学时JDE。黄经280度大约在1月1日
+    jde = 2451545.0 + 365.2422 * (year - 2000 + ((lon - 280) % 360) / 360)
+    for _ in range(20):
+        d = (lon - sun_longitude(jde) + 180) % 360 - 180
+        jde += d / 360 * 365.2422
+        if abs(d) < 1e-7:
+            break
+    return jde
+
+
+def beijing(jde):
+    # 力学时JDE换成北京时间的(日期, 当天的分钟数)
+    year = 2000 + (jde - J2000) / 365.25
+    jd = jde - delta_t(year) / 86400 + 8 / 24 + 0.5
+    day = math.floor(jd)
+    minute = (jd - day) * 1440
+    return date.fromordinal(int(day) - 1721425), minute
+
+
+close = []
+
+
+def event_date(jde, what, margin):
+    d, minute = beijing(jde)
+    if minute < margin or minute > 1440 - margin:
+        close.append((d, "%s %s %02d:%02d" % (what, d, minute // 60, minute % 60)))
+    return d
+
+
+def main():
+    first, last = 2019, 2053
+    # 所有的朔
+    k = math.floor((first - 2000) * 12.3685) - 2
+    moons = []
+    while True:
+        d = event_date(new_moon(k), "new moon", 5)
+        if d.year > last:
+            break
+        moons.append(d)
+        k += 1
+    # 中气: 冬至270度起每30度一个
+    zq = []
+    solstice = []
+    for y in range(first, last + 1):
+        for lon in range(0, 360, 30):
+            d = event_date(solar_term(y, lon), "zhongqi %d" % lon, 30)
+            zq.append(d)
+            if lon == 270:
+                solstice.append(d)
+
+    def month_of(d):
+        # 包含d的农历月的序号
+        i = max(j for j, m in enumerate(moons) if m <= d)
+        return i
+
+    months = {}
+    for s0, s1 in zip(solstice, solstice[1:]):
+        m0 = month_of(s0)
+        m1 = month_of(s1)
+        leap_done = m1 - m0 == 12
+        num = 11
+        for i in range(m0, m1):
+            start, end = moons[i], moons[i + 1]
+            has_zq = any(start <= z < end for z in zq)
+            if i > m0:
+                if not leap_done and not has_zq:
+                    leap_done = True
+                    months[i] = (num, 1)
+                    continue
+                num = num % 12 + 1
+            months[i] = (num, 0)
+
+    begin, end = date(2020, 1, 25), date(2052, 2, 2)
+    ly = 2019
+    for i in sorted(months):
+        num, leap = months[i]
+        if num == 1 and not leap:
+            ly = moons[i].year
+        if begin <= moons[i] < end:
+            print("%s %d %d %d" % (moons[i], ly, num, leap))
+
+    starts = set(moons)
+    for d, what in close:
+        if not begin <= d < end:
+            continue
+        if what.startswith("zhongqi") and d not in starts and d + timedelta(1) not in starts:
+            continue
+        print("check: " + what, file=sys.stderr)
+
+
+main()
@@ -0,0 +1,70 @@
+/*
+ * Linux主机上的显示仿真，模拟器内部接口。
+ * 固件源码只通过epd.h和SDK桩头文件与这里交互。
+ */
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+// 仿真时钟，单位us。SPI传输、delay_ms和波形都会推进它
+uint64_t sim_time_us(void);
+void sim_advance_us(uint64_t us);
+
+// 运行定时器和BUSY唤醒事件，直到仿真时钟前进ms毫秒
+void sim_run(int ms);
+// 运行到没有待处理的定时器为止(最多limit_ms)
+void sim_idle(int limit_ms);
+// 还有多少个定时器没到期
+int sim_timer_pending(void);
+
+// 时钟定时器当前周期的秒数和长度(ms)，唤醒的次数
+extern int sim_clock_sec;
+extern int sim_clock_ms;
+extern int sim_wakes;
+
+// 唤醒控制器是否在等BUSY下降沿
+int sim_wkup_armed(void);
+void sim_wkup_fire(void);
+
+// 模拟屏幕，out_dir为NULL时不输出图片
+void sim_panel_config(int lut_size, int w, int h, const char *out_dir, int pbm);
+uint64_t sim_panel_busy_end(void);
+int sim_panel_frames(void);
+// 最近一次刷新的0x22序列(0xf7是OTP全刷)，玻璃上红点的个数
+int sim_panel_seq(void);
+int sim_panel_red(void);
+void sim_panel_temp(int c16);
+
+// 模拟的SPI flash，引脚配置和user_peripheral.c相同
+#define SIM_FSPI_PINS  0x00030605
+int sim_flash_file(const char *name);
+uint8_t *sim_flash_data(void);
+int sim_flash_busy(void);
+extern int sim_flash_ops[3];
+
+// selflash看到的"正在运行的固件"
+#define SIM_FIRM_SIZE  0x8000
+extern uint8_t sim_firm[];
+extern int sim_firm_size;
+void sim_firm_init(void);
+
+// 固件请求复位的次数
+extern int sim_resets;
+
+// 给主机的通知，主机读到的特征值
+extern void (*sim_notify)(int handle, const uint8_t *value, int len);
+int sim_att_read(int handle, uint8_t *buf);
+
+// 电池电压(mV)，ADC采样返回它。屏幕刷新时电压低sim_vbat_sag_mv
+extern int sim_vbat_mv;
+extern int sim_vbat_sag_mv;
+
+// 广播占空比和平均电流的估算
+void sim_adv_duty(int hours);
+
+// 图片输出
+int sim_write_png(const char *name, int w, int h, const uint8_t *rgb);
+int sim_write_pbm(const char *name, int w, int h, const uint8_t *rgb);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * 广播占空比的估算(epd_sim -a hours)。
+ *
+ * 用固件的广播策略(user_adv.c)从开机走hours小时，一直没有主机连接，这是最耗电的
+ * 情况。统计广播窗口和广播事件的个数，估算平均电流，再和原来的做法比较：每分钟
+ * 广播30秒，间隔687.5ms。
+ *
+ * 电流按DA14585数据手册的典型值粗略估算，只用来比较不同的策略：一次广播事件在3个
+ * 信道上各发一个包再听一下，加上从extended sleep唤醒和XTAL16M起振，大约10uC；
+ * 睡眠时RAM保持和RC32K大约2uA。屏幕刷新和每分钟走时不算在内。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "user_adv.h"
+
+#include <stdio.h>
+
+/******************************************************************************/
+
+#define ADV_EVENT_UC   10.0   // 一次广播事件的电荷
+#define SLEEP_UA       2.0    // 睡眠电流
+#define ADV_DELAY_MS   5.0    // 每个广播间隔上加0-10ms的随机延迟，取平均
+
+#define OLD_INTV_MS    687.5
+#define OLD_LEN_MS     30000
+#define OLD_PERIOD_MS  60000
+
+
+// 一个窗口里的广播事件数
+static double adv_events(double intv_ms, double len_ms)
+{
+	return len_ms/(intv_ms+ADV_DELAY_MS);
+}
+
+
+void sim_adv_duty(int hours)
+{
+	long long end = (long long)hours*3600*1000;
+	long long t = 0;
+	double events[2] = {0, 0};
+	int windows[2] = {0, 0};
+	int intv, len, gap, beacon;
+	double uc, old;
+
+	adv_policy_init();
+	adv_policy_event(ADV_EV_BOOT);
+
+	while(t<end){
+		if(!adv_policy_window(&intv, &len))
+			break;
+		beacon = adv_policy_state()==ADV_BEACON;
+		if(t+len*10>end)
+			len = (end-t)/10;
+		windows[beacon] += 1;
+		events[beacon] += adv_events(intv*0.625, len*10);
+		t += len*10;
+
+		adv_policy_event(ADV_EV_TIMEOUT);
+		gap = adv_policy_gap();
+		if(gap<0)
+			break;
+		t += gap*10;
+	}
+
+	uc = (events[0]+events[1])*ADV_EVENT_UC;
+	printf("adv: %d h without connection\n", hours);
+	printf("  burst : %4d windows  %8.0f events\n", windows[0], events[0]);
+	printf("  beacon: %4d windows  %8.0f events\n", windows[1], events[1]);
+	printf("  average %.2f uA (adv %.2f + sleep %.2f)\n",
+		uc/(end/1000.0)+SLEEP_UA, uc/(end/1000.0), SLEEP_UA);
+
+	old = adv_events(OLD_INTV_MS, OLD_LEN_MS)*ADV_EVENT_UC/(OLD_PERIOD_MS/1000.0);
+	printf("  old: %d s every %d s at %.1f ms: %.2f uA (adv %.2f + sleep %.2f)\n",
+		OLD_LEN_MS/1000, OLD_PERIOD_MS/1000, OLD_INTV_MS, old+SLEEP_UA, old, SLEEP_UA);
+}
+
+
+/******************************************************************************/
@@ -0,0 +1,325 @@
+/*
+ * 外部SPI flash的模拟，接在固件的位操作SPI(spi_flash.c)下面。
+ *
+ * 固件的gpio_set/gpio_get/gpio_config到这里为止，只有flash的四个脚(SIM_FSPI_PINS，
+ * 和user_peripheral.c里的配置相同)有意义，屏幕在sim_hw.c里按字节模拟。
+ *
+ * - CLK上升沿采样DI，下降沿输出下一位。0x3b在dummy字节之后每个时钟从DO和DI
+ *   各输出一位，DI要先被固件切成输入
+ * - 支持的命令: 0xab 0x90 0x05 0x35 0x06 0x04 0x50 0x01 0x31 0x02 0x20 0x52 0xd8 0x0b 0x3b
+ * - 写和擦除在CS拉高时开始，忙的时间挂在仿真时钟上。忙的时候只接受读状态，
+ *   没有写使能的写和擦除被忽略，这两种情况都打印出来，一般是固件的错误
+ * - 写只能把1变成0，地址在page内回绕，和真的flash一样
+ * - 用sim_flash_file()可以把内容映射到一个文件里，进程中途退出也不会丢失已经写入的数据，
+ *   相当于掉电
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/******************************************************************************/
+
+#define SF_SIZE       0x40000   // 2Mbit
+#define SF_MID        0xef
+#define SF_PID        0x11
+
+// 估计的时序。位操作的SPI和屏幕的一样，每字节大约20us
+#define SF_CLK_NS     2500
+#define SF_PROG_US    700
+#define SF_ERASE4_US  45000
+#define SF_ERASE32_US 120000
+#define SF_ERASE64_US 150000
+
+#define PIN_CLK  ((SIM_FSPI_PINS>>24)&0xff)
+#define PIN_CS   ((SIM_FSPI_PINS>>16)&0xff)
+#define PIN_DI   ((SIM_FSPI_PINS>> 8)&0xff)
+#define PIN_DO   ((SIM_FSPI_PINS>> 0)&0xff)
+
+static u8 sf_ram[SF_SIZE];
+static u8 *sf_mem;
+
+static int cs = 1, clk, di_in, si, so, io0;
+static int clk_ns;
+
+static int nbytes;        // 这次CS低电平期间收到的字节数
+static int in_bits, in_byte;
+static int out_bits, out_byte;
+static u8 hdr[5];         // 命令、地址和dummy
+static int addr;
+static u8 page[256];
+static int page_len;
+static int ignored;
+
+static int wel;
+static uint64_t busy_until;
+
+int sim_flash_ops[3];     // 写、4K擦除、32K/64K擦除的次数，给测试用
+
+
+/******************************************************************************/
+
+static u8 *mem(void)
+{
+	if(sf_mem==NULL){
+		memset(sf_ram, 0xff, SF_SIZE);
+		sf_mem = sf_ram;
+	}
+	return sf_mem;
+}
+
+
+// 用文件保存flash的内容。文件不存在时新建，内容是擦除过的0xff
+int sim_flash_file(const char *name)
+{
+	struct stat st;
+	u8 *p;
+	int fd, fresh;
+
+	fd = open(name, O_RDWR|O_CREAT, 0644);
+	if(fd<0 || fstat(fd, &st)<0){
+		printf("sim: can't open flash file %s\n", name);
+		return -1;
+	}
+	fresh = st.st_size<SF_SIZE;
+	if(fresh && ftruncate(fd, SF_SIZE)<0){
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, SF_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p==MAP_FAILED)
+		return -1;
+	if(fresh)
+		memset(p+st.st_size, 0xff, SF_SIZE-st.st_size);
+	sf_mem = p;
+	return 0;
+}
+
+
+// 直接访问flash的内容，不经过SPI，测试检查结果用
+u8 *sim_flash_data(void)
+{
+	return mem();
+}
+
+
+int sim_flash_busy(void)
+{
+	return sim_time_us()<busy_until;
+}
+
+
+/******************************************************************************/
+
+static int need_wel(int cmd)
+{
+	if(wel)
+		return 1;
+	printf("sim: flash %02x without write enable\n", cmd);
+	return 0;
+}
+
+
+static void erase(int size, uint64_t us)
+{
+	int a = (hdr[1]<<16 | hdr[2]<<8 | hdr[3]) & (SF_SIZE-1) & ~(size-1);
+
+	memset(mem()+a, 0xff, size);
+	busy_until = sim_time_us() + us;
+	sim_flash_ops[size==0x1000? 1 : 2] += 1;
+}
+
+
+// CS拉高，命令结束
+static void cmd_end(void)
+{
+	int i, a;
+
+	if(nbytes==0 || ignored)
+		return;
+
+	switch(hdr[0]){
+	case 0x06:
+		wel = 1;
+		break;
+	case 0x04:
+		wel = 0;
+		break;
+	case 0x02:
+		if(nbytes<4 || !need_wel(0x02))
+			break;
+		a = (hdr[1]<<16 | hdr[2]<<8 | hdr[3]) & (SF_SIZE-1);
+		for(i=0; i<page_len && i<256; i++)
+			mem()[(a&~0xff) | ((a+i)&0xff)] &= page[i];
+		busy_until = sim_time_us() + SF_PROG_US;
+		sim_flash_ops[0] += 1;
+		wel = 0;
+		break;
+	case 0x20:
+		if(nbytes>=4 && need_wel(0x20))
+			erase(0x1000, SF_ERASE4_US);
+		wel = 0;
+		break;
+	case 0x52:
+		if(nbytes>=4 && need_wel(0x52))
+			erase(0x8000, SF_ERASE32_US);
+		wel = 0;
+		break;
+	case 0xd8:
+		if(nbytes>=4 && need_wel(0xd8))
+			erase(0x10000, SF_ERASE64_US);
+		wel = 0;
+		break;
+	}
+}
+
+
+// 收齐一个字节
+static void byte_in(int b)
+{
+	int n = nbytes++;
+
+	if(n<5)
+		hdr[n] = b;
+	if(n==0 && sim_flash_busy() && b!=0x05 && b!=0x35){
+		printf("sim: flash busy, command %02x ignored\n", b);
+		ignored = 1;
+	}
+	if(n==3)
+		addr = (hdr[1]<<16 | hdr[2]<<8 | hdr[3]) & (SF_SIZE-1);
+	if(hdr[0]==0x02 && n>=4){
+		page[(n-4)&0xff] = b;
+		if(page_len<256)
+			page_len += 1;
+	}
+}
+
+
+// 第n个字节输出什么
+static int byte_out(int n)
+{
+	if(ignored || n==0)
+		return 0xff;
+
+	switch(hdr[0]){
+	case 0x05:
+		return (sim_flash_busy()? 1 : 0) | (wel<<1);
+	case 0x35:
+		return 0;
+	case 0x90:
+		if(n<4)
+			return 0xff;
+		return ((n-4)&1)? SF_PID : SF_MID;
+	case 0x0b:
+	case 0x3b:
+		if(n<5)
+			return 0xff;
+		n = mem()[addr];
+		addr = (addr+1)&(SF_SIZE-1);
+		return n;
+	}
+	return 0xff;
+}
+
+
+static int dual_data(void)
+{
+	return hdr[0]==0x3b && nbytes>=5 && !ignored;
+}
+
+
+static void clk_fall(void)
+{
+	if(dual_data()){
+		if(out_bits==0){
+			out_byte = byte_out(nbytes);
+			out_bits = 8;
+		}
+		so  = (out_byte>>7)&1;
+		io0 = (out_byte>>6)&1;
+		out_byte <<= 2;
+		out_bits -= 2;
+		return;
+	}
+
+	// 按已经收到的位数对齐，CS拉低时CLK可能是低电平，第一位前没有下降沿
+	if(in_bits==0)
+		out_byte = byte_out(nbytes);
+	so = (out_byte>>(7-in_bits))&1;
+}
+
+
+static void clk_rise(void)
+{
+	clk_ns += SF_CLK_NS;
+	if(clk_ns>=1000){
+		sim_advance_us(clk_ns/1000);
+		clk_ns %= 1000;
+	}
+
+	if(dual_data())
+		return;
+
+	in_byte = (in_byte<<1) | si;
+	in_bits += 1;
+	if(in_bits==8){
+		byte_in(in_byte&0xff);
+		in_bits = 0;
+		in_byte = 0;
+	}
+}
+
+
+/******************************************************************************/
+
+// 固件的GPIO接口。mode 0x0100是输入，0x0300是输出
+void gpio_config(int index, int mode, int value)
+{
+	if(index==PIN_DI)
+		di_in = (mode==0x0100);
+	if(mode==0x0300)
+		gpio_set(index, value);
+}
+
+
+void gpio_set(int index, int value)
+{
+	value = value? 1 : 0;
+
+	if(index==PIN_CS){
+		if(cs && value==0){
+			nbytes = 0;
+			in_bits = 0;
+			in_byte = 0;
+			out_bits = 0;
+			page_len = 0;
+			ignored = 0;
+		}else if(cs==0 && value){
+			cmd_end();
+		}
+		cs = value;
+	}else if(index==PIN_CLK){
+		if(cs==0 && clk && value==0)
+			clk_fall();
+		else if(cs==0 && clk==0 && value)
+			clk_rise();
+		clk = value;
+	}else if(index==PIN_DI){
+		si = value;
+	}
+}
+
+
+int gpio_get(int index)
+{
+	if(index==PIN_DO)
+		return so;
+	if(index==PIN_DI)
+		return (di_in && dual_data())? io0 : si;
+	return 0;
+}
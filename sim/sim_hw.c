@@ -0,0 +1,462 @@
+/*
+ * epd_hw.c的主机替代品：模拟一块SSD16xx控制器的屏幕。
+ *
+ * - 命令按字节解析：数据输入模式(0x11)、RAM窗口(0x44/0x45)、地址计数器(0x4e/0x4f)、
+ *   写RAM(0x24/0x26)、读RAM(0x27，0x41选择读哪块)、LUT读写(0x32/0x33)、更新(0x20)
+ * - RAM大小按-s给的屏幕分辨率，越界的地址写不进去、读出0，让固件的RAM探测能认出屏幕
+ * - 每次0x20把RAM内容"刷"到玻璃上并输出一张图片。灰度模式只把黑点加深一级，
+ *   其余模式直接显示RAM内容。红色只在完整波形(0xf7)时改变
+ * - BUSY在波形期间保持高电平，持续时间按刷新模式估计，挂在仿真时钟上
+ * - 每个SPI字节推进仿真时钟，让trace里的上传时间有参考意义
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+
+/******************************************************************************/
+
+// 控制器RAM的最大尺寸(按400x300的屏幕留)
+#define RAM_XB    50
+#define RAM_Y     300
+
+// 估计的时序，单位us
+#define SPI_BYTE_US   20
+#define SWRESET_US    2000
+#define GRAY_STEP     24
+
+static const int wave_ms[4] = {
+	[UPDATE_FULL] = 2000,
+	[UPDATE_FAST] = 600,
+	[UPDATE_FLY]  = 250,
+	[UPDATE_GRAY] = 120,
+};
+
+u32 epd_spi_bytes;
+
+static u8 ram[2][RAM_Y][RAM_XB];
+static int ram_xb = RAM_XB;
+static int ram_y = RAM_Y;
+static int read_plane;
+static u8 lut[256];
+static int lut_len = 70;
+
+// 玻璃上的状态，每个像素一个灰度值(0黑 255白)和是否红色
+static u8 glass[RAM_Y][RAM_XB*8];
+static u8 glass_red[RAM_Y][RAM_XB*8];
+
+static int cur_cmd = -1;
+static int arg_pos;
+static u8 args[8];
+static int entry = 0x03;
+static int xs, xe, ys, ye;
+static int xc, yc;
+static int update_seq;
+static int temp16 = 25*16;     // 温度传感器，单位1/16度
+
+static uint64_t busy_until;
+static int frames;
+static const char *out_dir = ".";
+static int out_pbm;
+
+
+/******************************************************************************/
+
+void sim_panel_config(int lut_size, int w, int h, const char *dir, int pbm)
+{
+	lut_len = lut_size;
+	ram_xb = (w+7)>>3;
+	ram_y = h;
+	out_dir = dir;
+	out_pbm = pbm;
+	memset(glass, 0xff, sizeof(glass));
+	memset(glass_red, 0, sizeof(glass_red));
+}
+
+uint64_t sim_panel_busy_end(void)
+{
+	return (busy_until>sim_time_us())? busy_until : 0;
+}
+
+void sim_panel_temp(int c16)
+{
+	temp16 = c16;
+}
+
+int sim_panel_frames(void)
+{
+	return frames;
+}
+
+int sim_panel_seq(void)
+{
+	return update_seq;
+}
+
+int sim_panel_red(void)
+{
+	int x, y, n = 0;
+
+	for(y=0; y<RAM_Y; y++){
+		for(x=0; x<RAM_XB*8; x++)
+			n += glass_red[y][x];
+	}
+	return n;
+}
+
+
+/******************************************************************************/
+
+// 地址计数器在窗口内前进，data entry mode的AM位为0时先走X
+static void ram_advance(void)
+{
+	int xinc = (entry&1)? 1 : -1;
+	int yinc = (entry&2)? 1 : -1;
+
+	if(entry&4){
+		if(yc==ye){
+			yc = ys;
+			xc = (xc==xe)? xs : xc+xinc;
+		}else{
+			yc += yinc;
+		}
+	}else{
+		if(xc==xe){
+			xc = xs;
+			yc = (yc==ye)? ys : yc+yinc;
+		}else{
+			xc += xinc;
+		}
+	}
+}
+
+static u8 *ram_ptr(int plane)
+{
+	if(xc<0 || xc>=ram_xb || yc<0 || yc>=ram_y)
+		return NULL;
+	return &ram[plane][yc][xc];
+}
+
+
+// 玻璃坐标(面板坐标系，和fb一致)到RAM位置。镜像时固件反向写RAM，这里按同样的方式还原
+static int glass_bit(int plane, int nx, int ny)
+{
+	int xb = nx>>3;
+	int ry = ny;
+
+	if(scr_mode&MIRROR_H)
+		xb = line_bytes-1-xb;
+	if(scr_mode&MIRROR_V)
+		ry = scr_h-1-ny;
+	return (ram[plane][ry][xb]>>(7-(nx&7)))&1;
+}
+
+
+static void panel_dump(void)
+{
+	int rmode = scr_mode&3;
+	int w = (rmode&1)? scr_h : scr_w;
+	int h = (rmode&1)? scr_w : scr_h;
+	uint8_t *rgb = malloc(w*h*3);
+	char name[256];
+	int x, y, nx, ny;
+
+	if(out_dir==NULL){
+		free(rgb);
+		frames += 1;
+		return;
+	}
+	// 和draw_pixel相同的旋转，得到逻辑方向的图片
+	for(y=0; y<h; y++){
+		for(x=0; x<w; x++){
+			if(rmode==0){
+				nx = x; ny = y;
+			}else if(rmode==1){
+				nx = scr_w-1-y; ny = x;
+			}else if(rmode==2){
+				nx = scr_w-1-x; ny = scr_h-1-y;
+			}else{
+				nx = y; ny = scr_h-1-x;
+			}
+			uint8_t *p = rgb + (y*w+x)*3;
+			if(glass_red[ny][nx]){
+				p[0] = 0xff; p[1] = 0; p[2] = 0;
+			}else{
+				p[0] = p[1] = p[2] = glass[ny][nx];
+			}
+		}
+	}
+
+	snprintf(name, sizeof(name), "%s/frame_%03d.%s", out_dir, frames, out_pbm? "pbm" : "png");
+	if(out_pbm)
+		sim_write_pbm(name, w, h, rgb);
+	else
+		sim_write_png(name, w, h, rgb);
+	printf("sim: %s  mode %d  %dx%d\n", name, update_mode, w, h);
+	free(rgb);
+	frames += 1;
+}
+
+
+static void panel_update(void)
+{
+	int x, y;
+	int mode = update_mode&3;
+
+	for(y=0; y<scr_h; y++){
+		for(x=0; x<scr_w; x++){
+			int black = glass_bit(0, x, y)==0;
+			int red = (scr_mode&EPD_BWR) && glass_bit(1, x, y);
+
+			if(mode==UPDATE_GRAY && update_seq==0xc7){
+				// 灰度分层：黑点每刷一次加深一级，白点不动
+				if(black)
+					glass[y][x] = (glass[y][x]>GRAY_STEP)? glass[y][x]-GRAY_STEP : 0;
+			}else{
+				glass[y][x] = black? 0x00 : 0xff;
+				// 红色粒子只有OTP里的完整波形(0xf7)能驱动，快刷时保持原样
+				if(update_seq==0xf7)
+					glass_red[y][x] = red;
+			}
+		}
+	}
+
+	busy_until = sim_time_us() + (uint64_t)wave_ms[mode]*1000;
+	panel_dump();
+}
+
+
+static void panel_cmd(int cmd)
+{
+	cur_cmd = cmd;
+	arg_pos = 0;
+
+	switch(cmd){
+	case 0x12:
+		busy_until = sim_time_us() + SWRESET_US;
+		entry = 0x03;
+		read_plane = 0;
+		break;
+	case 0x20:
+		panel_update();
+		break;
+	case 0x24:
+	case 0x26:
+	case 0x27:
+	case 0x32:
+	case 0x33:
+		break;
+	}
+}
+
+
+static void panel_data(int data)
+{
+	u8 *p;
+
+	if(arg_pos<8)
+		args[arg_pos] = data;
+	arg_pos += 1;
+
+	switch(cur_cmd){
+	case 0x11:
+		entry = data&7;
+		break;
+	case 0x22:
+		update_seq = data;
+		break;
+	case 0x41:
+		read_plane = data&1;
+		break;
+	case 0x32:
+		if(arg_pos<=lut_len)
+			lut[arg_pos-1] = data;
+		break;
+	case 0x44:
+		if(arg_pos==1) xs = data;
+		if(arg_pos==2) xe = data;
+		break;
+	case 0x45:
+		if(arg_pos==2) ys = args[0] | (args[1]<<8);
+		if(arg_pos==4) ye = args[2] | (args[3]<<8);
+		break;
+	case 0x4e:
+		xc = data;
+		break;
+	case 0x4f:
+		if(arg_pos==1) yc = data;
+		if(arg_pos==2) yc = args[0] | (args[1]<<8);
+		break;
+	case 0x24:
+	case 0x26:
+		p = ram_ptr(cur_cmd==0x24? 0 : 1);
+		if(p)
+			*p = data;
+		ram_advance();
+		break;
+	}
+}
+
+
+static int panel_read(void)
+{
+	int value = 0;
+	u8 *p;
+
+	switch(cur_cmd){
+	case 0x33:
+		value = (arg_pos<lut_len)? lut[arg_pos] : 0;
+		break;
+	case 0x1b:
+		value = (arg_pos==0)? (temp16>>4)&0xff : (temp16<<4)&0xf0;
+		break;
+	case 0x27:
+		// 按SSD16xx的习惯，第一个字节是无效的dummy
+		if(arg_pos>0){
+			p = ram_ptr(read_plane);
+			value = p? *p : 0;
+			ram_advance();
+		}
+		break;
+	}
+	arg_pos += 1;
+	return value;
+}
+
+
+/******************************************************************************/
+
+// gpio_config/gpio_set/gpio_get在sim_flash.c中，只有flash用到GPIO
+
+void delay_ms(int ms)
+{
+	sim_advance_us((uint64_t)ms*1000);
+}
+
+
+void epd_hw_init(u32 config0, u32 config1, int w, int h, int mode)
+{
+	scr_w = w;
+	scr_h = h;
+	scr_mode = mode;
+	line_bytes = (scr_w+7)>>3;
+	scr_padding = line_bytes*8-scr_w;
+
+	fb_init();
+	select_layout(scr_h, scr_w);
+}
+
+void epd_hw_open(void) { }
+void epd_hw_close(void) { }
+void epd_hw_resume(void) { }
+
+u32 epd_ticks(void)
+{
+	return lld_evt_time_get();
+}
+
+void epd_reset(int val)
+{
+	if(val==0)
+		cur_cmd = -1;
+}
+
+int epd_wait(void)
+{
+	int timeout = EPD_WAIT_MS;
+
+	while(epd_busy()){
+		if(timeout==0){
+			printk("epd_wait: BUSY timeout\n");
+			return -1;
+		}
+		delay_ms(1);
+		timeout -= 1;
+	}
+	return 0;
+}
+
+int epd_busy(void)
+{
+	return (busy_until>sim_time_us())? 1 : 0;
+}
+
+int epd_busy_gpio(void)
+{
+	return 0x20;
+}
+
+void epd_power(int on)
+{
+	if(on==0)
+		busy_until = 0;
+}
+
+
+static void spi_byte(void)
+{
+	epd_spi_bytes += 1;
+	sim_advance_us(SPI_BYTE_US);
+}
+
+void epd_cmd(int cmd)
+{
+	spi_byte();
+	panel_cmd(cmd);
+}
+
+void epd_data(int data)
+{
+	spi_byte();
+	panel_data(data&0xff);
+}
+
+void epd_cmd1(int cmd, int d0)
+{
+	epd_cmd(cmd);
+	epd_data(d0);
+}
+
+void epd_cmd2(int cmd, int d0, int d1)
+{
+	epd_cmd(cmd);
+	epd_data(d0);
+	epd_data(d1);
+}
+
+void epd_cmd3(int cmd, int d0, int d1, int d2)
+{
+	epd_cmd(cmd);
+	epd_data(d0);
+	epd_data(d1);
+	epd_data(d2);
+}
+
+void epd_cmd4(int cmd, int d0, int d1, int d2, int d3)
+{
+	epd_cmd(cmd);
+	epd_data(d0);
+	epd_data(d1);
+	epd_data(d2);
+	epd_data(d3);
+}
+
+void epd_data_array(u8 *data, int len)
+{
+	for(int i=0; i<len; i++)
+		epd_data(data[i]);
+}
+
+void epd_read(u8 *data, int len)
+{
+	for(int i=0; i<len; i++){
+		spi_byte();
+		data[i] = panel_read();
+	}
+}
+
+void epd_cmd_read(int cmd, u8 *data, int len)
+{
+	epd_cmd(cmd);
+	epd_read(data, len);
+}
+
@@ -0,0 +1,154 @@
+/*
+ * 图片输出：不依赖zlib的PNG(deflate只用不压缩的stored块)和PBM。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+/******************************************************************************/
+
+static uint32_t crc_table[256];
+
+static uint32_t png_crc(const uint8_t *buf, int len, uint32_t crc)
+{
+	int i, j;
+
+	if(crc_table[1]==0){
+		for(i=0; i<256; i++){
+			uint32_t c = i;
+			for(j=0; j<8; j++)
+				c = (c&1)? 0xedb88320^(c>>1) : c>>1;
+			crc_table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for(i=0; i<len; i++)
+		crc = crc_table[(crc^buf[i])&0xff]^(crc>>8);
+	return ~crc;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v>>24;
+	p[1] = v>>16;
+	p[2] = v>>8;
+	p[3] = v;
+}
+
+static void png_chunk(FILE *fp, const char *type, const uint8_t *data, int len)
+{
+	uint8_t hdr[8];
+	uint32_t crc;
+
+	put32(hdr, len);
+	memcpy(hdr+4, type, 4);
+	crc = png_crc(hdr+4, 4, 0);
+	crc = png_crc(data, len, crc);
+
+	fwrite(hdr, 1, 8, fp);
+	fwrite(data, 1, len, fp);
+	put32(hdr, crc);
+	fwrite(hdr, 1, 4, fp);
+}
+
+
+int sim_write_png(const char *name, int w, int h, const uint8_t *rgb)
+{
+	static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	int stride = w*3+1;
+	int raw_len = stride*h;
+	int nblk = (raw_len+65534)/65535;
+	uint8_t *raw, *z, *p;
+	uint8_t ihdr[13];
+	uint32_t a = 1, b = 0;
+	int i, y, n;
+	FILE *fp;
+
+	fp = fopen(name, "wb");
+	if(fp==NULL){
+		printf("sim: can't write %s\n", name);
+		return -1;
+	}
+
+	// 每行前面加一个filter字节(0=None)
+	raw = malloc(raw_len);
+	for(y=0; y<h; y++){
+		raw[y*stride] = 0;
+		memcpy(raw+y*stride+1, rgb+y*w*3, w*3);
+	}
+
+	// zlib头 + stored块 + adler32
+	z = malloc(2+raw_len+nblk*5+4);
+	p = z;
+	*p++ = 0x78;
+	*p++ = 0x01;
+	for(i=0; i<raw_len; i+=n){
+		n = raw_len-i;
+		if(n>65535)
+			n = 65535;
+		*p++ = (i+n==raw_len)? 1 : 0;
+		*p++ = n;
+		*p++ = n>>8;
+		*p++ = ~n;
+		*p++ = (~n)>>8;
+		memcpy(p, raw+i, n);
+		p += n;
+	}
+	for(i=0; i<raw_len; i++){
+		a = (a+raw[i])%65521;
+		b = (b+a)%65521;
+	}
+	put32(p, (b<<16)|a);
+	p += 4;
+
+	put32(ihdr, w);
+	put32(ihdr+4, h);
+	ihdr[8] = 8;    // bit depth
+	ihdr[9] = 2;    // RGB
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+
+	fwrite(sig, 1, 8, fp);
+	png_chunk(fp, "IHDR", ihdr, 13);
+	png_chunk(fp, "IDAT", z, p-z);
+	png_chunk(fp, "IEND", NULL, 0);
+	fclose(fp);
+
+	free(z);
+	free(raw);
+	return 0;
+}
+
+
+// 黑白PBM，灰度按50%阈值，红色当作黑色
+int sim_write_pbm(const char *name, int w, int h, const uint8_t *rgb)
+{
+	int x, y;
+	FILE *fp;
+
+	fp = fopen(name, "wb");
+	if(fp==NULL){
+		printf("sim: can't write %s\n", name);
+		return -1;
+	}
+
+	fprintf(fp, "P4\n%d %d\n", w, h);
+	for(y=0; y<h; y++){
+		uint8_t byte = 0;
+		for(x=0; x<w; x++){
+			const uint8_t *p = rgb+(y*w+x)*3;
+			if(p[1]<0x80)
+				byte |= 0x80>>(x&7);
+			if((x&7)==7 || x==w-1){
+				fputc(byte, fp);
+				byte = 0;
+			}
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
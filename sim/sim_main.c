@@ -0,0 +1,256 @@
+/*
+ * 显示部分的主机仿真。
+ *
+ * 编译固件里的epd.c、epd_gui.c、epd_math.c、epd_trace.c和user_custs1_impl.c，
+ * 屏幕换成sim_hw.c中的模拟控制器，每次刷新输出一张图片。spi_flash.c和ota.c也参与
+ * 编译，下面接sim_flash.c里模拟的SPI flash。
+ *
+ * 脚本每行一条，格式和weble工具生成的命令文件相同:
+ *   93 / 94 0f ... / 9a      十六进制字节，作为写入long value特征值的BLE命令
+ *   w1000                    等待1000ms(仿真时间)
+ * 另外支持:
+ *   m5                       至少走5分钟，和固件的时钟定时器一样按画面的变化唤醒
+ *   t30                      屏幕的温度传感器读数改为30度
+ *   v2700                    电池电压改为2700mV
+ *   # ...                    注释
+ * 不给脚本时运行内置的场景: 开机二维码 -> 对时 -> 依次切换几种显示模式。
+ */
+#include <sys/stat.h>
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_def.h"
+#include "user_custs1_impl.h"
+#include "user_timekeep.h"
+#include "user_adv.h"
+#include "user_batt.h"
+
+/******************************************************************************/
+
+static const char *default_script[] = {
+	"# 2026-02-17 08:30:00 星期二，农历正月初一",
+	"91 ea 07 01 11 08 1e 00 02 06 00 01",
+	"w3000",
+	"m1",
+	"# 切换到日历",
+	"99",
+	"w3000",
+	"# 切换到自定义时钟",
+	"99",
+	"w3000",
+	"m30",
+	NULL,
+};
+
+
+static void sim_ble_write(const char *line)
+{
+	uint8_t buf[sizeof(struct custs1_val_write_ind)+DEF_SVC1_LONG_VALUE_CHAR_LEN];
+	struct custs1_val_write_ind *ind = (struct custs1_val_write_ind *)buf;
+	const char *p = line;
+	int n = 0, v, len;
+
+	memset(buf, 0, sizeof(buf));
+	while(n<DEF_SVC1_LONG_VALUE_CHAR_LEN && sscanf(p, "%x%n", &v, &len)==1){
+		ind->value[n++] = v;
+		p += len;
+	}
+	if(n==0)
+		return;
+
+	ind->handle = SVC1_IDX_LONG_VALUE_VAL;
+	ind->length = n;
+	user_svc1_long_val_wr_ind_handler(CUSTS1_VAL_WRITE_IND, ind, TASK_APP, TASK_ID_CUSTS1);
+}
+
+
+// 和user_peripheral.c中app_clock_timer_cb的显示部分一致
+static void sim_wake(void)
+{
+	int stat, flags = UPDATE_FLY;
+
+	// 定时器到期，走过这个周期，再按画面下一次变化的时刻开始下一个周期
+	sim_run(sim_clock_ms);
+	stat = clock_update(sim_clock_sec);
+	batt_tick(sim_clock_sec);
+	if(batt_state()==BATT_EMPTY){
+		// 固件在这里停止时钟定时器，之后只剩低电量画面
+		Update_Mode = LB_MODE;
+		per_min_draw_default();
+		sim_clock_sec = 0;
+		return;
+	}
+	sim_clock_sec = clock_next_change();
+	sim_clock_ms = timekeep_next(sim_clock_sec)*10;
+	sim_wakes += 1;
+
+	if(stat>=3){
+		flags = DRAW_BT | UPDATE_FULL;
+	}else if(stat>=2){
+		flags = DRAW_BT | UPDATE_FAST;
+	}
+
+	if((stat>0 || flags&DRAW_BT) && clock_screen_changed()){
+		Update_Mode = Default_Update_Mode;
+		per_min_draw(flags);
+	}
+}
+
+
+// 至少走过n分钟。定时器按实际的周期唤醒，最后一个周期可能超过n分钟
+static void sim_minutes(int n)
+{
+	int sec = n*60;
+	int wakes = sim_wakes;
+
+	while(sec>0 && sim_clock_sec>0){
+		sec -= sim_clock_sec;
+		sim_wake();
+	}
+	printf("%d min: %d wakes  %02d:%02d:%02d\n", n, sim_wakes-wakes, hour, minute, second);
+}
+
+
+static void sim_line(const char *line)
+{
+	int n;
+
+	while(*line==' ' || *line=='\t')
+		line += 1;
+
+	if(line[0]=='#' || line[0]=='\0' || line[0]=='\r' || line[0]=='\n')
+		return;
+
+	if(line[0]=='w'){
+		sim_run(atoi(line+1));
+	}else if(line[0]=='v'){
+		sim_vbat_mv = atoi(line+1);
+	}else if(line[0]=='t'){
+		sim_panel_temp(atoi(line+1)*16);
+	}else if(line[0]=='m'){
+		n = atoi(line+1);
+		sim_minutes(n);
+	}else{
+		sim_ble_write(line);
+	}
+}
+
+
+static void usage(void)
+{
+	printf("usage: epd_sim [-o dir] [-s WxH] [-r rotate] [-R] [-l lut_size] [-p] [-f flash] [-b] [-a hours] [script|-]\n");
+	printf("  -o dir    图片输出目录(默认out)\n");
+	printf("  -s WxH    屏幕分辨率(默认122x250)，固件按探测到的控制器RAM大小自己选\n");
+	printf("  -r n      旋转0-3(默认3)\n");
+	printf("  -R        三色屏(BWR)，相当于flash配置区里记录了三色屏\n");
+	printf("  -l n      控制器LUT大小，70或100(默认70)\n");
+	printf("  -p        输出PBM而不是PNG\n");
+	printf("  -f file   flash的内容保存在文件里，下次运行接着用\n");
+	printf("  -b        只运行绘图基准测试\n");
+	printf("  -a hours  只估算广播的平均电流\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *out = "out";
+	const char *script = NULL;
+	const char *flash = NULL;
+	int w = 122, h = 250, rot = 3, bwr = 0, lut = 70, pbm = 0, bench = 0, adv = 0;
+	int mode;
+	char line[1024];
+	int i;
+
+	for(i=1; i<argc; i++){
+		if(strcmp(argv[i], "-o")==0 && i+1<argc){
+			out = argv[++i];
+		}else if(strcmp(argv[i], "-s")==0 && i+1<argc){
+			sscanf(argv[++i], "%dx%d", &w, &h);
+		}else if(strcmp(argv[i], "-r")==0 && i+1<argc){
+			rot = atoi(argv[++i])&3;
+		}else if(strcmp(argv[i], "-R")==0){
+			bwr = 1;
+		}else if(strcmp(argv[i], "-l")==0 && i+1<argc){
+			lut = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-p")==0){
+			pbm = 1;
+		}else if(strcmp(argv[i], "-f")==0 && i+1<argc){
+			flash = argv[++i];
+		}else if(strcmp(argv[i], "-b")==0){
+			bench = 1;
+		}else if(strcmp(argv[i], "-a")==0 && i+1<argc){
+			adv = atoi(argv[++i]);
+		}else if(argv[i][0]=='-' && argv[i][1]!='\0'){
+			usage();
+			return 1;
+		}else{
+			script = argv[i];
+		}
+	}
+
+	if(adv>0){
+		sim_adv_duty(adv);
+		return 0;
+	}
+
+	if(((w+7)>>3)*h > FB_SIZE){
+		printf("%dx%d needs %d bytes of framebuffer, FB_SIZE is %d\n", w, h, ((w+7)>>3)*h, FB_SIZE);
+		return 1;
+	}
+	if(flash && sim_flash_file(flash)<0)
+		return 1;
+	mkdir(out, 0755);
+	sim_panel_config(lut, w, h, out, pbm);
+	if(bwr)
+		detect_mode = EPD_BWR;
+
+	// 和user_app_init/user_app_on_db_init_complete相同的启动流程
+	boot_t0 = epd_ticks();
+	boot_timing = 1;
+	sim_firm_init();
+	fspi_config(SIM_FSPI_PINS);
+	selflash(0x1234a5a5);
+	epd_hw_init(0, 0, 122, 250, EPD_BW | rot);
+	epd_detect();
+	epd_panel_select(&w, &h, &mode);
+	epd_hw_init(0, 0, w, h, mode | rot);
+	kv_init();
+	settings_load();
+	timekeep_init();
+	adv_policy_init();
+	date_sync();
+
+	if(bench){
+		epd_bench_run();
+		return 0;
+	}
+
+	batt_init();
+	adv_policy_event(ADV_EV_BOOT);
+	Update_Mode = QR_MODE;
+	per_min_draw_default();
+	sim_idle(60*1000);
+
+	if(script){
+		FILE *fp = (strcmp(script, "-")==0)? stdin : fopen(script, "r");
+		if(fp==NULL){
+			printf("can't open %s\n", script);
+			return 1;
+		}
+		while(fgets(line, sizeof(line), fp))
+			sim_line(line);
+		if(fp!=stdin)
+			fclose(fp);
+	}else{
+		for(i=0; default_script[i]; i++)
+			sim_line(default_script[i]);
+	}
+
+	sim_idle(60*1000);
+	epd_trace_dump();
+	printf("sim: %d frames, %.3f s simulated\n", sim_panel_frames(), sim_time_us()/1e6);
+	printf("sim: static layer %d bytes\n", layer_size());
+
+	return 0;
+}
+
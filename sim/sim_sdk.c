@@ -0,0 +1,350 @@
+/*
+ * SDK桩函数：软件定时器、唤醒控制器、BLE消息和user_peripheral.c里的全局变量。
+ * 定时器和BUSY中断都挂在仿真时钟上，事件按时间顺序执行。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_def.h"
+#include "user_custs1_impl.h"
+#include "user_timekeep.h"
+
+/******************************************************************************/
+
+static uint64_t sim_now;
+
+uint64_t sim_time_us(void)
+{
+	return sim_now;
+}
+
+void sim_advance_us(uint64_t us)
+{
+	sim_now += us;
+}
+
+// BLE基准时钟，625us一个slot，27位
+uint32_t lld_evt_time_get(void)
+{
+	return (uint32_t)(sim_now/625)&0x07ffffff;
+}
+
+
+/******************************************************************************/
+
+static int sleep_mode = ARCH_EXT_SLEEP_ON;
+
+void arch_set_sleep_mode(int mode)
+{
+	sleep_mode = mode;
+}
+
+int arch_get_sleep_mode(void)
+{
+	return sleep_mode;
+}
+
+
+/******************************************************************************/
+
+// app_easy_timer: 单位10ms，句柄从1开始，0是无效句柄
+#define SIM_TIMERS  16
+
+static struct {
+	uint64_t due;
+	void (*fn)(void);
+}timers[SIM_TIMERS];
+
+timer_hnd app_easy_timer(const uint32_t delay, void (*fn)(void))
+{
+	int i;
+
+	for(i=0; i<SIM_TIMERS; i++){
+		if(timers[i].fn==NULL){
+			timers[i].fn = fn;
+			timers[i].due = sim_now + (uint64_t)delay*10000;
+			return i+1;
+		}
+	}
+	printf("sim: out of timers\n");
+	return EASY_TIMER_INVALID_TIMER;
+}
+
+void app_easy_timer_cancel(const timer_hnd timer_id)
+{
+	if(timer_id>0 && timer_id<=SIM_TIMERS)
+		timers[timer_id-1].fn = NULL;
+}
+
+timer_hnd app_easy_timer_modify(const timer_hnd timer_id, uint32_t delay)
+{
+	if(timer_id>0 && timer_id<=SIM_TIMERS && timers[timer_id-1].fn)
+		timers[timer_id-1].due = sim_now + (uint64_t)delay*10000;
+	return timer_id;
+}
+
+int sim_timer_pending(void)
+{
+	int i, n = 0;
+
+	for(i=0; i<SIM_TIMERS; i++){
+		if(timers[i].fn)
+			n += 1;
+	}
+	return n;
+}
+
+
+/******************************************************************************/
+
+// 唤醒控制器，只模拟BUSY引脚的下降沿
+static void (*wkup_cb)(void);
+static void (*wakeup_fn)(void);
+static int wkup_armed;
+static int wakeup_pending;
+
+void wkupct_register_callback(void (*callback)(void))
+{
+	wkup_cb = callback;
+}
+
+void wkupct_enable_irq(uint32_t sel_pins, uint32_t pol_pins, uint16_t events_num, uint16_t deb_time)
+{
+	wkup_armed = 1;
+}
+
+void wkupct_disable_irq(void)
+{
+	wkup_armed = 0;
+}
+
+void app_easy_wakeup_set(void (*fn)(void))
+{
+	wakeup_fn = fn;
+}
+
+// 真实SDK里这会给应用任务发一条消息，这里也推迟到中断处理之后执行
+void app_easy_wakeup(void)
+{
+	wakeup_pending = 1;
+}
+
+int sim_wkup_armed(void)
+{
+	return wkup_armed;
+}
+
+void sim_wkup_fire(void)
+{
+	if(wkup_armed && wkup_cb)
+		wkup_cb();
+	if(wakeup_pending && wakeup_fn){
+		wakeup_pending = 0;
+		wakeup_fn();
+	}
+}
+
+bool arch_ble_ext_wakeup_get(void) { return false; }
+void arch_ble_force_wakeup(void) { }
+void arch_ble_ext_wakeup_off(void) { }
+
+
+/******************************************************************************/
+
+// 执行下一个事件(定时器或BUSY下降沿)，如果它在limit之前。返回0表示没有事件
+static int sim_step(uint64_t limit)
+{
+	uint64_t due = limit;
+	uint64_t busy_end;
+	int i, next = -1;
+
+	for(i=0; i<SIM_TIMERS; i++){
+		if(timers[i].fn && timers[i].due<=due){
+			due = timers[i].due;
+			next = i;
+		}
+	}
+
+	busy_end = sim_panel_busy_end();
+	if(wkup_armed && busy_end && busy_end<=due){
+		if(busy_end>sim_now)
+			sim_now = busy_end;
+		sim_wkup_fire();
+		return 1;
+	}
+
+	if(next<0)
+		return 0;
+
+	if(due>sim_now)
+		sim_now = due;
+	void (*fn)(void) = timers[next].fn;
+	timers[next].fn = NULL;
+	fn();
+	return 1;
+}
+
+void sim_run(int ms)
+{
+	uint64_t limit = sim_now + (uint64_t)ms*1000;
+
+	while(sim_step(limit))
+		;
+	if(limit>sim_now)
+		sim_now = limit;
+}
+
+void sim_idle(int limit_ms)
+{
+	uint64_t limit = sim_now + (uint64_t)limit_ms*1000;
+
+	while(sim_timer_pending() || (wkup_armed && sim_panel_busy_end())){
+		if(sim_step(limit)==0)
+			break;
+	}
+}
+
+
+/******************************************************************************/
+
+// BLE消息：只记下写到特征值数据库里的内容
+struct app_env_tag app_env[1];
+
+static uint8_t att_val[CUSTS1_IDX_NB][DEF_SVC1_LONG_VALUE_CHAR_LEN];
+static int att_len[CUSTS1_IDX_NB];
+
+// 测试用: 每次给主机发通知都调用它
+void (*sim_notify)(int handle, const uint8_t *value, int len);
+
+ke_task_id_t prf_get_task_from_id(int id)
+{
+	return id;
+}
+
+struct sim_msg {
+	int id;
+	uint8_t param[];
+};
+
+void *sim_msg_alloc(int id, int size)
+{
+	struct sim_msg *msg = calloc(1, sizeof(struct sim_msg)+size);
+
+	msg->id = id;
+	return msg->param;
+}
+
+static int att_set(int handle, const uint8_t *value, int len)
+{
+	if(len>DEF_SVC1_LONG_VALUE_CHAR_LEN)
+		len = DEF_SVC1_LONG_VALUE_CHAR_LEN;
+	if(handle<CUSTS1_IDX_NB){
+		memcpy(att_val[handle], value, len);
+		att_len[handle] = len;
+	}
+	return len;
+}
+
+// 通知也更新数据库里的值，和协议栈一样
+void sim_msg_send(void *param)
+{
+	struct sim_msg *msg = (struct sim_msg *)((uint8_t *)param - offsetof(struct sim_msg, param));
+
+	if(msg->id==CUSTS1_VAL_SET_REQ){
+		struct custs1_val_set_req *req = param;
+		att_set(req->handle, req->value, req->length);
+	}else if(msg->id==CUSTS1_VAL_NTF_REQ){
+		struct custs1_val_ntf_ind_req *req = param;
+		int len = att_set(req->handle, req->value, req->length);
+		if(sim_notify)
+			sim_notify(req->handle, req->value, len);
+	}
+	free(msg);
+}
+
+// 主机读特征值。返回长度
+int sim_att_read(int handle, uint8_t *buf)
+{
+	if(handle>=CUSTS1_IDX_NB)
+		return 0;
+	memcpy(buf, att_val[handle], att_len[handle]);
+	return att_len[handle];
+}
+
+
+/******************************************************************************/
+
+// 其余外设
+void adc_offset_calibrate(int mode) { }
+
+// 电池电压，脚本里用v<mV>改变。屏幕刷新(BUSY)时低sim_vbat_sag_mv
+int sim_vbat_mv = 3000;
+int sim_vbat_sag_mv = 0;
+
+uint16_t adc_get_vbat_sample(bool sample_vbat1v)
+{
+	int mv = sim_vbat_mv;
+
+	if(epd_busy())
+		mv -= sim_vbat_sag_mv;
+	return mv*128/225;
+}
+
+void hw_otpc_init(void) { }
+void hw_otpc_manual_read_on(bool spi_en) { }
+void hw_otpc_disable(void) { }
+
+
+/******************************************************************************/
+
+// user_peripheral.c中的全局变量和函数。它直接读OTP地址，不参与主机编译
+char adv_name[20] = "\x11\x09" "DLG-CLOCK-000000";
+char *bt_id = adv_name + 12;
+const int boot_debug = 1;
+
+// 时钟定时器当前的周期，由sim_wake()使用
+int sim_clock_sec = 60;
+int sim_clock_ms = 60*1000;
+int sim_wakes;
+
+void app_clock_timer_restart(void)
+{
+	sim_clock_sec = clock_next_change();
+	sim_clock_ms = timekeep_next(sim_clock_sec)*10;
+}
+
+void app_clock_timer_reschedule(void)
+{
+	clock_update(timekeep_cut());
+	sim_clock_sec = clock_next_change();
+	sim_clock_ms = timekeep_next(sim_clock_sec)*10;
+}
+
+
+// spi_flash.c里selflash用的"正在运行的固件"。内容是固定的伪随机数，每次都一样
+uint8_t sim_firm[SIM_FIRM_SIZE+256]; // selflash按整page读，最后一个page会超出固件的长度
+int sim_firm_size = SIM_FIRM_SIZE;
+
+void sim_firm_init(void)
+{
+	uint32_t x = 0x2545f491;
+	int i;
+
+	for(i=0; i<SIM_FIRM_SIZE; i++){
+		x ^= x<<13;
+		x ^= x>>17;
+		x ^= x<<5;
+		sim_firm[i] = x;
+	}
+}
+
+// 写SYS_CTRL_REG的SW_RESET位就是复位，记下次数，仿真继续运行
+int sim_resets;
+
+void sim_set_word16(int reg, int val)
+{
+	if(reg==SYS_CTRL_REG && (val&SW_RESET)){
+		printf("sim: software reset\n");
+		sim_resets += 1;
+	}
+}
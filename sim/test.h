@@ -0,0 +1,37 @@
+/*
+ * 主机上的单元测试(make check)。
+ * 每个test_xxx.c提供一个或几个测试函数，在test_main.c的表里登记。
+ */
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+extern int test_fails;
+
+// 条件不成立时打印位置和说明，计一次失败，测试继续
+#define CHECK(cond, ...) do{ \
+	if(!(cond)){ \
+		printf("%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_fails += 1; \
+	} \
+}while(0)
+
+// 公历的下一天，月份和日期从1开始，不依赖固件的日期函数
+void test_next_day(int *y, int *m, int *d);
+
+// 和开机一样配置250x122的模拟屏幕，不输出图片。bwr为1时是三色屏，返回屏幕的mode
+int test_panel(int bwr);
+
+void test_batt(void);
+void test_bwr(void);
+void test_lunar(void);
+void test_crc32(void);
+void test_date(void);
+void test_kvs(void);
+void test_ota(void);
+void test_timekeep(void);
+
+#endif
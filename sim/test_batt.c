@@ -0,0 +1,93 @@
+/*
+ * 电池电压的滤波和低电量判断(user_batt.c)。
+ *
+ * 模拟的电池在屏幕刷新时电压低sim_vbat_sag_mv。检查:
+ *   - 带负载和空载的采样各自滤波，空载采样不会把带负载的值拉高
+ *   - 一次刷新的电压偶然很低不会进入BATT_EMPTY
+ *   - 连续两次带负载的电压低于阈值才进入BATT_EMPTY
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_impl.h"
+#include "user_batt.h"
+#include "test.h"
+
+#include <stdlib.h>
+
+/******************************************************************************/
+
+#define PERIOD  (30*60)    // 和user_batt.c相同: 刷新后采样的最短间隔
+#define STALE   (2*3600)   // 这么久没有刷新，空载采样一次
+
+
+static void set_batt(int mv, int sag)
+{
+	sim_vbat_mv = mv;
+	sim_vbat_sag_mv = sag;
+	batt_init();
+}
+
+
+// 过了采样间隔以后刷新一次，波形期间带负载采样。返回刷新的帧数
+static int refresh(int sag)
+{
+	int frames = sim_panel_frames();
+
+	sim_vbat_sag_mv = sag;
+	batt_tick(PERIOD);
+	per_min_draw(UPDATE_FULL);
+	sim_idle(30*1000);
+	return sim_panel_frames()-frames;
+}
+
+
+// 滤波值换算成mV时有截断，差几mV算相等
+static int near(int mv, int want)
+{
+	return abs(mv-want)<=5;
+}
+
+
+void test_batt(void)
+{
+	int n;
+
+	test_panel(0);
+	Update_Mode = CLOCK_MODE;
+
+	// 开机空载采样，刷新时带负载。报告的是最近的带负载电压
+	set_batt(2900, 150);
+	CHECK(near(batt_volt(), 2900) && batt_state()==BATT_OK, "boot: %d mV state %d", batt_volt(), batt_state());
+	n = refresh(150);
+	CHECK(n==1, "%d frames", n);
+	CHECK(near(batt_volt(), 2750), "loaded: %d mV", batt_volt());
+
+	// 很久没有刷新，空载采样，报告空载的电压；再刷新时带负载的滤波值不受它影响
+	batt_tick(STALE);
+	CHECK(near(batt_volt(), 2900), "stale: %d mV", batt_volt());
+	refresh(150);
+	CHECK(near(batt_volt(), 2750), "loaded after a rest sample: %d mV", batt_volt());
+
+	// 第一次带负载的采样偶然很低(2300mV)，之后正常
+	set_batt(2900, 600);
+	refresh(600);
+	CHECK(batt_state()!=BATT_EMPTY, "empty after one low loaded sample: %d mV", batt_volt());
+	refresh(100);
+	CHECK(batt_state()!=BATT_EMPTY, "empty after a normal sample: %d mV", batt_volt());
+
+	// 电池真的耗尽了，带负载一直低于阈值
+	set_batt(2600, 300);
+	refresh(300);
+	CHECK(batt_state()!=BATT_EMPTY, "empty after one loaded sample: %d mV", batt_volt());
+	refresh(300);
+	CHECK(batt_state()==BATT_EMPTY, "not empty after two loaded samples: %d mV state %d", batt_volt(), batt_state());
+
+	// 空载的电压回升也不退出
+	batt_tick(STALE);
+	CHECK(batt_state()==BATT_EMPTY, "left BATT_EMPTY: %d mV", batt_volt());
+
+	sim_vbat_mv = 3000;
+	sim_vbat_sag_mv = 0;
+	batt_init();
+}
@@ -0,0 +1,82 @@
+/*
+ * 三色屏的刷新方式(epd.c的epd_update)。
+ *
+ * 红色只有OTP里的完整波形能驱动。红色平面和玻璃上一样时每分钟的刷新照常快刷，
+ * 红色有变化时才全刷。检查时钟和日历两种画面，日期是有节气(红色)的一天。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_impl.h"
+#include "test.h"
+
+/******************************************************************************/
+
+#define SEQ_FULL  0xf7
+
+
+static void set_day(int y, int m, int d)
+{
+	year = y;
+	month = m-1;
+	date = d-1;
+	hour = 10;
+	minute = 0;
+	second = 0;
+	date_sync();
+}
+
+
+// 画一帧，等刷新结束。返回这次刷新的0x22序列，没有刷新返回-1
+static int draw(int flags)
+{
+	int frames = sim_panel_frames();
+
+	per_min_draw(flags);
+	sim_idle(30*1000);
+	if(sim_panel_frames()==frames)
+		return -1;
+	return sim_panel_seq();
+}
+
+
+static void check_mode(int mode, const char *name)
+{
+	int seq, red;
+
+	Update_Mode = mode;
+	Default_Update_Mode = mode;
+
+	// 春分，整点的全刷画出红色
+	set_day(2026, 3, 20);
+	seq = draw(UPDATE_FULL);
+	red = sim_panel_red();
+	CHECK(seq==SEQ_FULL && red>0, "%s: full refresh on a term day: seq %02x  %d red", name, seq, red);
+
+	// 之后每分钟的刷新红色不变，仍然快刷，红色留在玻璃上
+	minute = 1;
+	seq = draw(UPDATE_FLY);
+	CHECK(seq>=0 && seq!=SEQ_FULL, "%s: minute tick on a term day: seq %02x", name, seq);
+	CHECK(sim_panel_red()==red, "%s: red %d after a fast refresh, want %d", name, sim_panel_red(), red);
+	minute = 2;
+	seq = draw(UPDATE_FAST);
+	CHECK(seq>=0 && seq!=SEQ_FULL, "%s: second minute tick: seq %02x", name, seq);
+
+	// 第二天没有节气，时钟画面的红色没有了，要全刷擦掉
+	if(mode==CLOCK_MODE){
+		set_day(2026, 3, 21);
+		seq = draw(UPDATE_FLY);
+		CHECK(seq==SEQ_FULL && sim_panel_red()==0, "%s: red removed: seq %02x  %d red", name, seq, sim_panel_red());
+		minute = 1;
+		seq = draw(UPDATE_FLY);
+		CHECK(seq>=0 && seq!=SEQ_FULL, "%s: minute tick without red: seq %02x", name, seq);
+	}
+}
+
+
+void test_bwr(void)
+{
+	CHECK(test_panel(1)&EPD_BWR, "not a BWR panel");
+	check_mode(CLOCK_MODE, "clock");
+	check_mode(CALENDAR_MODE, "calendar");
+}
@@ -0,0 +1,54 @@
+/*
+ * CRC-32(crc32.c)。标准测试向量，再和逐位计算的结果比较: 各种长度、非对齐的起点、
+ * 分两段计算。slicing-by-4按字处理，开头和结尾的零头最容易出错。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "test.h"
+
+/******************************************************************************/
+
+static u32 crc32_bitwise(u32 crc, const u8 *p, int len)
+{
+	int j;
+
+	crc = ~crc;
+	while(len--){
+		crc ^= *p++;
+		for(j=0; j<8; j++)
+			crc = (crc&1)? 0xedb88320^(crc>>1) : crc>>1;
+	}
+	return ~crc;
+}
+
+
+void test_crc32(void)
+{
+	static const char *vec[] = {"", "a", "abc", "123456789", "The quick brown fox jumps over the lazy dog"};
+	static const u32 ref[] = {0x00000000, 0xe8b7be43, 0x352441c2, 0xcbf43926, 0x414fa339};
+	static u8 data[600];
+	u32 x = 0x12345678, want;
+	int i, n, off, len;
+
+	for(i=0; i<5; i++){
+		n = strlen(vec[i]);
+		CHECK(crc32(0, vec[i], n)==ref[i], "\"%s\": %08x, want %08x", vec[i], crc32(0, vec[i], n), ref[i]);
+		CHECK(crc32(crc32(0, vec[i], n/2), vec[i]+n/2, n-n/2)==ref[i], "\"%s\" in two parts", vec[i]);
+	}
+
+	for(i=0; i<(int)sizeof(data); i++){
+		x ^= x<<13;
+		x ^= x>>17;
+		x ^= x<<5;
+		data[i] = x;
+	}
+	for(off=0; off<4; off++){
+		for(len=0; len<=300; len++){
+			want = crc32_bitwise(0, data+off, len);
+			CHECK(crc32(0, data+off, len)==want, "offset %d length %d", off, len);
+			n = len/3;
+			CHECK(crc32(crc32(0, data+off, n), data+off+n, len-n)==want, "offset %d length %d split at %d", off, len, n);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * 公历日期运算(epd_date.c)和用到它的date_inc、days_until。
+ *
+ * 从1926-01-01逐日走到2126-12-31，也就是现在前后各100年，包括1970年以前的负天数和
+ * 2000、2100这两种整百年。每一天检查天数、反算的日期、星期和当月的天数。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_impl.h"
+#include "test.h"
+
+/******************************************************************************/
+
+#define FIRST_DAYS  (-16071)   // 1926-01-01距1970-01-01的天数
+#define FIRST_WDAY  5          // 1926-01-01是星期五
+#define NUM_DAYS    73414      // 到2126-12-31
+
+// 没有放进头文件的固件函数
+void date_inc(void);
+int days_until(int target_year, int target_month, int target_day);
+
+
+void test_date(void)
+{
+	static const int mdays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	int y = 1926, m = 1, d = 1;
+	int i, days, leap, ry, rm, rd;
+	int wd = FIRST_WDAY;
+
+	for(i=0; i<NUM_DAYS; i++){
+		days = days_from_civil(y, m-1, d-1);
+		CHECK(days==FIRST_DAYS+i, "%04d-%02d-%02d: days %d, want %d", y, m, d, days, FIRST_DAYS+i);
+
+		civil_from_days(FIRST_DAYS+i, &ry, &rm, &rd);
+		CHECK(ry==y && rm==m-1 && rd==d-1, "civil_from_days(%d): %04d-%02d-%02d, want %04d-%02d-%02d",
+			FIRST_DAYS+i, ry, rm+1, rd+1, y, m, d);
+
+		CHECK(weekday_from_days(FIRST_DAYS+i)==wd, "%04d-%02d-%02d: weekday %d, want %d",
+			y, m, d, weekday_from_days(FIRST_DAYS+i), wd);
+
+		if(d==1){
+			leap = (y%4==0 && y%100!=0) || y%400==0;
+			CHECK(is_leap_year(y)==leap, "is_leap_year(%d)", y);
+			CHECK(days_in_month(y, m-1)==mdays[m-1]+(m==2 && leap), "days_in_month(%d, %d)", y, m-1);
+		}
+
+		// date_inc在全局变量上走一天
+		year = y;
+		month = m-1;
+		date = d-1;
+		wday = wd;
+		test_next_day(&y, &m, &d);
+		wd = (wd+1)%7;
+		date_inc();
+		CHECK(year==y && month==m-1 && date==d-1 && wday==wd, "date_inc to %04d-%02d-%02d: %04d-%02d-%02d %d",
+			y, m, d, year, month+1, date+1, wday);
+	}
+	CHECK(y==2127 && m==1 && d==1, "stopped at %04d-%02d-%02d", y, m, d);
+
+	// 跨过整百年和闰日的天数差
+	year = 2026;
+	month = 9;
+	date = 18;
+	CHECK(days_until(2026, 9, 18)==0, "same day");
+	CHECK(days_until(2026, 9, 19)==1, "tomorrow");
+	CHECK(days_until(2025, 9, 18)==-365, "last year");
+	CHECK(days_until(2028, 2, 0)-days_until(2028, 1, 28)==1, "2028-02-29");
+	CHECK(days_until(2126, 9, 18)==36524, "100 years ahead, without 2100-02-29: %d", days_until(2126, 9, 18));
+	CHECK(days_until(1926, 9, 18)==-36525, "100 years back: %d", days_until(1926, 9, 18));
+}
@@ -0,0 +1,194 @@
+/*
+ * flash上的键值存储(kvs.c)，flash用sim_flash.c的模拟。
+ *
+ * 检查读写和重启后的值，相同的值不重复写，写满一个扇区后搬到另一个扇区，
+ * 以及掉电的两种情况: 写了一半的记录，和搬了一半(新扇区还没有头)。
+ * 还有flash正忙(OTA的page还在写)和OTA升级中的写，以及记录中间有空洞的扇区。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "test.h"
+
+/******************************************************************************/
+
+#define KV_ADDR0    0x3e000
+#define KV_ADDR1    0x3f000
+#define KV_SECTOR   0x1000
+#define KV_MAGIC    0x3153564b
+#define OTA_ADDR    0x20000     // 随便一个不在KV扇区里的page
+
+static u8 *flash;
+
+
+static u32 hdr_word(int base, int i)
+{
+	return *(u32*)(flash+base+i*4);
+}
+
+
+static void set_hdr(int base, u32 seq)
+{
+	u32 hdr[2] = {KV_MAGIC, seq};
+
+	memcpy(flash+base, hdr, 8);
+}
+
+
+static int get_u32(int key, u32 *v)
+{
+	return kv_get(key, v, 4);
+}
+
+
+void test_kvs(void)
+{
+	u8 buf[200], big[128];
+	u32 v;
+	int i, n, ops, erases, seq;
+
+	fspi_config(SIM_FSPI_PINS);
+	flash = sim_flash_data();
+	memset(flash+KV_ADDR0, 0xff, 2*KV_SECTOR);
+
+	// 空的flash: 格式化第一个扇区
+	kv_init();
+	CHECK(hdr_word(KV_ADDR0, 0)==KV_MAGIC && hdr_word(KV_ADDR0, 1)==1, "format: %08x %d",
+		hdr_word(KV_ADDR0, 0), hdr_word(KV_ADDR0, 1));
+	CHECK(kv_get(1, buf, sizeof(buf))==-1, "missing key");
+
+	// 读写
+	v = 0x11111111;
+	CHECK(kv_set(1, &v, 4)==0, "set");
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x11111111, "get %08x", v);
+	v = 0x22222222;
+	kv_set(1, &v, 4);
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x22222222, "overwrite %08x", v);
+	CHECK(kv_set(2, "abc", 3)==0 && kv_get(2, buf, sizeof(buf))==3 && memcmp(buf, "abc", 3)==0, "3 bytes");
+	CHECK(kv_set(3, "", 0)==0 && kv_get(3, buf, sizeof(buf))==0, "empty value");
+	CHECK(kv_get(2, buf, 2)==2, "short buffer");
+	for(i=0; i<128; i++)
+		big[i] = i*7;
+	CHECK(kv_set(4, big, 128)==0 && kv_get(4, buf, sizeof(buf))==128 && memcmp(buf, big, 128)==0, "128 bytes");
+	CHECK(kv_set(5, buf, 129)==-1, "129 bytes accepted");
+	CHECK(kv_set(0xff, &v, 4)==-1, "key 0xff accepted");
+
+	// 和最新值相同时不写
+	ops = sim_flash_ops[0];
+	v = 0x22222222;
+	CHECK(kv_set(1, &v, 4)==0, "same value");
+	CHECK(sim_flash_ops[0]==ops, "same value written again");
+
+	// 重启后还在
+	kv_init();
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x22222222, "after reboot %08x", v);
+	CHECK(kv_get(4, buf, sizeof(buf))==128 && memcmp(buf, big, 128)==0, "128 bytes after reboot");
+
+	// 写了一半的记录: 数据没写对，校验不过，用前一条
+	v = 0x33333333;
+	kv_set(1, &v, 4);
+	for(i=KV_SECTOR-4; i>=8; i-=4){
+		if(*(u32*)(flash+KV_ADDR0+i)==0x33333333)
+			break;
+	}
+	CHECK(i>=8, "record not found");
+	flash[KV_ADDR0+i+1] &= 0x0f;
+	kv_init();
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x22222222, "torn record: %08x", v);
+	v = 0x44444444;
+	kv_set(1, &v, 4);
+	kv_init();
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x44444444, "after torn record: %08x", v);
+
+	// 写满以后搬到另一个扇区，每个key保留最新值
+	erases = sim_flash_ops[1];
+	seq = hdr_word(KV_ADDR0, 1);
+	for(n=0; n<1000; n++){
+		v = n;
+		CHECK(kv_set(10+(n&3), &v, 4)==0, "set failed at %d", n);
+		if(hdr_word(KV_ADDR1, 0)==KV_MAGIC)
+			break;
+	}
+	CHECK(n<1000, "no compaction");
+	CHECK(sim_flash_ops[1]==erases+1, "%d erases", sim_flash_ops[1]-erases);
+	CHECK(hdr_word(KV_ADDR1, 0)==KV_MAGIC && hdr_word(KV_ADDR1, 1)==seq+1, "new sector %08x %d",
+		hdr_word(KV_ADDR1, 0), hdr_word(KV_ADDR1, 1));
+	kv_init();
+	for(i=0; i<4; i++){
+		v = 0;
+		CHECK(get_u32(10+i, &v)==4 && v==n-((n-i)&3), "key %d after compaction: %d", 10+i, v);
+	}
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x44444444, "key 1 after compaction: %08x", v);
+	CHECK(kv_get(4, buf, sizeof(buf))==128 && memcmp(buf, big, 128)==0, "128 bytes after compaction");
+
+	// 再写满一次，这次搬回第一个扇区后掉电，头还没写: 下次启动还用旧扇区
+	for(n+=1; n<2000; n++){
+		v = n;
+		kv_set(10+(n&3), &v, 4);
+		if(hdr_word(KV_ADDR0, 1)==seq+2)
+			break;
+	}
+	CHECK(n<2000, "no second compaction");
+	memset(flash+KV_ADDR0, 0xff, 8);
+	kv_init();
+	v = 0;
+	CHECK(get_u32(10+(n&3), &v)==4 && v==n-4, "interrupted compaction: key %d is %d, want %d", 10+(n&3), v, n-4);
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x44444444, "key 1 after interrupted compaction: %08x", v);
+	v = 1234;
+	CHECK(kv_set(20, &v, 4)==0, "set after interrupted compaction");
+	v = 0;
+	CHECK(get_u32(20, &v)==4 && v==1234, "get after interrupted compaction");
+
+	// seq回绕: 0xffffffff的下一个是0
+	memset(flash+KV_ADDR0, 0xff, 2*KV_SECTOR);
+	set_hdr(KV_ADDR0, 0xffffffff);
+	set_hdr(KV_ADDR1, 0);
+	kv_init();
+	CHECK(kv_set(1, "new", 3)==0, "set");
+	CHECK(memcmp(flash+KV_ADDR1+8+4, "new", 3)==0, "seq 0 should be newer than 0xffffffff");
+
+	// flash还在写OTA的page时写KV: 先等它写完，记录不能丢
+	memset(flash+KV_ADDR0, 0xff, 2*KV_SECTOR);
+	kv_init();
+	memset(big, 0x5a, sizeof(big));
+	fspi_init();
+	sf_page_write(OTA_ADDR, big, sizeof(big));
+	fspi_exit();
+	CHECK(sim_flash_busy(), "flash should be busy");
+	v = 0x55555555;
+	CHECK(kv_set(1, &v, 4)==0, "set while the flash is busy");
+	kv_init();
+	v = 0;
+	CHECK(get_u32(1, &v)==4 && v==0x55555555, "set while the flash is busy: %08x", v);
+
+	// OTA升级中不写
+	ops = sim_flash_ops[0];
+	ota_state = 1;
+	v = 0x66666666;
+	CHECK(kv_set(1, &v, 4)==-1, "set during OTA");
+	ota_state = 0;
+	CHECK(sim_flash_ops[0]==ops, "flash written during OTA");
+
+	// 中间有一条记录没写进去(空洞)。读到空洞为止，后面的记录不要；下一次写先搬到另一个扇区
+	memset(flash+KV_ADDR0, 0xff, 2*KV_SECTOR);
+	kv_init();
+	kv_set(30, "a", 1);
+	kv_set(31, "b", 1);
+	kv_set(30, "c", 1);
+	memset(flash+KV_ADDR0+8+8, 0xff, 8);
+	kv_init();
+	CHECK(kv_get(30, buf, sizeof(buf))==1 && buf[0]=='a', "key 30 after the gap: %c", buf[0]);
+	CHECK(kv_get(31, buf, sizeof(buf))==-1, "key 31 is in the gap");
+	CHECK(kv_set(32, "d", 1)==0, "set after the gap");
+	CHECK(hdr_word(KV_ADDR1, 0)==KV_MAGIC && hdr_word(KV_ADDR1, 1)==2, "no compaction after the gap");
+	kv_init();
+	CHECK(kv_get(30, buf, sizeof(buf))==1 && buf[0]=='a', "key 30 after compaction: %c", buf[0]);
+	CHECK(kv_get(32, buf, sizeof(buf))==1 && buf[0]=='d', "key 32 after compaction: %c", buf[0]);
+}
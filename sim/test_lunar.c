@@ -0,0 +1,99 @@
+/*
+ * 农历换算(lunar_from_date)和天文推算的参考数据逐日比较。
+ *
+ * lunar_ref.txt由lunar_ref.py生成，每行是一个农历月的第一天:
+ *   公历日期 农历年 月(1-12) 是否闰月
+ * 覆盖农历表的全部范围，2020-01-25到2052-01-31，每一天都检查。
+ * 范围外的日期应该返回-1，结果固定在表的第一天或最后一天。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_impl.h"
+#include "test.h"
+
+/******************************************************************************/
+
+#define REF_FILE   "lunar_ref.txt"
+#define REF_MONTHS 400
+
+static struct {
+	int days;      // days_from_civil
+	int ly, lm;    // 和lunar_from_date的输出格式相同
+} ref[REF_MONTHS];
+static int nref;
+
+// 参考数据和测试里的日期都是1开始的月份和日期
+static int civil(int y, int m, int d)
+{
+	return days_from_civil(y, m-1, d-1);
+}
+
+static int lunar(int y, int m, int d, int *ly, int *lm, int *ld)
+{
+	return lunar_from_date(y, m-1, d-1, ly, lm, ld);
+}
+
+static int load_ref(void)
+{
+	FILE *fp = fopen(REF_FILE, "r");
+	int y, m, d, lyear, lmon, leap;
+
+	if(fp==NULL){
+		printf("can't open %s\n", REF_FILE);
+		return -1;
+	}
+	nref = 0;
+	while(nref<REF_MONTHS && fscanf(fp, "%d-%d-%d %d %d %d", &y, &m, &d, &lyear, &lmon, &leap)==6){
+		ref[nref].days = civil(y, m, d);
+		ref[nref].ly = lyear-2020;
+		ref[nref].lm = (lmon-1) | (leap? 0x80 : 0);
+		nref += 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+void test_lunar(void)
+{
+	int y = 2020, m = 1, d = 25;
+	int i = 0, days, ret;
+	int ly, lm, ld;
+	int checked = 0;
+
+	if(load_ref()<0){
+		CHECK(0, "no reference data");
+		return;
+	}
+	CHECK(nref==397, "%d months in %s", nref, REF_FILE);
+	CHECK(ref[0].days==civil(2020, 1, 25), "first month");
+
+	// 最后一行是表外的2052年正月，只用来确定2051年腊月的长度
+	for(;;){
+		days = civil(y, m, d);
+		while(i+1<nref && ref[i+1].days<=days)
+			i += 1;
+		if(i+1>=nref)
+			break;
+		ret = lunar(y, m, d, &ly, &lm, &ld);
+		CHECK(ret==0 && ly==ref[i].ly && lm==ref[i].lm && ld==days-ref[i].days,
+			"%04d-%02d-%02d: got %d %d/%02x/%d, want %d/%02x/%d",
+			y, m, d, ret, ly, lm, ld, ref[i].ly, ref[i].lm, days-ref[i].days);
+		checked += 1;
+		test_next_day(&y, &m, &d);
+	}
+	CHECK(y==2052 && m==2 && d==1, "stopped at %04d-%02d-%02d", y, m, d);
+	CHECK(checked>11600, "%d days checked", checked);
+
+	// 表的范围以外: 返回-1，结果是表的第一天或最后一天
+	ret = lunar(2020, 1, 24, &ly, &lm, &ld);
+	CHECK(ret==-1 && ly==0 && lm==0 && ld==0, "2020-01-24: %d %d/%02x/%d", ret, ly, lm, ld);
+	ret = lunar(1990, 6, 1, &ly, &lm, &ld);
+	CHECK(ret==-1 && ly==0 && lm==0 && ld==0, "1990-06-01: %d %d/%02x/%d", ret, ly, lm, ld);
+	ret = lunar(2052, 2, 1, &ly, &lm, &ld);
+	CHECK(ret==-1 && ly==31 && lm==11 && ld==civil(2052, 1, 31)-ref[nref-2].days,
+		"2052-02-01: %d %d/%02x/%d", ret, ly, lm, ld);
+	ret = lunar(2099, 12, 31, &ly, &lm, &ld);
+	CHECK(ret==-1 && ly==31 && lm==11, "2099-12-31: %d %d/%02x/%d", ret, ly, lm, ld);
+}
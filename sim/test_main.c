@@ -0,0 +1,100 @@
+/*
+ * 单元测试的入口。
+ *   sim_test            运行全部测试
+ *   sim_test lunar ...  只运行列出的测试
+ * 有失败时返回1。测试和epd_sim链接同样的固件和模拟器代码，只是不用sim_main.c。
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "test.h"
+
+/******************************************************************************/
+
+int test_fails;
+
+
+void test_next_day(int *y, int *m, int *d)
+{
+	static const int mdays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	int leap = (*y%4==0 && *y%100!=0) || *y%400==0;
+	int n = mdays[*m-1] + (*m==2 && leap);
+
+	if(++*d>n){
+		*d = 1;
+		if(++*m>12){
+			*m = 1;
+			*y += 1;
+		}
+	}
+}
+
+int test_panel(int bwr)
+{
+	int w, h, mode;
+
+	sim_panel_config(70, 250, 122, NULL, 0);
+	detect_mode = bwr? EPD_BWR : 0;
+	fspi_config(SIM_FSPI_PINS);
+	epd_hw_init(0, 0, 122, 250, EPD_BW | 3);
+	epd_detect();
+	epd_panel_select(&w, &h, &mode);
+	epd_hw_init(0, 0, w, h, mode | 3);
+	detect_mode = 0;
+	return mode;
+}
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+} tests[] = {
+	{"batt", test_batt},
+	{"bwr", test_bwr},
+	{"crc32", test_crc32},
+	{"date", test_date},
+	{"kvs", test_kvs},
+	{"lunar", test_lunar},
+	{"ota", test_ota},
+	{"timekeep", test_timekeep},
+};
+
+#define NTESTS ((int)(sizeof(tests)/sizeof(tests[0])))
+
+
+static int run(int i)
+{
+	int fails = test_fails;
+
+	tests[i].func();
+	printf("%-8s %s\n", tests[i].name, test_fails==fails? "ok" : "FAIL");
+	return test_fails==fails;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, j;
+
+	if(argc<2){
+		for(i=0; i<NTESTS; i++)
+			run(i);
+	}else{
+		for(j=1; j<argc; j++){
+			for(i=0; i<NTESTS; i++){
+				if(strcmp(argv[j], tests[i].name)==0)
+					break;
+			}
+			if(i==NTESTS){
+				printf("unknown test: %s\n", argv[j]);
+				return 2;
+			}
+			run(i);
+		}
+	}
+
+	if(test_fails){
+		printf("%d check(s) failed\n", test_fails);
+		return 1;
+	}
+	return 0;
+}
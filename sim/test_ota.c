@@ -0,0 +1,352 @@
+/*
+ * OTA升级(ota.c)，flash用sim_flash.c的模拟，内容映射到一个临时文件。
+ *
+ * 主机的发送逻辑和weble.html相同: 每个page分a2/a3两个包，最多比写完的page超前两个，
+ * 窗口满了等a1状态，溢出时从报告的page重发。每个包之间仿真时钟走一个连接间隔。
+ * 主机订阅了通知时状态用通知发出，没有订阅时只能读特征值。
+ * 检查的情况:
+ *   - 没有订阅时不发通知，状态可以读到
+ *   - 正常升级，新image的内容和flag正确，设备复位
+ *   - 主机不等状态连续发包，溢出后重发
+ *   - page收了一半时断开，续传
+ *   - 两个page还在缓冲里时断开，续传的回复要等它们写完，不能在BLE消息里等
+ *   - 写进flash的内容和收到的不同(坏的位)，CRC按读回的内容算，image不启用
+ *   - 传了一半掉电(复位)，旧的image仍然有效，重新开始升级
+ *   - 不在升级中时收到a2/a3/a4
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_def.h"
+#include "user_peripheral.h"
+#include "user_custs1_impl.h"
+#include "test.h"
+
+#include <unistd.h>
+
+/******************************************************************************/
+
+#define OTA_OK        0
+#define OTA_OVERRUN   1
+#define OTA_RESUME    2
+#define OTA_BADCRC    3
+#define OTA_IDLE      4
+
+#define BLE_MS        8           // 一次写或读操作，大约一个连接间隔
+#define FIRM_SIZE     5000
+#define NPAGES        ((FIRM_SIZE+64+255)/256)
+
+static u8 image[NPAGES*256];      // header加固件，和主机发送的一样
+static int slot_addr[2];
+
+static int st_status, st_pages;   // 最近一次a1状态
+static int resumes, overruns, notifies;
+
+
+static void on_notify(int handle, const uint8_t *v, int len)
+{
+	if(handle!=SVC1_IDX_LONG_VALUE_VAL || len<4 || v[0]!=0xa1)
+		return;
+	notifies += 1;
+	st_status = v[1];
+	st_pages = v[2] | (v[3]<<8);
+	if(st_status==OTA_RESUME)
+		resumes += 1;
+	if(st_status==OTA_OVERRUN)
+		overruns += 1;
+}
+
+
+static void image_build(u32 seed)
+{
+	u32 x = seed;
+	int i;
+
+	memset(image, 0xff, sizeof(image));
+	for(i=64; i<64+FIRM_SIZE; i++){
+		x ^= x<<13;
+		x ^= x>>17;
+		x ^= x<<5;
+		image[i] = x;
+	}
+	*(u32*)(image+0) = 0x00aa5170;
+	*(u32*)(image+4) = FIRM_SIZE;
+	*(u32*)(image+8) = crc32(0, image+64, FIRM_SIZE);
+	*(u32*)(image+28) = 0xa50f0000;
+	image[32] = 0;
+}
+
+
+// 写long value的CCC，on为1订阅通知
+static void subscribe(int on)
+{
+	u32 buf[(sizeof(struct custs1_val_write_ind)+2+3)/4];
+	struct custs1_val_write_ind *ind = (struct custs1_val_write_ind *)buf;
+
+	ind->conidx = 0;
+	ind->handle = SVC1_IDX_LONG_VALUE_NTF_CFG;
+	ind->length = 2;
+	ind->value[0] = on;
+	ind->value[1] = 0;
+	user_svc1_long_val_cfg_ind_handler(CUSTS1_VAL_WRITE_IND, ind, TASK_APP, TASK_ID_CUSTS1);
+}
+
+
+static void send_cmd(int cmd)
+{
+	u8 buf[136];
+
+	memset(buf, 0, sizeof(buf));
+	buf[0] = cmd;
+	buf[2] = FIRM_SIZE&0xff;
+	buf[3] = FIRM_SIZE>>8;
+	ota_handle(buf);
+}
+
+
+static void send_half(int page, int half)
+{
+	u8 buf[136];
+
+	memset(buf, 0xff, sizeof(buf));
+	buf[0] = 0xa2+half;
+	buf[1] = 0;
+	buf[2] = page&0xff;
+	buf[3] = page>>8;
+	memcpy(buf+8, image+page*256+half*128, 128);
+	ota_handle(buf);
+}
+
+
+// 从第next个page发到最后，直到全部写完。stop>=0时发完第stop个page的前半就断开。
+// 返回0全部写完，-1断开，其他是出错的状态
+static int host_run(int next, int gap, int stop)
+{
+	int acked = next;
+	int reads = 0;
+
+	while(acked<NPAGES){
+		if(next<NPAGES && next<acked+2){
+			send_half(next, 0);
+			sim_run(gap);
+			if(next==stop)
+				return -1;
+			send_half(next, 1);
+			sim_run(gap);
+			next += 1;
+			continue;
+		}
+		sim_run(BLE_MS);
+		if(++reads>10000)
+			return -2;
+		if(st_status==OTA_OK){
+			acked = st_pages;
+		}else if(st_status==OTA_OVERRUN){
+			if(st_pages<next)
+				next = st_pages;
+			if(acked<st_pages-1)
+				acked = st_pages-1;
+		}else{
+			return 100+st_status;
+		}
+	}
+	return 0;
+}
+
+
+// 发a4，等校验和复位。返回1表示复位了
+static int host_finish(void)
+{
+	int resets = sim_resets;
+
+	send_cmd(0xa4);
+	sim_idle(1000);
+	return sim_resets>resets;
+}
+
+
+// 设备复位: RAM里的升级状态都没有了
+static void reboot(void)
+{
+	sim_idle(1000);
+	ota_state = 0;
+}
+
+
+static int slot_flag(int slot)
+{
+	return (signed char)sim_flash_data()[slot_addr[slot]+3];
+}
+
+
+// 升级写进哪个slot，flag是多少: 和ota_start一样，写进flag小的那个，flag加1
+static int next_slot(int *flag)
+{
+	int active = (slot_flag(0)>=slot_flag(1))? 0 : 1;
+
+	*flag = slot_flag(active)+1;
+	return active^1;
+}
+
+
+// 检查新image写在slot里，flag正确
+static void check_slot(int slot, int flag)
+{
+	u8 *p = sim_flash_data()+slot_addr[slot];
+
+	CHECK(memcmp(p, image, 3)==0, "slot %d magic", slot);
+	CHECK(slot_flag(slot)==flag, "slot %d flag %d, want %d", slot, slot_flag(slot), flag);
+	CHECK(memcmp(p+4, image+4, NPAGES*256-4)==0, "slot %d contents", slot);
+}
+
+
+/******************************************************************************/
+
+void test_ota(void)
+{
+	char name[] = "/tmp/sim_ota_XXXXXX";
+	int fd, ret, flag, slot, bad;
+	u8 *p, b, buf[DEF_SVC1_LONG_VALUE_CHAR_LEN];
+
+	fd = mkstemp(name);
+	if(fd<0 || sim_flash_file(name)<0){
+		CHECK(0, "can't create the flash file");
+		return;
+	}
+	sim_notify = on_notify;
+
+	// 和开机一样把"正在运行的固件"写进flash
+	sim_firm_init();
+	fspi_config(SIM_FSPI_PINS);
+	selflash(0x1234a5a5);
+	p = sim_flash_data();
+	slot_addr[0] = *(u32*)(p+0x38004);
+	slot_addr[1] = *(u32*)(p+0x38008);
+	CHECK(slot_addr[0]==0x4000 && slot_addr[1]==0x1f000, "product header %x %x", slot_addr[0], slot_addr[1]);
+
+	// 没有订阅: 不发通知，读特征值得到状态
+	notifies = 0;
+	send_half(0, 0);
+	ret = sim_att_read(SVC1_IDX_LONG_VALUE_VAL, buf);
+	CHECK(notifies==0, "%d notifications without a subscription", notifies);
+	CHECK(ret==4 && buf[0]==0xa1 && buf[1]==OTA_IDLE && buf[2]==0xff && buf[3]==0xff,
+	      "read status: %d bytes %02x %02x %02x %02x", ret, buf[0], buf[1], buf[2], buf[3]);
+	subscribe(1);
+
+	// 不在升级中
+	st_status = -1;
+	send_half(0, 0);
+	CHECK(notifies==1, "%d notifications after subscribing", notifies);
+	CHECK(st_status==OTA_IDLE && st_pages==0xffff, "a2 while idle: %d %d", st_status, st_pages);
+	st_status = -1;
+	CHECK(host_finish()==0, "a4 while idle reset the device");
+	CHECK(st_status==OTA_IDLE, "a4 while idle: %d", st_status);
+	send_cmd(0xa5);
+	CHECK(st_status==OTA_RESUME && st_pages==0xffff, "a5 while idle: %d %d", st_status, st_pages);
+
+	// 正常升级
+	image_build(1);
+	slot = next_slot(&flag);
+	send_cmd(0xa0);
+	CHECK(st_status==OTA_OK && st_pages==0, "a0: %d %d", st_status, st_pages);
+	overruns = 0;
+	ret = host_run(0, BLE_MS, -1);
+	CHECK(ret==0, "clean transfer: %d", ret);
+	CHECK(overruns==0, "%d overruns on a paced transfer", overruns);
+	CHECK(host_finish(), "no reset after a4");
+	check_slot(slot, flag);
+	CHECK(slot_flag(slot^1)==flag-1, "old slot flag %d", slot_flag(slot^1));
+	reboot();
+
+	// 不等状态，三个page连着发，第三个没有缓冲
+	image_build(2);
+	slot = next_slot(&flag);
+	send_cmd(0xa0);
+	send_half(0, 0);
+	send_half(0, 1);
+	send_half(1, 0);
+	send_half(1, 1);
+	send_half(2, 0);
+	CHECK(st_status==OTA_OVERRUN && st_pages==2, "third page: %d %d", st_status, st_pages);
+	send_half(2, 1);
+	send_half(3, 0);
+	CHECK(st_status==OTA_OVERRUN && st_pages==2, "after the overrun: %d %d", st_status, st_pages);
+	ret = host_run(4, BLE_MS, -1);
+	CHECK(ret==0, "transfer after overrun: %d", ret);
+	CHECK(host_finish(), "no reset after a4");
+	check_slot(slot, flag);
+	reboot();
+
+	// page收了一半时断开，重新连上后续传
+	image_build(3);
+	slot = next_slot(&flag);
+	send_cmd(0xa0);
+	ret = host_run(0, BLE_MS, 7);
+	CHECK(ret==-1, "disconnect: %d", ret);
+	sim_run(100);
+	resumes = 0;
+	send_cmd(0xa5);
+	sim_run(BLE_MS);
+	CHECK(resumes==1 && st_status==OTA_RESUME && st_pages==7, "resume: %d %d %d", resumes, st_status, st_pages);
+	ret = host_run(st_pages, BLE_MS, -1);
+	CHECK(ret==0, "transfer after resume: %d", ret);
+	CHECK(host_finish(), "no reset after a4");
+	check_slot(slot, flag);
+	reboot();
+
+	// 两个page在缓冲里(一个在写)时断开。续传的回复在它们写完以后由定时器发出
+	image_build(4);
+	slot = next_slot(&flag);
+	send_cmd(0xa0);
+	ret = host_run(0, BLE_MS, 5);
+	send_half(5, 1);
+	send_half(6, 0);
+	send_half(6, 1);
+	CHECK(sim_flash_busy(), "flash should still be programming page 5");
+	resumes = 0;
+	send_cmd(0xa5);
+	CHECK(resumes==0, "resume answered while pages were still being written");
+	sim_run(100);
+	CHECK(resumes==1 && st_status==OTA_RESUME && st_pages==7, "resume after drain: %d %d %d", resumes, st_status, st_pages);
+	ret = host_run(st_pages, BLE_MS, -1);
+	CHECK(ret==0, "transfer after resume: %d", ret);
+	CHECK(host_finish(), "no reset after a4");
+	check_slot(slot, flag);
+	reboot();
+
+	// flash里有一个坏的位: 收到的数据没错，写进去的错了。按读回的内容校验，不启用
+	image_build(5);
+	slot = next_slot(&flag);
+	send_cmd(0xa0);
+	bad = 9*256+17;
+	CHECK(image[bad]!=0, "pick another byte");
+	sim_flash_data()[slot_addr[slot]+bad] &= ~(image[bad]&-image[bad]);
+	ret = host_run(0, BLE_MS, -1);
+	CHECK(ret==0, "transfer: %d", ret);
+	CHECK(host_finish()==0, "reset with a bad image");
+	CHECK(st_status==OTA_BADCRC, "bad bit: status %d", st_status);
+	CHECK(slot_flag(slot)==-1, "bad image flag %d", slot_flag(slot));
+	CHECK(slot_flag(slot^1)==flag-1, "active image flag %d", slot_flag(slot^1));
+	CHECK(ota_state==0, "ota_state %d after a bad image", ota_state);
+
+	// 传到一半掉电。flag还是0xff，bootloader继续用旧的image；复位后续传不了，重新开始
+	image_build(6);
+	send_cmd(0xa0);
+	ret = host_run(0, BLE_MS, 11);
+	reboot();
+	CHECK(pread(fd, &b, 1, slot_addr[slot]+3)==1 && b==0xff, "half written image flag %02x in the file", b);
+	CHECK(pread(fd, &b, 1, slot_addr[slot]+10*256)==1 && b==image[10*256], "page 10 not in the file");
+	send_cmd(0xa5);
+	CHECK(st_status==OTA_RESUME && st_pages==0xffff, "resume after reset: %d %d", st_status, st_pages);
+	send_cmd(0xa0);
+	ret = host_run(0, BLE_MS, -1);
+	CHECK(ret==0, "restarted transfer: %d", ret);
+	CHECK(host_finish(), "no reset after a4");
+	check_slot(slot, flag);
+	reboot();
+
+	subscribe(0);
+	sim_notify = NULL;
+	close(fd);
+	unlink(name);
+}
@@ -0,0 +1,295 @@
+/*
+ * 时钟定时器的自适应唤醒(clock_next_change)和走时修正(user_timekeep.c)。
+ *
+ * 定时器的处理和user_peripheral.c的app_clock_timer_cb一样，只是不画屏幕。仿真时钟
+ * 代表本地的晶振，检查的情况:
+ *   - 各显示模式和电量下，到画面下一次变化的秒数
+ *   - 静态画面每小时醒一次，时钟每分钟，电量低时每10分钟，每次都醒在变化的时刻
+ *   - 周期中途换显示模式，走过的时间计入时钟，不足一秒的部分留给下一个周期
+ *   - 每个周期不足10ms的补偿累加到以后的周期，正负两个方向
+ *   - 晶振快了125ppm: 对时学到误差，之后走时和真实时间一致
+ *   - 不随时间变化的画面整点醒来不重画，换了一天或者屏幕上是别的画面才重画
+ */
+#include "sim_sdk.h"
+#include "sim.h"
+#include "epd.h"
+#include "user_custs1_impl.h"
+#include "user_peripheral.h"
+#include "user_timekeep.h"
+#include "user_batt.h"
+#include "test.h"
+
+/******************************************************************************/
+
+#define KV_ADDR0    0x3e000
+#define KV_SECTOR   0x1000
+
+#define MV_OK       3000
+#define MV_LOW      2500        // 约10%，BATT_LOW
+
+static const struct {
+	int mode, mv;
+	int h, m, s;
+	int next;
+} next_tab[] = {
+	{CLOCK_MODE,        MV_OK,  10, 20, 15, 45},
+	{CLOCK_MODE,        MV_OK,  10, 20,  0, 60},
+	{QR_MODE,           MV_OK,  10, 20, 15, 45},
+	{CALENDAR_MODE,     MV_OK,  10, 20, 15, 45},
+	{STATIC_MODE,       MV_OK,  10, 20, 15, 45+39*60},
+	{STATIC_MODE,       MV_OK,  10, 59, 59, 1},
+	{STATIC_MODE,       MV_OK,  23,  0,  0, 3600},
+	{CUSTOM_CLOCK_MODE, MV_OK,  10, 20, 15, 45+39*60},
+	{LB_MODE,           MV_OK,  10, 20, 15, 45+39*60},
+	{CLOCK_MODE,        MV_LOW, 10, 23, 15, 45+6*60},
+	{CLOCK_MODE,        MV_LOW, 10, 29, 30, 30},
+	{CLOCK_MODE,        MV_LOW, 10, 30,  0, 600},
+	{STATIC_MODE,       MV_LOW, 10, 20, 15, 45+39*60},
+};
+
+#define NNEXT ((int)(sizeof(next_tab)/sizeof(next_tab[0])))
+
+
+static void set_batt(int mv)
+{
+	sim_vbat_mv = mv;
+	batt_init();
+}
+
+
+// 改本地时间，从现在开始新的周期。仿真时钟对齐到BLE的625us，时间差可以精确计算
+static void set_time(int mode, int h, int m, int s)
+{
+	sim_advance_us(625 - sim_time_us()%625);
+	Update_Mode = mode;
+	year = 2026;
+	month = 2;
+	date = 9;
+	hour = h;
+	minute = m;
+	second = s;
+	app_clock_timer_restart();
+}
+
+
+// 定时器到期: 走过这个周期，再按画面下一次变化的时刻开始下一个周期
+static int wake(void)
+{
+	int stat;
+
+	sim_advance_us((uint64_t)sim_clock_ms*1000);
+	stat = clock_update(sim_clock_sec);
+	sim_clock_sec = clock_next_change();
+	sim_clock_ms = timekeep_next(sim_clock_sec)*10;
+	return stat;
+}
+
+
+static int day_sec(void)
+{
+	return hour*3600 + minute*60 + second;
+}
+
+
+// 从h:m:s开始走sec秒，检查每次都醒在变化的时刻(every秒的整数倍)，返回醒的次数
+static int run_wakes(int mode, int h, int m, int s, int sec, int every)
+{
+	uint64_t t0;
+	int n = 0, start, stat;
+
+	set_time(mode, h, m, s);
+	t0 = sim_time_us();
+	start = day_sec();
+	while(day_sec()-start+sim_clock_sec<=sec){
+		stat = wake();
+		n += 1;
+		CHECK(day_sec()%every==0, "mode %d woke at %02d:%02d:%02d", mode, hour, minute, second);
+		if(every==3600)
+			CHECK(stat>=3, "mode %d: stat %d at %02d:00", mode, stat, hour);
+	}
+	// 没有学到误差时定时器不加补偿，仿真时钟和本地时间只差不足10ms的余数
+	CHECK(llabs((long long)(sim_time_us()-t0) - (day_sec()-start)*1000000LL)<10000,
+		"mode %d: %lld us for %d s", mode, (long long)(sim_time_us()-t0), day_sec()-start);
+	return n;
+}
+
+
+static void clock_buf(uint8_t *buf, int days, int sec)
+{
+	int y, m, d;
+
+	civil_from_days(days, &y, &m, &d);
+	memset(buf, 0, 12);
+	buf[0] = 0x91;
+	buf[1] = y&0xff;
+	buf[2] = y>>8;
+	buf[3] = m;
+	buf[4] = d+1;
+	buf[5] = sec/3600;
+	buf[6] = sec/60%60;
+	buf[7] = sec%60;
+}
+
+
+// 画一帧，等刷新结束
+static void draw(int flags)
+{
+	per_min_draw(flags);
+	sim_idle(30*1000);
+}
+
+
+// 按app_clock_timer_cb走n个周期，返回刷新的帧数
+static int run_draws(int n)
+{
+	int frames = sim_panel_frames();
+	int stat, flags;
+
+	while(n-->0){
+		stat = wake();
+		flags = (stat>=3)? (DRAW_BT | UPDATE_FULL) : (stat>=2)? (DRAW_BT | UPDATE_FAST) : UPDATE_FLY;
+		if((stat>0 || flags&DRAW_BT) && clock_screen_changed()){
+			Update_Mode = Default_Update_Mode;
+			draw(flags);
+		}
+	}
+	return sim_panel_frames()-frames;
+}
+
+
+static void check_draws(void)
+{
+	int n;
+
+	test_panel(0);
+
+	// 用户时钟: 整点不重画，只有过了零点(静态层的key变了)才画
+	Default_Update_Mode = CUSTOM_CLOCK_MODE;
+	set_time(CUSTOM_CLOCK_MODE, 10, 20, 0);
+	draw(DRAW_BT | UPDATE_FULL);
+	CHECK(!clock_screen_changed(), "custom clock needs a redraw right after drawing");
+	n = run_draws(20);
+	CHECK(n==1 && hour==6, "custom clock: %d frames in 20 hours, now %02d:%02d", n, hour, minute);
+
+	// 屏幕上是主机画的东西时要重画
+	refresh_screen(UPDATE_FAST);
+	sim_idle(30*1000);
+	CHECK(clock_screen_changed(), "custom clock not redrawn over another screen");
+
+	// 静态画面: 显示过以后不再画
+	epd_image_save();
+	Default_Update_Mode = STATIC_MODE;
+	set_time(STATIC_MODE, 10, 20, 0);
+	draw(DRAW_BT | UPDATE_FULL);
+	n = run_draws(20);
+	CHECK(n==0, "static: %d frames in 20 hours", n);
+
+	// 时钟每分钟都画
+	Default_Update_Mode = CLOCK_MODE;
+	set_time(CLOCK_MODE, 10, 20, 0);
+	n = run_draws(60);
+	CHECK(n==60, "clock: %d frames in 60 minutes", n);
+}
+
+
+/******************************************************************************/
+
+void test_timekeep(void)
+{
+	uint8_t buf[12];
+	uint64_t t0;
+	long long real_us, err_us;
+	int i, n, sum, days, sec;
+
+	fspi_config(SIM_FSPI_PINS);
+	memset(sim_flash_data()+KV_ADDR0, 0xff, 2*KV_SECTOR);
+	kv_init();
+	timekeep_init();
+	epd_temp = EPD_TEMP_NONE;
+
+	// 到画面下一次变化的秒数
+	for(i=0; i<NNEXT; i++){
+		set_batt(next_tab[i].mv);
+		Update_Mode = next_tab[i].mode;
+		hour = next_tab[i].h;
+		minute = next_tab[i].m;
+		second = next_tab[i].s;
+		n = clock_next_change();
+		CHECK(n==next_tab[i].next, "mode %d %d mV %02d:%02d:%02d: %d s, want %d", next_tab[i].mode,
+			next_tab[i].mv, next_tab[i].h, next_tab[i].m, next_tab[i].s, n, next_tab[i].next);
+	}
+	set_batt(MV_LOW);
+	CHECK(batt_state()==BATT_LOW, "%d mV: state %d", MV_LOW, batt_state());
+
+	// 走10小时: 静态画面只在整点醒，电量低的时钟每10分钟，正常的时钟每分钟
+	n = run_wakes(STATIC_MODE, 10, 20, 15, 10*3600, 3600);
+	CHECK(n==10, "static: %d wakes in 10 hours", n);
+	n = run_wakes(CLOCK_MODE, 10, 20, 15, 10*3600, 600);
+	CHECK(n==60, "clock on low battery: %d wakes in 10 hours", n);
+	set_batt(MV_OK);
+	n = run_wakes(CLOCK_MODE, 10, 20, 15, 10*3600, 60);
+	CHECK(n==600, "clock: %d wakes in 10 hours", n);
+
+	// 静态画面的周期中途换成时钟，再换回来。走过的整秒计入时钟，零头从下一个周期里扣掉
+	set_time(STATIC_MODE, 10, 20, 0);
+	t0 = sim_time_us();
+	CHECK(sim_clock_sec==2400, "static period %d s", sim_clock_sec);
+	sim_advance_us(1000500000);
+	Update_Mode = CLOCK_MODE;
+	app_clock_timer_reschedule();
+	CHECK(day_sec()==10*3600+36*60+40, "switch to clock at %02d:%02d:%02d", hour, minute, second);
+	CHECK(sim_clock_sec==20 && abs(sim_clock_ms-19500)<=10, "after switch: %d s %d ms", sim_clock_sec, sim_clock_ms);
+	wake();
+	CHECK(day_sec()==10*3600+37*60, "first clock wake at %02d:%02d:%02d", hour, minute, second);
+	sim_advance_us(30250000);
+	Update_Mode = STATIC_MODE;
+	app_clock_timer_reschedule();
+	CHECK(sim_clock_sec==22*60+30 && abs(sim_clock_ms-(22*60+29)*1000-750)<=10,
+		"back to static: %d s %d ms", sim_clock_sec, sim_clock_ms);
+	wake();
+	CHECK(day_sec()==11*3600, "static wake at %02d:%02d:%02d", hour, minute, second);
+	CHECK(llabs((long long)(sim_time_us()-t0)-2400000000LL)<10000, "%lld us for 40 min",
+		(long long)(sim_time_us()-t0));
+
+	// 补偿不足10ms时累加: 1000个60秒的周期，每个差1ms(16.7ppm)，合计100ms
+	timekeep_manual(1, 1000);
+	for(i=0, sum=0; i<1000; i++)
+		sum += timekeep_next(60)-6000;
+	CHECK(llabs(sum*10000000LL-999960000LL)<20000000, "+16666 ppb: %d0 ms in 1000 min", sum);
+	timekeep_manual(-2, 1000);
+	for(i=0, sum=0; i<1000; i++)
+		sum += timekeep_next(60)-6000;
+	CHECK(llabs(sum*10000000LL+1000020000LL)<20000000, "-16667 ppb: %d0 ms in 1000 min", sum);
+
+	// 晶振快了1/8000(125ppm)。从新的参数开始，对时后走400分钟，本地多走了3秒
+	memset(sim_flash_data()+KV_ADDR0, 0xff, 2*KV_SECTOR);
+	kv_init();
+	timekeep_init();
+	set_time(CLOCK_MODE, 8, 0, 0);
+	days = days_from_civil(year, month, date);
+	clock_buf(buf, days, 8*3600);
+	clock_set(buf);
+	t0 = sim_time_us();
+	for(i=0; i<400; i++)
+		wake();
+	real_us = (sim_time_us()-t0) - (sim_time_us()-t0)/8000;
+	CHECK(day_sec()==8*3600+24000 && real_us==23997000000LL, "%02d:%02d:%02d after %lld us real",
+		hour, minute, second, real_us);
+
+	// 对时学到误差，再走400分钟，本地时间和真实时间的差不到两个定时器单位
+	sec = 8*3600 + (int)(real_us/1000000);
+	clock_buf(buf, days, sec);
+	clock_set(buf);
+	t0 = sim_time_us();
+	n = 0;
+	while(n<24000){
+		n += sim_clock_sec;
+		wake();
+	}
+	real_us = (sim_time_us()-t0) - (sim_time_us()-t0)/8000;
+	err_us = (long long)n*1000000 - real_us;
+	CHECK(day_sec()==sec+n, "%02d:%02d:%02d, want %d s", hour, minute, second, sec+n);
+	CHECK(llabs(err_us)<20000, "%lld us off after %d s with the learned drift", err_us, n);
+
+	check_draws();
+}
@@ -62,6 +62,7 @@ static const uint16_t custs1_svc1     = 0xff00;
 static const uint16_t svc1_ctrl_point = 0xff03;
 static const uint16_t svc1_adc_val1   = 0xff02;
 static const uint16_t svc1_long_value = 0xff01;
+static const uint16_t svc1_trace      = 0xff04;
 
 // Attribute specifications
 static const uint16_t att_decl_svc       = ATT_DECL_PRIMARY_SERVICE;
@@ -105,8 +106,17 @@ const struct attm_desc_128 custs1_att_db[CUSTS1_IDX_NB] =
     // Long Value Characteristic Declaration
     [SVC1_IDX_LONG_VALUE_CHAR]         = {(uint8_t*)&att_decl_char, ATT_UUID_16_LEN, PERM(RD, ENABLE), 0, 0, NULL},
     // Long Value Characteristic Value
-    [SVC1_IDX_LONG_VALUE_VAL]          = {(uint8_t*)&svc1_long_value, ATT_UUID_16_LEN, PERM(RD, ENABLE) | PERM(WR, ENABLE) | PERM(WRITE_REQ, ENABLE),
+    [SVC1_IDX_LONG_VALUE_VAL]          = {(uint8_t*)&svc1_long_value, ATT_UUID_16_LEN, PERM(RD, ENABLE) | PERM(WR, ENABLE) | PERM(WRITE_REQ, ENABLE) | PERM(NTF, ENABLE),
                                             DEF_SVC1_LONG_VALUE_CHAR_LEN, 0, 0},
+    // Long Value Client Characteristic Configuration Descriptor
+    [SVC1_IDX_LONG_VALUE_NTF_CFG]      = {(uint8_t*)&att_desc_cfg, ATT_UUID_16_LEN, PERM(RD, ENABLE) | PERM(WR, ENABLE) | PERM(WRITE_REQ, ENABLE),
+                                            sizeof(uint16_t), 0, 0},
+
+    // Refresh Trace Characteristic Declaration
+    [SVC1_IDX_TRACE_CHAR]              = {(uint8_t*)&att_decl_char, ATT_UUID_16_LEN, PERM(RD, ENABLE), 0, 0, NULL},
+    // Refresh Trace Characteristic Value
+    [SVC1_IDX_TRACE_VAL]               = {(uint8_t*)&svc1_trace, ATT_UUID_16_LEN, PERM(RD, ENABLE),
+                                            DEF_SVC1_TRACE_CHAR_LEN, 0, 0},
 };
 
 /// @} USER_CONFIG
@@ -0,0 +1,80 @@
+
+
+#include "epd.h"
+
+
+/******************************************************************************/
+
+// CRC-32 (多项式0xedb88320，和zlib相同)
+//
+// 可以分段计算: crc = crc32(crc, buf, len)，第一段的crc为0。OTA、image校验和启动时的
+// 固件校验都用这一个。
+//
+// DA14585没有硬件CRC，这里用slicing-by-4: 每次查4张表处理一个字，比逐字节查表快2倍多。
+// 代码运行在RAM里，const的表同样占RAM，所以表在第一次使用时生成，不占image的大小。
+// 4张表共4K，RAM紧张时可以把CRC32_SLICE定义为1，退回逐字节的1K表。
+
+#ifndef CRC32_SLICE
+#define CRC32_SLICE  4
+#endif
+
+static u32 crc_tab[CRC32_SLICE][256];
+
+
+static void crc32_init(void)
+{
+	int i, j;
+	u32 c;
+
+	for(i=0; i<256; i++){
+		c = i;
+		for(j=0; j<8; j++)
+			c = (c&1)? 0xedb88320^(c>>1) : c>>1;
+		crc_tab[0][i] = c;
+	}
+
+#if CRC32_SLICE==4
+	for(i=0; i<256; i++){
+		c = crc_tab[0][i];
+		for(j=1; j<4; j++){
+			c = crc_tab[0][c&0xff]^(c>>8);
+			crc_tab[j][i] = c;
+		}
+	}
+#endif
+}
+
+
+uint32_t crc32(uint32_t crc, const void *buf, size_t size)
+{
+	const u8 *p = (const u8 *)buf;
+
+	if(crc_tab[0][1]==0)
+		crc32_init();
+
+	crc = ~crc;
+
+#if CRC32_SLICE==4
+	// M0不支持非对齐访问，先逐字节处理到4字节对齐
+	while(size && ((size_t)p&3)){
+		crc = crc_tab[0][(crc^*p++)&0xff]^(crc>>8);
+		size--;
+	}
+	while(size>=4){
+		crc ^= *(const u32 *)p;
+		crc = crc_tab[3][crc&0xff] ^ crc_tab[2][(crc>>8)&0xff] ^
+		      crc_tab[1][(crc>>16)&0xff] ^ crc_tab[0][crc>>24];
+		p += 4;
+		size -= 4;
+	}
+#endif
+
+	while(size--)
+		crc = crc_tab[0][(crc^*p++)&0xff]^(crc>>8);
+
+	return ~crc;
+}
+
+
+/******************************************************************************/
+
@@ -14,10 +14,33 @@ int scr_padding;
 int update_mode;
 int lut_size;
 
-int detect_w = 104;
-int detect_h = 212;
+// 屏幕控制器状态，见epd.h中的EPD_STATE_xxx
+int epd_state = EPD_STATE_OFF;
+// 自上次复位以来已经写入控制器的LUT，NULL表示控制器使用的是OTP中的波形
+static u8 *lut_loaded;
+// 上次刷新使用的模式，保持状态下只有同一模式的刷新才能跳过初始化
+static int last_mode = -1;
+// 三色屏: 这一帧和玻璃上现在的红色平面的摘要，0表示没有红色
+static u32 frame_red;
+static u32 glass_red;
+static u32 red_sum;
+static int red_any;
+
+// 控制器内置温度传感器的读数，单位1/16度。只有全刷(0xf7)的序列里会测温度
+int epd_temp = EPD_TEMP_NONE;
+static int temp_loaded;
+
+// flash配置区中记录的屏幕参数，0表示没有记录
+int detect_w = 0;
+int detect_h = 0;
 int detect_mode = EPD_BW;
 
+// epd_detect()探测到的控制器RAM大小，0表示读不出来
+int probe_ram_w;
+int probe_ram_h;
+// 控制器有没有第二块(0x26)RAM
+int probe_red;
+
 
 // 窗口参数
 int win_w;
@@ -145,8 +168,32 @@ u8 lut_fly_100[112] = {
     0x15, 0x41, 0xa8, 0x32, 0x50, 0x0f, 0x0c,
 };
 
+// 100字节控制器的灰度LUT，不单独写一份，由lut_gray_step按下面的对应关系生成:
+//   LUT0-LUT4  前7个phase照抄，RP7-RP9为0
+//   Group0-6   照抄；Group7-9全为0，不占时间
+//   VGH-VSL    照抄
+//   VCOM       0x0d，和70字节的灰度刷新里单独发的0x2c命令相同
+//   FR1 FR2    两种控制器的帧率编码不同，用其它100字节LUT验证过的0x0f 0x0c
+static u8 lut_gray_step_100[112];
+
+static void lut_gray_100_build(void)
+{
+	u8 *dst = lut_gray_step_100;
+	int i;
+
+	memset(dst, 0, sizeof(lut_gray_step_100));
+	for(i=0; i<5; i++)
+		memcpy(dst+i*10, lut_gray_step+i*7, 7);
+	memcpy(dst+50, lut_gray_step+35, 7*5);
+	memcpy(dst+100, lut_gray_step+70, 4);
+	dst[104] = 0x0d;
+	dst[105] = lut_fly_100[105];
+	dst[106] = lut_fly_100[106];
+}
+
 u8 *lut_fast = lut_fast_70;
 u8 *lut_fly  = lut_fly_70;
+static u8 *lut_gray = lut_gray_step;
 
 
 /******************************************************************************/
@@ -300,6 +347,8 @@ int epd_lut_size(void)
 	if(lut_size==100){
 		lut_fast = lut_fast_100;
 		lut_fly  = lut_fly_100;
+		lut_gray_100_build();
+		lut_gray = lut_gray_step_100;
 	}
 
 	return lut_size;
@@ -310,8 +359,22 @@ void epd_init(void)
 {
 	//printk("epd_init: %dx%d\n", scr_w, scr_h);
 
+	if(epd_state==EPD_STATE_RETAIN){
+		if(update_mode==last_mode){
+			// 控制器一直保持上电，寄存器和LUT都还在，只需要复位RAM地址
+			epd_window(0, 0, scr_w-1, scr_h-1);
+			epd_state = EPD_STATE_READY;
+			return;
+		}
+		// 换了刷新模式(例如灰度改过VCOM)，完整地重新上电
+		epd_power(0);
+		epd_reset(0);
+		delay_ms(2);
+	}
+
 	epd_power(1);
 	epd_reset(1);
+	lut_loaded = NULL;
 
 #if 0
 	epd_wait();
@@ -335,6 +398,7 @@ void epd_init(void)
 	epd_window(0, 0, scr_w-1, scr_h-1);
 
 	epd_cmd1(0x18, 0x80);  // Read Built-in temperature sensor
+	epd_state = EPD_STATE_READY;
 }
 
 
@@ -345,39 +409,135 @@ void epd_update_mode(int mode)
 }
 
 
+// 只在控制器中的LUT和要用的不同时才重新下发
+static void epd_use_lut(u8 *lut)
+{
+	if(lut_loaded==lut)
+		return;
+	epd_load_lut(lut);
+	lut_loaded = lut;
+}
+
+
+// 红色平面的摘要(FNV-1a)，分段累加。red_any记录有没有红点
+static void red_begin(void)
+{
+	red_sum = 2166136261u;
+	red_any = 0;
+}
+
+static void red_add(u8 *data, int len)
+{
+	int i;
+
+	for(i=0; i<len; i++){
+		red_sum = (red_sum^data[i])*16777619u;
+		red_any |= data[i];
+	}
+}
+
+static u32 red_end(void)
+{
+	return red_any? (red_sum|1) : 0;
+}
+
+// 图片槽的红色平面一边读一边写给屏幕，顺便算摘要
+static void red_stream(u8 *data, int len)
+{
+	red_add(data, len);
+	epd_data_array(data, len);
+}
+
+
 void epd_update(void)
 {
 	int seq;
 
+	// 三色屏的红色只有OTP里的完整波形能驱动。快刷的LUT只管黑白，0x26里的红点按W->W
+	// 处理，玻璃上的红色保持原样。所以红色平面和玻璃上一样时照常快刷，有变化时只能全刷。
+	// 每分钟的画面里节气、节日的红色一天才变一次
+	if(scr_mode&EPD_BWR){
+		if(frame_red!=glass_red){
+			update_mode = UPDATE_FULL;
+			epd_trace_mode(update_mode);
+		}
+		if(update_mode==UPDATE_FULL)
+			glass_red = frame_red;
+	}
+
 	if(update_mode==UPDATE_FULL){
 		seq = 0xf7;
+		// 0xf7会从OTP重新载入波形，覆盖掉之前写入的LUT
+		lut_loaded = NULL;
 	}else{
 		if(update_mode==UPDATE_FAST){
-			epd_load_lut(lut_fast);
+			epd_use_lut(lut_fast);
 		}else if (update_mode==UPDATE_FLY){
-			epd_load_lut(lut_fly);
+			epd_use_lut(lut_fly);
 		}else if(update_mode==UPDATE_GRAY){
 			//epd_gray_update(gray_step);
-			//Goto end;
-			epd_load_lut(lut_gray_step);
-			epd_cmd1(0x2c,0x0d); // VCOM
+			if(lut_loaded!=lut_gray){
+				epd_use_lut(lut_gray);
+				epd_cmd1(0x2c,0x0d); // VCOM
+			}
 		}
 		seq = 0xc7;
 	}
 
 	epd_cmd1(0x22, seq);
 	epd_cmd(0x20);
-	end:return;
+	temp_loaded = (seq==0xf7);
+	last_mode = update_mode;
+	epd_state = EPD_STATE_BUSY;
 }
 
 
 
+// 刷新结束后、断电之前调用。这次刷新测过温度就读出来，否则保持上次的值
+int epd_temp_read(void)
+{
+	u8 buf[2];
+	int t;
+
+	if(!temp_loaded)
+		return epd_temp;
+	temp_loaded = 0;
+
+	// 12位补码，高8位在前
+	epd_cmd_read(0x1b, buf, 2);
+	t = (buf[0]<<4)|(buf[1]>>4);
+	if(t&0x800)
+		t -= 0x1000;
+	epd_temp = t;
+	return t;
+}
+
+
 void epd_sleep(void)
 {
 	epd_cmd1(0x10, 01);
 }
 
 
+// 刷新结束后让控制器保持上电，下一次同模式的刷新可以跳过初始化和LUT下发
+void epd_retain(void)
+{
+	epd_state = EPD_STATE_RETAIN;
+}
+
+
+// 深度睡眠并断电，控制器里的寄存器和LUT全部丢失
+void epd_power_off(void)
+{
+	epd_sleep();
+	epd_power(0);
+	epd_hw_close();
+	epd_state = EPD_STATE_OFF;
+	lut_loaded = NULL;
+	last_mode = -1;
+}
+
+
 /******************************************************************************/
 
 void epd_screen_update(void)
@@ -394,6 +554,9 @@ void epd_screen_update(void)
 		for(i=0; i<win_h*line_bytes; i++){
 			epd_data(fb_rr[i]);
 		}
+		red_begin();
+		red_add(fb_rr, win_h*line_bytes);
+		frame_red = red_end();
 	}
 }
 
@@ -440,13 +603,188 @@ void epd_screen_clean(int mode)
 }
 
 
+/******************************************************************************/
+
+
+// flash图片槽
+//
+// 保存一帧画面，显示时从flash直接送进控制器RAM，不占用fb。flash和屏幕是两组引脚，
+// 用sf_read_stream()每读SF_STREAM_CHUNK字节就写给屏幕，一读一写交替进行，只需要这
+// 一块栈上的缓冲。保持fb原样，显示以后还可以在fb里画别的东西。
+//
+// 数据就是fb的内容: 黑白平面，三色屏后面跟着红色平面，每个平面scr_h*line_bytes字节。
+// 头放在槽的最后，数据写完才写头，写了一半的槽不会被当成有效的。
+// 122x250的三色屏两个平面共8000字节，头放在前面就放不下了。
+
+#define IMG_SLOT_ADDR   0x3b000
+#define IMG_SLOT_SIZE   0x2000
+#define IMG_HDR_ADDR    (IMG_SLOT_ADDR+IMG_SLOT_SIZE-sizeof(IMG_HDR))
+#define IMG_MAGIC       0x474d4945  // "EIMG"
+
+typedef struct {
+	u32 magic;
+	u16 w;
+	u16 h;
+	u8  mode;       // scr_mode
+	u8  red;        // 红色平面里有没有点
+	u16 plane;      // 一个平面的字节数
+}IMG_HDR;
+
+
+static int img_read_hdr(IMG_HDR *hdr)
+{
+	sf_read(IMG_HDR_ADDR, sizeof(IMG_HDR), (u8*)hdr);
+	return hdr->magic==IMG_MAGIC;
+}
+
+
+// 把fb里的画面存进图片槽。放不下返回-1
+int epd_image_save(void)
+{
+	IMG_HDR hdr;
+	int i, red = 0;
+	int plane = scr_h*line_bytes;
+	int planes = (scr_mode&EPD_BWR)? 2 : 1;
+
+	if(plane*planes > IMG_SLOT_SIZE-sizeof(IMG_HDR))
+		return -1;
+
+	if(fb_rr){
+		for(i=0; i<plane; i++)
+			red |= fb_rr[i];
+	}
+
+	hdr.magic = IMG_MAGIC;
+	hdr.w = scr_w;
+	hdr.h = scr_h;
+	hdr.mode = scr_mode;
+	hdr.red = red? 1 : 0;
+	hdr.plane = plane;
+
+	fspi_init();
+	sf_erase(IMG_SLOT_ADDR, IMG_SLOT_SIZE, 1);
+	sf_write(IMG_SLOT_ADDR, fb_bw, plane);
+	if(planes==2)
+		sf_write(IMG_SLOT_ADDR+plane, fb_rr, plane);
+	sf_write(IMG_HDR_ADDR, (u8*)&hdr, sizeof(IMG_HDR));
+	fspi_exit();
+
+	printk("Image saved: %dx%d mode %02x  %d bytes\n", scr_w, scr_h, scr_mode, plane*planes);
+	return 0;
+}
+
+
+// 图片槽里有没有和当前屏幕参数一致的画面
+int epd_image_valid(void)
+{
+	IMG_HDR hdr;
+	int ok;
+
+	fspi_init();
+	ok = img_read_hdr(&hdr);
+	fspi_exit();
+
+	return ok && hdr.w==scr_w && hdr.h==scr_h && hdr.mode==scr_mode && hdr.plane==scr_h*line_bytes;
+}
+
+
+// 代替epd_screen_update()，把图片槽里的画面写进控制器RAM。调用前先用epd_image_valid()检查
+void epd_image_upload(void)
+{
+	IMG_HDR hdr;
 
+	fspi_init();
+	img_read_hdr(&hdr);
 
+	epd_cmd(0x24);
+	sf_read_stream(IMG_SLOT_ADDR, hdr.plane, epd_data_array);
+	if(scr_mode&EPD_BWR){
+		epd_cmd(0x26);
+		red_begin();
+		sf_read_stream(IMG_SLOT_ADDR+hdr.plane, hdr.plane, red_stream);
+		frame_red = red_end();
+	}
+
+	fspi_exit();
+}
 
 
 /******************************************************************************/
 
 
+// 控制器RAM探测
+//
+// 控制器的RAM一般比玻璃大，越界的地址写不进去或者回绕到开头。从大到小试几个常见的
+// 尺寸: 在(0,0)写0x00，在最后一个字节写0x5a，两个都能原样读回来就认为RAM有这么大。
+// 0x41选择0x27读哪一块RAM，0x26那块能读回写入的值说明控制器有两块RAM，三色屏需要它。
+
+static const u16 probe_widths[]  = {200, 176, 160, 128, 104};
+static const u16 probe_heights[] = {300, 296, 250, 212};
+
+
+static void ram_write(int cmd, int xb, int y, int value)
+{
+	epd_cmd2(0x44, 0, xb);
+	epd_cmd4(0x45, 0, 0, y, y>>8);
+	epd_cmd1(0x4e, xb);
+	epd_cmd2(0x4f, y, y>>8);
+	epd_cmd1(cmd, value);
+}
+
+
+static int ram_read(int xb, int y)
+{
+	u8 buf[2];
+
+	epd_cmd1(0x4e, xb);
+	epd_cmd2(0x4f, y, y>>8);
+	epd_cmd_read(0x27, buf, 2);  // 第一个字节是dummy
+	return buf[1];
+}
+
+
+static int ram_test(int xb, int y)
+{
+	ram_write(0x24, 0, 0, 0x00);
+	ram_write(0x24, xb, y, 0x5a);
+	if(ram_read(xb, y)!=0x5a)
+		return 0;
+	return ram_read(0, 0)==0x00;
+}
+
+
+static void epd_probe_ram(void)
+{
+	int i;
+
+	epd_cmd1(0x11, 0x03);
+
+	probe_ram_w = 0;
+	for(i=0; i<sizeof(probe_widths)/2; i++){
+		if(ram_test((probe_widths[i]>>3)-1, 0)){
+			probe_ram_w = probe_widths[i];
+			break;
+		}
+	}
+
+	probe_ram_h = 0;
+	for(i=0; i<sizeof(probe_heights)/2; i++){
+		if(ram_test(0, probe_heights[i]-1)){
+			probe_ram_h = probe_heights[i];
+			break;
+		}
+	}
+
+	ram_write(0x24, 0, 0, 0x00);
+	ram_write(0x26, 0, 0, 0xa5);
+	epd_cmd1(0x41, 0x01);
+	probe_red = ram_read(0, 0)==0xa5;
+	epd_cmd1(0x41, 0x00);
+
+	printk("EPD RAM: %dx%d %s\n", probe_ram_w, probe_ram_h, probe_red? "BW+R" : "BW");
+}
+
+
 int epd_detect(void)
 {
 	int retv = 0;
@@ -455,9 +793,12 @@ int epd_detect(void)
 	epd_reset(1);
 	epd_cmd(0x12); // SWRESET
 	if(epd_busy()){
-		epd_wait();
-		epd_lut_size();
-		retv = 1;
+		// BUSY一直不变低的控制器读不出可靠的结果，按没有探测到处理
+		if(epd_wait()==0){
+			epd_lut_size();
+			epd_probe_ram();
+			retv = 1;
+		}
 	}
 	epd_hw_close();
 	return retv;
@@ -467,6 +808,80 @@ int epd_detect(void)
 /******************************************************************************/
 
 
+// 控制器到屏幕的对应表。同一种控制器会配不同的玻璃，这里只能记最常见的搭配
+typedef struct {
+	u8  lut;
+	u16 ram_w, ram_h;
+	u16 w, h;
+}EPD_PANEL;
+
+static const EPD_PANEL epd_panels[] = {
+	{ 70, 128, 250,  122, 250},
+	{ 70, 104, 212,  104, 212},
+	{100, 176, 296,  128, 296},
+	{100, 128, 296,  128, 296},
+	{100, 128, 250,  122, 250},
+};
+#define EPD_PANEL_NUM  (sizeof(epd_panels)/sizeof(EPD_PANEL))
+
+
+static int panel_fit(int w, int h)
+{
+	if(w<=0 || h<=0 || ((w+7)>>3)*h>FB_SIZE)
+		return 0;
+	if(probe_ram_w && probe_ram_h && (w>probe_ram_w || h>probe_ram_h))
+		return 0;
+	return 1;
+}
+
+
+// 根据epd_detect()的结果选择分辨率和颜色。控制器能在表里查到时用表里的分辨率；
+// 查不到时用flash配置区的记录(RAM放得下才用，有些标签里的记录和实际的屏对不上)，
+// 再不行用RAM能放下的最大的屏，什么都探测不到时用2.13寸122x250。
+void epd_panel_select(int *w, int *h, int *mode)
+{
+	const EPD_PANEL *p;
+	int i, best = -1;
+
+	*w = 122;
+	*h = 250;
+	*mode = EPD_BW;
+
+	for(i=0; i<EPD_PANEL_NUM; i++){
+		p = &epd_panels[i];
+		if(p->lut==lut_size && p->ram_w==probe_ram_w && p->ram_h==probe_ram_h){
+			best = i;
+			break;
+		}
+	}
+	if(best<0 && panel_fit(detect_w, detect_h)){
+		*w = detect_w;
+		*h = detect_h;
+	}else{
+		if(best<0 && probe_ram_w && probe_ram_h){
+			for(i=0; i<EPD_PANEL_NUM; i++){
+				p = &epd_panels[i];
+				if(panel_fit(p->w, p->h) && (best<0 || p->w*p->h>epd_panels[best].w*epd_panels[best].h))
+					best = i;
+			}
+		}
+		if(best>=0){
+			*w = epd_panels[best].w;
+			*h = epd_panels[best].h;
+		}
+	}
+
+	// 玻璃是不是三色的只有flash里的记录知道，控制器没有第二块RAM时只能按黑白屏用
+	if(detect_mode==EPD_BWR && probe_red)
+		*mode = EPD_BWR;
+
+	printk("EPD panel: %dx%d %s\n", *w, *h, (*mode==EPD_BWR)? "BWR" : "BW");
+}
+
+
+/******************************************************************************/
+
+
 #if 0
 
 void epd_test(void)
@@ -2,6 +2,14 @@
 
 #include "user_config.h"
 
+// 刷新时由BUSY下降沿唤醒CPU，波形期间允许睡眠。为0时退回40ms轮询。
+#ifndef EPD_BUSY_IRQ
+#define EPD_BUSY_IRQ  1
+#endif
+
+// epd_wait()最多等多少毫秒。只够复位，刷新的波形比它长
+#define EPD_WAIT_MS   4000
+
 
 typedef unsigned  char  u8;
 typedef unsigned short  u16;
@@ -23,19 +31,52 @@ int fspi_config(u32 gpio_word);
 int fspi_init(void);
 int fspi_exit(void);
 int sf_readid(void);
+int sf_status(int id);
+int sf_wait(void);
 int sf_sector_erase(int cmd, int addr, int wait);
+int sf_erase(int addr, int size, int wait);
 int sf_page_write(int addr, u8 *buf, int size);
+int sf_write(int addr, u8 *buf, int size);
 int sf_read(int addr, int len, u8 *buf);
+#define SF_STREAM_CHUNK  64
+typedef void (*SF_READ_FUNC)(u8 *buf, int len);
+int sf_read_stream(int addr, int len, SF_READ_FUNC func);
+int sf_read_width(void);
 int selflash(int otp_boot);
+void selflash_verify(void);
+extern int boot_verify_pending;
+
+// crc32: 和zlib相同的CRC-32，可以分段计算，第一段的crc为0
+uint32_t crc32(uint32_t crc, const void *buf, size_t size);
+
+// 开机计时: 从user_app_init到第一帧刷新完成
+extern u32 boot_t0;
+extern int boot_timing;
+
+// kvs: flash上的键值存储，key 0-254，值最长128字节
+#define KV_SETTINGS   1   // 显示模式、12/24小时制
+#define KV_TIME       2   // 时间检查点
+#define KV_COUNTDOWN  3   // 倒计时目标
+#define KV_TIMEKEEP   4   // 走时误差和温度系数
+void kv_init(void);
+int kv_get(int key, void *buf, int len);
+int kv_set(int key, const void *buf, int len);
+
+// ota
+extern int ota_state;
 int ota_handle(u8 *buf);
+void ota_push(int status, int pages);
 
 // epd_hw
 void epd_hw_init(u32 config0, u32 config1, int w, int h, int mode);
 void epd_hw_open(void);
 void epd_hw_close(void);
+void epd_hw_resume(void);
+u32  epd_ticks(void);
 void epd_reset(int val);
-void epd_wait(void);
+int  epd_wait(void);
 int  epd_busy(void);
+int  epd_busy_gpio(void);
 void epd_power(int on);
 
 void epd_cmd(int cmd);
@@ -53,18 +94,77 @@ void epd_init(void);
 void epd_update_mode(int mode);
 void epd_update();
 void epd_sleep(void);
+void epd_retain(void);
+void epd_power_off(void);
 void epd_window(int x1, int y1, int x2, int y2);
 void epd_set_gray_image(const u8 *image);
 void epd_load_lut(u8 *lut);
 void epd_screen_update(void);
 void epd_screen_clean(int mode);
 int  epd_detect(void);
+void epd_panel_select(int *w, int *h, int *mode);
+int  epd_temp_read(void);
+int  epd_image_save(void);
+int  epd_image_valid(void);
+void epd_image_upload(void);
 
 
 extern u8 lut_p[];
+extern u32 epd_spi_bytes;
+extern int epd_state;
+
+// epd_state
+#define EPD_STATE_OFF     0  // 断电，需要完整初始化
+#define EPD_STATE_READY   1  // 已初始化，可以写RAM
+#define EPD_STATE_BUSY    2  // 正在刷新
+#define EPD_STATE_RETAIN  3  // 刷新完成但保持上电，寄存器和LUT仍有效
+
+// epd_trace
+enum {
+	TRACE_DRAW = 0,
+	TRACE_INIT,
+	TRACE_UPLOAD,
+	TRACE_LUT,
+	TRACE_BUSY,
+	TRACE_SLEEP,
+	TRACE_PHASES,
+};
+#define TRACE_F_RETAIN  0x01  // 控制器保持上电(同一模式时跳过初始化)
+#define TRACE_F_QUEUED  0x02  // 流水线中挂起的帧，上一帧刷完后立即上传
+#define TRACE_F_FLASH   0x04  // 从flash图片槽直接上传，不经过fb
+void epd_trace_draw(void);
+void epd_trace_begin(int mode, int flags);
+void epd_trace_mode(int mode);
+void epd_trace_phase(int phase);
+void epd_trace_end(void);
+void epd_trace_dump(void);
+int  epd_trace_pack(u8 *buf, int len);
 // epd_sxtend相关
 void gray_mode_refresh(void);
 void custom_clock_draw(int flag);
+void draw_clock(int flags);
+void calendar_draw(int flags);
+
+// epd_bench
+void epd_bench_run(void);
+
+// epd_layer: 静态层缓存
+#define LAYER_HASH_INIT  0x811c9dc5
+#define LAYER_BUF_SIZE   2048
+void layer_init(void);
+u32 layer_hash(u32 hash, const void *data, int len);
+u32 layer_hash_int(u32 hash, int value);
+int layer_restore(u32 key);
+void layer_save(u32 key);
+void layer_invalidate(void);
+int layer_size(void);
+
+// epd_date: 公历日期运算，天数是距1970-01-01的天数，月份0-11，日期从0开始
+int is_leap_year(int y);
+int days_in_month(int y, int m);
+int days_from_civil(int y, int m, int d);
+void civil_from_days(int days, int *y_out, int *m_out, int *d_out);
+int weekday_from_days(int days);
 
 // epd_gui
 void draw_pixel(int x, int y, int color);
@@ -74,16 +174,20 @@ void draw_line(int x1, int y1, int x2, int y2, int color);
 void draw_rect(int x1, int y1, int x2, int y2, int color);
 void draw_box(int x1, int y1, int x2, int y2, int color);
 void draw_bitmap(int start_x, int start_y, int width, int height, const unsigned char *img);
+void draw_bitmap_mask(int start_x, int start_y, int width, int height, const unsigned char *img, int color);
 void draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3, int color);
 void draw_filled_triangle(int x1, int y1, int x2, int y2, int x3, int y3, int color);
 
 
 void draw_text(int x, int y, char *str, int color);
 void draw_text_filled(int x, int y, char *str, int color);
+void draw_text_box(int x, int y, char *str, int color, int bg_color);
 void fb_set_scale(int scale);
+#define FONT_NUM  5
 int select_font(int id);
 int fb_draw_font_info(int x, int y, const u8 *font_data, int color);
 int fb_draw_font(int x, int y, int ucs, int color);
+int fb_get_font_width(int ucs);
 void fb_test(void);
 
 void draw_qr_code(
@@ -97,6 +201,7 @@ void draw_qr_code(
 void select_layout(int xres, int yres);
 
 void refresh_screen(int UPDATE_MODE);//广义上的刷新屏幕，只要调用这个就能集成掉用其他方法
+int refresh_image(int UPDATE_MODE);
 extern uint8_t redraw_dirty_mark;
 
 #define EPD_BW    0x00
@@ -120,7 +225,17 @@ enum
 	CLOCK_MODE= 1,
 	CALENDAR_MODE=2,
 	CUSTOM_CLOCK_MODE =3,
-	LB_MODE=4
+	LB_MODE=4,
+	STATIC_MODE=5		// 固定显示图片槽里的画面(0x96)
+};
+
+// 画面下一次需要变化的时刻，时钟定时器按它唤醒
+enum
+{
+	NEXT_MINUTE = 0,
+	NEXT_HOUR,
+	NEXT_DAY,
+	NEXT_NEVER			// 仍然每小时醒一次，记时间检查点和开广播
 };
 
 
@@ -146,16 +261,29 @@ extern int update_mode;
 extern int detect_w;
 extern int detect_h;
 extern int detect_mode;
+extern int probe_ram_w;
+extern int probe_ram_h;
+extern int probe_red;
 
 
 extern int win_w;
 extern int win_h;
 
+#define EPD_TEMP_NONE  (-0x8000)
+extern int epd_temp;
+
 extern int fb_w;
 extern int fb_h;
 
-extern u8 fb_bw[];
-extern u8 fb_rr[];
+// 一个平面按行对齐的最大大小，按布局表里最大的屏留: 128x296的屏每行16字节，共296行
+#define FB_SIZE  4736
+// 帧缓冲区总大小: 两个平面加静态层缓存。黑白屏只用一个平面，剩下的给其他缓冲
+#define FB_ARENA_SIZE  (FB_SIZE*2+LAYER_BUF_SIZE)
+extern u8 *fb_bw;
+extern u8 *fb_rr;   // 只有三色屏才有，黑白屏为NULL
+void fb_init(void);
+u8 *fb_alloc(int size);
+int fb_free_size(void);
 //epd math
 typedef struct {
     int x;
@@ -0,0 +1,242 @@
+
+
+#include "epd.h"
+
+#ifdef EPD_SIM
+#include <time.h>
+#else
+#include "datasheet.h"
+#endif
+
+
+/******************************************************************************/
+
+// 绘图热点的基准测试
+//
+// 目标板上用SysTick计数CPU时钟周期(M0没有DWT)，主机仿真里用clock_gettime计纳秒。
+// 结果每项一行，方便脚本对比前后两次的结果:
+//   BENCH <名称> <次数> <平均> <最小> <单位>
+// 会改写fb和屏幕RAM，跑完需要重画。
+
+
+#ifdef EPD_SIM
+
+#define BENCH_UNIT  "ns"
+
+static void bench_timer_start(void)
+{
+}
+
+static void bench_timer_stop(void)
+{
+}
+
+static u32 bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+static u32 bench_elapsed(u32 start)
+{
+	return bench_now()-start;
+}
+
+#else
+
+#define BENCH_UNIT  "cyc"
+
+// SysTick是24位的递减计数器，16MHz下大约1秒回绕一次，单次测量不能超过这个时间
+static void bench_timer_start(void)
+{
+	SysTick->LOAD = 0x00ffffff;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+static void bench_timer_stop(void)
+{
+	SysTick->CTRL = 0;
+}
+
+static u32 bench_now(void)
+{
+	return SysTick->VAL;
+}
+
+static u32 bench_elapsed(u32 start)
+{
+	return (start-SysTick->VAL)&0x00ffffff;
+}
+
+#endif
+
+
+typedef void (*BENCH_FUNC)(int i);
+
+static void bench(const char *name, int iters, BENCH_FUNC fn)
+{
+	u32 t, total = 0, min = 0xffffffff;
+	int i;
+
+	for(i=0; i<iters; i++){
+		t = bench_now();
+		fn(i);
+		t = bench_elapsed(t);
+		total += t;
+		if(t<min)
+			min = t;
+	}
+
+	printk("BENCH %s %d %d %d %s\n", name, iters, total/iters, min, BENCH_UNIT);
+}
+
+
+/******************************************************************************/
+
+static const u8 bench_bitmap[32*4] = {
+	0xff, 0xff, 0xff, 0xff, 0x80, 0x00, 0x00, 0x01, 0xbf, 0xff, 0xff, 0xfd, 0xa0, 0x00, 0x00, 0x05,
+	0xaf, 0xff, 0xff, 0xf5, 0xa8, 0x00, 0x00, 0x15, 0xab, 0xff, 0xff, 0xd5, 0xaa, 0x00, 0x00, 0x55,
+	0xaa, 0xff, 0xff, 0x55, 0xaa, 0x80, 0x01, 0x55, 0xaa, 0xbf, 0xfd, 0x55, 0xaa, 0xa0, 0x05, 0x55,
+	0xaa, 0xaf, 0xf5, 0x55, 0xaa, 0xa8, 0x15, 0x55, 0xaa, 0xab, 0xd5, 0x55, 0xaa, 0xaa, 0x55, 0x55,
+	0xaa, 0xaa, 0x55, 0x55, 0xaa, 0xab, 0xd5, 0x55, 0xaa, 0xa8, 0x15, 0x55, 0xaa, 0xaf, 0xf5, 0x55,
+	0xaa, 0xa0, 0x05, 0x55, 0xaa, 0xbf, 0xfd, 0x55, 0xaa, 0x80, 0x01, 0x55, 0xaa, 0xff, 0xff, 0x55,
+	0xaa, 0x00, 0x00, 0x55, 0xab, 0xff, 0xff, 0xd5, 0xa8, 0x00, 0x00, 0x15, 0xaf, 0xff, 0xff, 0xf5,
+	0xa0, 0x00, 0x00, 0x05, 0xbf, 0xff, 0xff, 0xfd, 0x80, 0x00, 0x00, 0x01, 0xff, 0xff, 0xff, 0xff,
+};
+
+static int bench_font;
+static int bench_scale;
+// 逻辑方向的画布大小
+static int bw, bh;
+
+static void b_pixel(int i)
+{
+	int n;
+	// 每次画一行，覆盖整个fb
+	for(n=0; n<bw; n++)
+		draw_pixel(n, i%bh, (n^i)&1);
+}
+
+static void b_line(int i)
+{
+	draw_line(0, 0, bw-1, (i*7)%bh, SWAP);
+}
+
+static void b_box(int i)
+{
+	draw_box(10, 10, 10+(i%64)+32, 10+(i%32)+32, SWAP);
+}
+
+static void b_triangle(int i)
+{
+	draw_filled_triangle(0, 0, bw-1, i%bh, bw/2, bh-1, SWAP);
+}
+
+static void b_bitmap(int i)
+{
+	draw_bitmap((i*8)%(bw-32), (i*4)%(bh-32), 32, 32, bench_bitmap);
+}
+
+static void b_text(int i)
+{
+	select_font(bench_font);
+	fb_set_scale(bench_scale);
+	if(bench_font==1 || bench_font==3){
+		// 数码管字体只有数字
+		draw_text(0, 0, "12:34", BLACK);
+	}else{
+		draw_text(0, 0, "Hello 2026 星期二", BLACK);
+	}
+	fb_set_scale(1);
+	select_font(0);
+}
+
+static void b_clock(int i)
+{
+	draw_clock(UPDATE_FAST);
+}
+
+static void b_calendar(int i)
+{
+	calendar_draw(UPDATE_FAST);
+}
+
+static void b_screen_update(int i)
+{
+	epd_screen_update();
+}
+
+static void b_crc32(int i)
+{
+	// 整个fb，起点错开测试非对齐的开头
+	crc32(0, fb_bw+(i&3), scr_h*line_bytes-3);
+}
+
+
+#ifndef EPD_SIM
+static void b_sf_read(int i)
+{
+	sf_read(0x38000, 1024, fb_bw);
+}
+#endif
+
+
+void epd_bench_run(void)
+{
+	static char name[24];
+	int f, s;
+
+	printk("BENCH-BEGIN %08x %dx%d\n", EPD_VERSION, scr_w, scr_h);
+	bench_timer_start();
+
+	bw = (scr_mode&1)? scr_h : scr_w;
+	bh = (scr_mode&1)? scr_w : scr_h;
+	memset(fb_bw, 0xff, scr_h*line_bytes);
+	if(fb_rr)
+		memset(fb_rr, 0x00, scr_h*line_bytes);
+
+	bench("draw_pixel_row", 32, b_pixel);
+	bench("draw_line", 32, b_line);
+	bench("draw_box", 32, b_box);
+	bench("draw_filled_triangle", 16, b_triangle);
+	bench("draw_bitmap_32x32", 32, b_bitmap);
+
+	for(f=0; f<FONT_NUM; f++){
+		for(s=1; s<=2; s++){
+			bench_font = f;
+			bench_scale = s;
+			sprintf(name, "draw_text_f%d_x%d", f, s);
+			bench(name, 8, b_text);
+		}
+	}
+
+	bench("crc32_fb", 16, b_crc32);
+
+#ifndef EPD_SIM
+	// 仿真里没有flash
+	fspi_init();
+	sprintf(name, "sf_read_1k_x%d", sf_read_width());
+	bench(name, 4, b_sf_read);
+	fspi_exit();
+#endif
+
+	bench("draw_clock", 8, b_clock);
+	bench("calendar_draw", 8, b_calendar);
+
+	// 只往控制器RAM里写，不触发刷新
+	if(epd_state==EPD_STATE_OFF){
+		epd_hw_open();
+		epd_init();
+		bench("epd_screen_update", 4, b_screen_update);
+		epd_power_off();
+	}
+
+	bench_timer_stop();
+	printk("BENCH-END\n");
+}
+
+
+/******************************************************************************/
+
@@ -0,0 +1,74 @@
+
+
+#include "epd.h"
+
+
+/******************************************************************************/
+
+// 公历日期运算
+//
+// 天数是距1970-01-01的天数，算法来自Howard Hinnant的days_from_civil/civil_from_days，
+// 不需要按年或按月循环。月份0-11、日期从0开始，和全局变量month/date的约定相同。
+// 以3月为一年的开始，这样闰日落在"年"的最后，每400年(146097天)是一个完整的周期。
+
+
+int is_leap_year(int y)
+{
+	return (y%4==0 && y%100!=0) || (y%400==0);
+}
+
+
+int days_in_month(int y, int m)
+{
+	static const u8 mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+	if(m==1 && is_leap_year(y))
+		return 29;
+	return mdays[m];
+}
+
+
+int days_from_civil(int y, int m, int d)
+{
+	int era, yoe, doy, doe;
+
+	m += 1;
+	d += 1;
+	if(m<=2)
+		y -= 1;
+	era = (y>=0? y : y-399)/400;
+	yoe = y-era*400;                                  // [0, 399]
+	doy = (153*(m>2? m-3 : m+9)+2)/5 + d-1;           // [0, 365]
+	doe = yoe*365 + yoe/4 - yoe/100 + doy;            // [0, 146096]
+	return era*146097 + doe - 719468;
+}
+
+
+void civil_from_days(int days, int *y_out, int *m_out, int *d_out)
+{
+	int era, doe, yoe, doy, mp, y, m;
+
+	days += 719468;
+	era = (days>=0? days : days-146096)/146097;
+	doe = days-era*146097;                                  // [0, 146096]
+	yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;    // [0, 399]
+	y = yoe + era*400;
+	doy = doe - (365*yoe + yoe/4 - yoe/100);                // [0, 365]
+	mp = (5*doy+2)/153;                                     // [0, 11]，从3月开始
+	m = (mp<10)? mp+3 : mp-9;                               // [1, 12]
+
+	*y_out = (m<=2)? y+1 : y;
+	*m_out = m-1;
+	*d_out = doy - (153*mp+2)/5;
+}
+
+
+// 0: 星期日。1970-01-01是星期四
+int weekday_from_days(int days)
+{
+	return (days>=-4)? (days+4)%7 : (days+5)%7+6;
+}
+
+
+/******************************************************************************/
+
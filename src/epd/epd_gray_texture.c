@@ -1,3 +1,2 @@
 #include "epd.h"
-#define FB_SIZE 3813
 //计划在这里存储某些东西，以期实现默认情况下的灰度显示
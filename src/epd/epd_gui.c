@@ -8,9 +8,62 @@
 int fb_w;
 int fb_h;
 
-#define FB_SIZE 3813
-u8 fb_bw[FB_SIZE];
-u8 fb_rr[FB_SIZE];
+u8 *fb_bw;
+u8 *fb_rr;
+
+// 帧缓冲和附属缓冲(静态层缓存等)都从这一块内存里分，按当前屏幕的大小分配。
+// 黑白屏不分配红色平面，省下的空间留给后面的缓冲。4字节对齐。
+static u32 fb_arena[FB_ARENA_SIZE/4];
+static int fb_used;
+
+
+// 从剩下的空间里分配size字节，不够时返回NULL
+u8 *fb_alloc(int size)
+{
+	u8 *p;
+
+	size = (size+3)&~3;
+	if(fb_used+size>FB_ARENA_SIZE){
+		printk("fb_alloc: %d bytes, only %d left\n", size, FB_ARENA_SIZE-fb_used);
+		return NULL;
+	}
+	p = (u8*)fb_arena+fb_used;
+	fb_used += size;
+	return p;
+}
+
+
+int fb_free_size(void)
+{
+	return FB_ARENA_SIZE-fb_used;
+}
+
+
+// 按scr_w/scr_h/scr_mode重新划分。epd_hw_init()改了屏幕参数后调用，之前分配的缓冲全部作废
+void fb_init(void)
+{
+	int size = scr_h*line_bytes;
+	int planes = (scr_mode&EPD_BWR)? 2 : 1;
+
+	if(size*planes>FB_ARENA_SIZE && planes==2){
+		printk("fb_init: no room for the red plane, use BW\n");
+		scr_mode &= ~EPD_BWR;
+		planes = 1;
+	}
+	if(size>FB_ARENA_SIZE){
+		scr_h = FB_ARENA_SIZE/line_bytes;
+		size = scr_h*line_bytes;
+		printk("fb_init: %d lines only\n", scr_h);
+	}
+
+	fb_used = 0;
+	fb_bw = fb_alloc(size);
+	fb_rr = (planes==2)? fb_alloc(size) : NULL;
+	layer_init();
+
+	printk("FB: %dx%d %s %d bytes, %d free\n", scr_w, scr_h, (planes==2)? "BWR" : "BW",
+		size*planes, fb_free_size());
+}
 
 /******************************************************************************/
 void draw_pixel(int x, int y, int color)
@@ -32,6 +85,9 @@ void draw_pixel(int x, int y, int color)
 		ny = scr_h-1-x;
 	}
 	//if(scr_mode&MIRROR_H)nx += scr_padding;
+	// 越界的点直接丢掉，布局里画到xres/yres的线不会写坏fb前后的内存
+	if(nx<0 || nx>=scr_w || ny<0 || ny>=scr_h)
+		return;
 
 	// 2. 核心计算：确保 nx=0 对应字节最高位 0x80
   int byte_pos = ny * line_bytes + (nx >> 3);
@@ -39,15 +95,24 @@ void draw_pixel(int x, int y, int color)
 	switch (color) {
         case BLACK: // 0
             fb_bw[byte_pos] &= ~bit_mask; // 清零变黑
+            if (fb_rr)
+                fb_rr[byte_pos] &= ~bit_mask;
             break;
 
         case WHITE: // 1
             fb_bw[byte_pos] |= bit_mask;  // 置位变白
+            if (fb_rr)
+                fb_rr[byte_pos] &= ~bit_mask;
             break;
 
         case RED:   // 2
-            if (scr_mode & EPD_BWR) {
+            // 红色平面置位就显示红色，黑白平面同时置白，两个平面的内容保持一致。
+            // 黑白屏没有红色平面，按黑色画，节日这类强调色照样看得见
+            if (fb_rr) {
                 fb_rr[byte_pos] |= bit_mask;
+                fb_bw[byte_pos] |= bit_mask;
+            } else {
+                fb_bw[byte_pos] &= ~bit_mask;
             }
             break;
 
@@ -267,6 +332,24 @@ void draw_bitmap(int start_x, int start_y, int width, int height, const unsigned
         }
     }
 }
+
+
+// 只画图片里为1的点，为0的点保持原样。用来叠加红色平面: 先用draw_bitmap画黑白图，
+// 再用这个函数以RED画红色部分
+void draw_bitmap_mask(int start_x, int start_y, int width, int height, const unsigned char *img, int color)
+{
+	int bytes_per_line = (width + 7) / 8;
+	int x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			if (img[y * bytes_per_line + (x >> 3)] & (0x80 >> (x & 7)))
+				draw_pixel(start_x + x, start_y + y, color);
+		}
+	}
+}
 /******************************************************************************/
 
 #include "sfont.h"
@@ -275,7 +358,7 @@ void draw_bitmap(int start_x, int start_y, int width, int height, const unsigned
 #include "font66.h"
 #include "KH_Dot_Hatcyoubori_16.h"
 //typedef unsigned  char  u8;写在头文件
-const u8 *font_list[6] = {
+const u8 *font_list[FONT_NUM] = {
 	sfont,
 	F_DSEG7_50,
 	sfont16,
@@ -294,7 +377,7 @@ void fb_set_scale(int scale)
 
 int select_font(int id)
 {
-	if(id>=sizeof(font_list))return 0;
+	if(id<0 || id>=FONT_NUM)return 0;
 	current_font = font_list[id];
 	return 0;
 }
@@ -314,6 +397,9 @@ static const u8 *find_font(const u8 *font, int ucs)
 		}
 	}
 
+	// 当前字体里没有的字符到默认字体里找，默认字体也没有就放弃
+	if (font == font_list[0])
+		return NULL;
 	return find_font(font_list[0],ucs);
 }
 
@@ -494,12 +580,7 @@ void draw_text(int x, int y, char *str, int color)
  */
 void draw_text_filled(int x, int y, char *str, int color)
 {
-    int tw, th;
-    
-    // 1. 获取文字实际占用的宽高
-    get_text_dimension(str, &tw, &th);
-
-    // 2. 确定背景色
+    // 确定背景色
     // 如果文字是黑色(0)，背景设为白色(1)；反之亦然。
     // 如果是 RED 或 SWAP，则根据需要设定，这里默认为取反
     int bg_color;
@@ -507,12 +588,25 @@ void draw_text_filled(int x, int y, char *str, int color)
     else if (color == WHITE) bg_color = BLACK;
     else                     bg_color = WHITE; // 默认背景
 
-    // 3. 计算边距 (Padding)
+    draw_text_box(x, y, str, color, bg_color);
+}
+
+/**
+ * @brief 绘制指定背景色的文字，例如三色屏上的红底白字
+ */
+void draw_text_box(int x, int y, char *str, int color, int bg_color)
+{
+    int tw, th;
+    
+    // 1. 获取文字实际占用的宽高
+    get_text_dimension(str, &tw, &th);
+
+    // 2. 计算边距 (Padding)
     // 建议边距随字号缩放，或者固定为一个视觉舒适的值
     int pad_x = 4 * font_scale; 
     int pad_y = 8 * font_scale;
 
-    // 4. 绘制背景矩形
+    // 3. 绘制背景矩形
     // 注意：draw_box 通常需要左上角和右下角坐标
     draw_box(x - pad_x/2, 
              y, 
@@ -520,7 +614,7 @@ void draw_text_filled(int x, int y, char *str, int color)
              y + th + pad_y, 
              bg_color);
 
-    // 5. 绘制文字 (文字在背景之上)
+    // 4. 绘制文字 (文字在背景之上)
     draw_text(x, y, str, color);
 }
 
@@ -1,6 +1,7 @@
 
 
 #include "epd.h"
+#include "lld_evt.h"
 
 
 /******************************************************************************/
@@ -13,6 +14,12 @@ static int epio_cs;
 static int epio_clk;
 static int epio_sdi;
 
+static int epd_hw_opened;
+static int epd_pwr_on;
+
+// SPI发送/接收的字节数，用于统计每次刷新的传输量
+u32 epd_spi_bytes;
+
 
 #define EPD_CLK(n)  gpio_set(epio_clk, (n))
 #define EPD_SDI(n)  gpio_set(epio_sdi, (n))
@@ -87,12 +94,19 @@ void epd_hw_init(u32 config0, u32 config1, int w, int h, int mode)
 	line_bytes = (scr_w+7)>>3;
 	scr_padding = line_bytes*8-scr_w;
 
-	select_layout(h, w);
+	fb_init();
+	select_layout(scr_h, scr_w);
 	
 }
 
 void epd_hw_open(void)
 {
+	// 屏幕处于保持状态时引脚已经配置好，重新配置会把电源拉低
+	if(epd_hw_opened)
+		return;
+	epd_hw_opened = 1;
+	epd_pwr_on = 0;
+
 	gpio_config(epio_pwr , 0x0300, 0);
 	gpio_config(epio_busy, 0x0000, 1);
 	gpio_config(epio_rst , 0x0300, 0);
@@ -104,6 +118,9 @@ void epd_hw_open(void)
 
 void epd_hw_close(void)
 {
+	epd_hw_opened = 0;
+	epd_pwr_on = 0;
+
 	gpio_config(epio_pwr , 0x0300, 0);
 	gpio_config(epio_busy, 0x0000, 0);
 	gpio_config(epio_rst , 0x0300, 0);
@@ -113,10 +130,36 @@ void epd_hw_close(void)
 	gpio_config(epio_sdi , 0x0300, 0);
 }
 
+// 从扩展睡眠唤醒后外设电源域会复位GPIO配置，这里按当前状态恢复引脚。
+// 由set_pad_functions()在每次唤醒时调用。
+void epd_hw_resume(void)
+{
+	if(epd_hw_opened==0)
+		return;
+
+	gpio_config(epio_pwr , 0x0300, epd_pwr_on);
+	gpio_config(epio_busy, 0x0000, 1);
+	gpio_config(epio_rst , 0x0300, 1);
+	gpio_config(epio_dc  , 0x0300, 0);
+	gpio_config(epio_cs  , 0x0300, 1);
+	gpio_config(epio_clk , 0x0300, 0);
+	gpio_config(epio_sdi , 0x0300, 0);
+}
+
+
+// BLE基准时钟，单位625us，睡眠期间也在计数
+u32 epd_ticks(void)
+{
+	return lld_evt_time_get();
+}
+
+
 static void epd_spi_write(int value)
 {
 	int i;
 
+	epd_spi_bytes += 1;
+
 	for(i=0; i<8; i++){
 		EPD_CLK(0);
 		EPD_SDI(value&0x80);
@@ -130,6 +173,7 @@ static int epd_spi_read(void)
 {
 	int i, value=0;
 
+	epd_spi_bytes += 1;
 	for(i=0; i<8; i++){
 		EPD_CLK(0);
 		value <<= 1;
@@ -147,9 +191,22 @@ void epd_reset(int val)
 }
 
 
-void epd_wait(void)
+// 阻塞等待BUSY变低，只用于复位等很短的操作。刷新的波形不要用它，等BUSY的下降沿中断。
+// 最多等EPD_WAIT_MS(delay_ms(1)不是很准，大约4秒)，防止屏幕掉线时卡死。
+// 返回0表示BUSY已经变低，-1表示超时，BUSY还是高的
+int epd_wait(void)
 {
-	while(EPD_BUSY());
+	int timeout = EPD_WAIT_MS;
+
+	while(EPD_BUSY()){
+		if(timeout==0){
+			printk("epd_wait: BUSY timeout\n");
+			return -1;
+		}
+		delay_ms(1);
+		timeout -= 1;
+	}
+	return 0;
 }
 
 
@@ -159,8 +216,16 @@ int epd_busy(void)
 }
 
 
+// BUSY引脚编号(高4位为port，低4位为pin)，用于配置唤醒中断
+int epd_busy_gpio(void)
+{
+	return epio_busy;
+}
+
+
 void epd_power(int on)
 {
+	epd_pwr_on = on;
 	EPD_PWR(on);
 }
 
@@ -0,0 +1,202 @@
+
+
+#include "epd.h"
+
+
+/******************************************************************************/
+
+// 静态层缓存
+//
+// 每个显示模式的画面分成两部分: 一天(或更久)才变一次的静态层，和每分钟都变的动态层
+// (时间、电量、蓝牙图标)。静态层画好后压缩存起来，用一个内容哈希做key，key由调用者
+// 把决定静态层内容的所有参数(模式、日期、布局等)算进去。下次key相同就直接解压到fb，
+// 只需要再画动态层。
+//
+// 只缓存一层，切换模式时自然失效。压缩用类似PackBits的行程编码:
+//   0x00-0x7f: 后面跟n+1个原样的字节
+//   0x80-0xff: 下一个字节重复n-0x80+2次
+// 画面大部分是白色，122x250的日历压缩后约1.5K，时钟约400字节。压缩后放不下时不缓存，
+// 调用者每次都会重画，结果一样只是慢一点。
+
+
+// 缓冲从帧缓冲区里分，分不到时不缓存
+static u8 *layer_buf;
+static int layer_len;
+static u32 layer_key;
+static int layer_valid;
+
+
+/******************************************************************************/
+
+
+u32 layer_hash(u32 hash, const void *data, int len)
+{
+	const u8 *p = (const u8 *)data;
+
+	while(len--){
+		hash ^= *p++;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+
+u32 layer_hash_int(u32 hash, int value)
+{
+	return layer_hash(hash, &value, sizeof(value));
+}
+
+
+/******************************************************************************/
+
+
+// 按列扫描fb(同一个字节位置从上到下，再到下一列)时下一个字节的位置。
+// 屏幕常用旋转方向显示，逻辑上的一行文字在fb里是竖着的，按列扫描时相同字节连成片，
+// 比按行扫描压缩后小三分之一左右。M0没有除法指令，这里只用加减。
+static int col_next(int pos)
+{
+	pos += line_bytes;
+	if(pos>=scr_h*line_bytes)
+		pos -= scr_h*line_bytes-1;
+	return pos;
+}
+
+
+// 压缩一个平面，返回写入的字节数，放不下返回-1
+static int rle_pack(u8 *dst, int dst_len, const u8 *src)
+{
+	int len = scr_h*line_bytes;
+	int i = 0, n = 0, pos = 0;
+	int lit = -1;   // 当前原样段的控制字节位置
+
+	while(i<len){
+		int v = src[pos];
+		int run = 1;
+		int next = col_next(pos);
+		while(i+run<len && run<129 && src[next]==v){
+			run += 1;
+			next = col_next(next);
+		}
+
+		if(run>=2){
+			if(n+2>dst_len)
+				return -1;
+			dst[n++] = 0x80+run-2;
+			dst[n++] = v;
+			lit = -1;
+		}else{
+			if(lit<0 || dst[lit]==0x7f){
+				if(n+1>dst_len)
+					return -1;
+				lit = n;
+				dst[n++] = 0xff;    // 第一个字节加1后为0
+			}
+			if(n+1>dst_len)
+				return -1;
+			dst[lit] += 1;
+			dst[n++] = v;
+		}
+		i += run;
+		pos = next;
+	}
+
+	return n;
+}
+
+
+// 解压一个平面，返回读掉的字节数
+static int rle_unpack(u8 *dst, const u8 *src)
+{
+	const u8 *p = src;
+	int len = scr_h*line_bytes;
+	int i = 0, pos = 0;
+	int n;
+
+	while(i<len){
+		int ctrl = *p++;
+		if(ctrl&0x80){
+			n = ctrl-0x80+2;
+			i += n;
+			while(n--){
+				dst[pos] = *p;
+				pos = col_next(pos);
+			}
+			p += 1;
+		}else{
+			n = ctrl+1;
+			i += n;
+			while(n--){
+				dst[pos] = *p++;
+				pos = col_next(pos);
+			}
+		}
+	}
+
+	return p-src;
+}
+
+
+/******************************************************************************/
+
+
+// 由fb_init()在重新划分帧缓冲区后调用
+void layer_init(void)
+{
+	layer_buf = fb_alloc(LAYER_BUF_SIZE);
+	layer_valid = 0;
+}
+
+
+// 如果key对应的静态层在缓存中，把它解压到fb并返回1。否则返回0，调用者应该先画静态层，
+// 再调用layer_save()保存，然后画动态层
+int layer_restore(u32 key)
+{
+	int n;
+
+	if(!layer_valid || layer_key!=key)
+		return 0;
+
+	n = rle_unpack(fb_bw, layer_buf);
+	if(scr_mode&EPD_BWR)
+		rle_unpack(fb_rr, layer_buf+n);
+	return 1;
+}
+
+
+void layer_save(u32 key)
+{
+	int n, m = 0;
+
+	layer_valid = 0;
+	if(layer_buf==NULL)
+		return;
+
+	n = rle_pack(layer_buf, LAYER_BUF_SIZE, fb_bw);
+	if(n<0)
+		return;
+	if(scr_mode&EPD_BWR){
+		m = rle_pack(layer_buf+n, LAYER_BUF_SIZE-n, fb_rr);
+		if(m<0)
+			return;
+	}
+
+	layer_len = n+m;
+	layer_key = key;
+	layer_valid = 1;
+}
+
+
+void layer_invalidate(void)
+{
+	layer_valid = 0;
+}
+
+
+int layer_size(void)
+{
+	return layer_valid? layer_len : -1;
+}
+
+
+/******************************************************************************/
+
@@ -0,0 +1,204 @@
+
+
+#include "epd.h"
+
+
+/******************************************************************************/
+
+// 刷新过程各阶段的耗时统计
+//
+// 时间单位是BLE时钟的一个slot(625us)，由epd_ticks()提供，睡眠期间也在走。
+// 一次刷新的阶段顺序:
+//   draw   开始画fb到提交刷新(主机传输时包含BLE传输时间)
+//   init   上电复位和寄存器初始化(保持上电时只设置窗口)
+//   upload 写RAM
+//   lut    下发LUT并启动波形
+//   busy   等待BUSY拉低，中断模式下CPU在这段时间睡眠
+//   sleep  保持上电或进入深度睡眠断电
+//
+// 记录打包格式(小端，便于主机解析)，见epd_trace_pack():
+//   头: 版本, 记录数, 每条记录字节数, 是否轮询BUSY
+//   记录: seq, mode, flags, 0, spi字节数(u16), 6个阶段(u16 ticks)
+
+
+#ifndef EPD_TRACE_NUM
+#define EPD_TRACE_NUM  8
+#endif
+
+#define TRACE_VERSION  1
+#define TRACE_HDR_SIZE 4
+#define TRACE_REC_SIZE (6+TRACE_PHASES*2)
+
+typedef struct {
+	u8  seq;
+	u8  mode;
+	u8  flags;
+	u16 bytes;
+	u16 t[TRACE_PHASES];
+}TRACE_REC;
+
+static TRACE_REC trace_ring[EPD_TRACE_NUM];
+static int trace_head;
+static int trace_count;
+static u8  trace_seq;
+
+static TRACE_REC trace_cur;
+static int trace_active;
+static u32 trace_t;
+
+static u32 trace_draw_t0;
+static int trace_draw_valid;
+
+static const char *trace_name[TRACE_PHASES] = {
+	"draw", "init", "upload", "lut", "busy", "sleep",
+};
+
+
+static u16 trace_clip(u32 ticks)
+{
+	return (ticks>0xffff)? 0xffff : ticks;
+}
+
+
+static u32 trace_elapsed(u32 start)
+{
+	return (epd_ticks()-start)&0x07ffffff;
+}
+
+
+// 开始往fb里画新的一帧
+void epd_trace_draw(void)
+{
+	trace_draw_t0 = epd_ticks();
+	trace_draw_valid = 1;
+}
+
+
+// 开始一次刷新，清零SPI字节计数
+void epd_trace_begin(int mode, int flags)
+{
+	memset(&trace_cur, 0, sizeof(trace_cur));
+	trace_cur.seq = trace_seq++;
+	trace_cur.mode = mode;
+	trace_cur.flags = flags;
+
+	trace_t = epd_ticks();
+	if(trace_draw_valid){
+		trace_cur.t[TRACE_DRAW] = trace_clip(trace_elapsed(trace_draw_t0));
+		trace_draw_valid = 0;
+	}
+
+	epd_spi_bytes = 0;
+	trace_active = 1;
+}
+
+
+// 刷新模式在发出刷新命令时被改了(例如三色屏有红色时只能全刷)，记录实际的模式
+void epd_trace_mode(int mode)
+{
+	trace_cur.mode = mode;
+}
+
+
+// 结束当前阶段，时间累加到phase上
+void epd_trace_phase(int phase)
+{
+	u32 now = epd_ticks();
+
+	if(trace_active==0)
+		return;
+	trace_cur.t[phase] = trace_clip(trace_cur.t[phase] + ((now-trace_t)&0x07ffffff));
+	trace_t = now;
+}
+
+
+// 结束这次刷新，写入环形缓冲区
+void epd_trace_end(void)
+{
+	TRACE_REC *r;
+	int i, total, wake;
+
+	if(trace_active==0)
+		return;
+	trace_active = 0;
+
+	trace_cur.bytes = trace_clip(epd_spi_bytes);
+	trace_ring[trace_head] = trace_cur;
+	trace_head = (trace_head+1)%EPD_TRACE_NUM;
+	if(trace_count<EPD_TRACE_NUM)
+		trace_count += 1;
+
+	r = &trace_cur;
+	total = 0;
+	for(i=TRACE_INIT; i<TRACE_PHASES; i++)
+		total += r->t[i];
+	wake = total;
+	if(EPD_BUSY_IRQ)
+		wake -= r->t[TRACE_BUSY];
+
+	printk("EPD refresh: mode %d  spi %d bytes  %d ms  wake %d ms%s%s\n",
+		   r->mode, r->bytes, (total*5)>>3, (wake*5)>>3,
+		   (r->flags&TRACE_F_QUEUED)? "  (queued)" : "",
+		   (r->flags&TRACE_F_FLASH)? "  (flash)" : "");
+}
+
+
+// 在调试串口上打印全部记录，每行一条，时间单位ms
+void epd_trace_dump(void)
+{
+	TRACE_REC *r;
+	int i, j;
+
+	printk("TRACE seq mode flags bytes");
+	for(j=0; j<TRACE_PHASES; j++)
+		printk(" %s", trace_name[j]);
+	printk("\n");
+
+	for(i=0; i<trace_count; i++){
+		r = &trace_ring[(trace_head-trace_count+i+EPD_TRACE_NUM)%EPD_TRACE_NUM];
+		printk("TRACE %d %d %d %d", r->seq, r->mode, r->flags, r->bytes);
+		for(j=0; j<TRACE_PHASES; j++)
+			printk(" %d", (r->t[j]*5)>>3);
+		printk("\n");
+	}
+}
+
+
+// 把记录按从旧到新打包到buf中，返回长度
+int epd_trace_pack(u8 *buf, int len)
+{
+	TRACE_REC *r;
+	int i, j, n;
+	u8 *p;
+
+	n = trace_count;
+	if(TRACE_HDR_SIZE+n*TRACE_REC_SIZE > len)
+		n = (len-TRACE_HDR_SIZE)/TRACE_REC_SIZE;
+
+	buf[0] = TRACE_VERSION;
+	buf[1] = n;
+	buf[2] = TRACE_REC_SIZE;
+	buf[3] = EPD_BUSY_IRQ? 0 : 1;
+
+	p = buf+TRACE_HDR_SIZE;
+	for(i=trace_count-n; i<trace_count; i++){
+		r = &trace_ring[(trace_head-trace_count+i+EPD_TRACE_NUM)%EPD_TRACE_NUM];
+		p[0] = r->seq;
+		p[1] = r->mode;
+		p[2] = r->flags;
+		p[3] = 0;
+		p[4] = r->bytes;
+		p[5] = r->bytes>>8;
+		for(j=0; j<TRACE_PHASES; j++){
+			p[6+j*2] = r->t[j];
+			p[7+j*2] = r->t[j]>>8;
+		}
+		p += TRACE_REC_SIZE;
+	}
+
+	return TRACE_HDR_SIZE+n*TRACE_REC_SIZE;
+}
+
+
+/******************************************************************************/
+
@@ -0,0 +1,270 @@
+
+
+#include "epd.h"
+
+
+/******************************************************************************/
+
+// flash上的键值存储
+//
+// 设置和时间检查点都很小，改一次就擦一个4K的扇区太浪费，也磨损flash。这里用两个扇区
+// 轮流记日志: 每次修改在当前扇区末尾追加一条记录，读的时候同一个key以最后一条为准。
+// 扇区写满后把每个key的最新值搬到另一个扇区(先擦除)，再写新扇区的头，旧扇区作废。
+// 每小时一个时间检查点的话，一个扇区能用十天左右，扇区的擦写次数远到不了寿命。
+//
+// 扇区头: magic seq，两个扇区都有效时seq大的是当前扇区。头最后写，搬了一半掉电时
+// 新扇区没有头，下次启动还用旧扇区。
+// 记录: key len check data，data按4字节对齐。key为0xff表示后面都是空的。
+// check是key、len和data的CRC32的低16位，掉电时写了一半的记录校验不过，跳过它。
+//
+// 读的时候遇到空记录就停，后面的记录都不要。写之前等flash空闲，写完读回记录头，
+// 没写进去的不算，所以正常情况下记录之间没有空洞。万一有(比如以前的固件写丢了一条)，
+// 空洞后面的记录不可信，也不能在空洞里接着写，下一次写之前先搬到另一个扇区。
+//
+// OTA升级时flash的page写入是异步的，不在这里等，升级期间的修改不写(返回-1)。
+// 升级成功会复位；失败时时间检查点下个小时再写，设置等下一次修改。
+
+#define KV_ADDR0      0x3e000
+#define KV_ADDR1      0x3f000
+#define KV_SECTOR     0x1000
+#define KV_MAGIC      0x3153564b  // "KVS1"
+#define KV_HDR_SIZE   8
+#define KV_DATA_MAX   128
+#define KV_GAP_CHECK  (4+KV_DATA_MAX)  // 末尾后面检查这么多字节，够一条最长的记录
+
+static int kv_base = -1;     // 当前扇区，-1表示还没有初始化
+static int kv_end;           // 第一条空记录的偏移
+static u32 kv_seq;
+
+
+/******************************************************************************/
+
+
+static int kv_align(int len)
+{
+	return (len+3)&~3;
+}
+
+
+static u16 kv_check(int key, int len, const void *data)
+{
+	u8 h[2];
+	u32 crc;
+
+	h[0] = key;
+	h[1] = len;
+	crc = crc32(0, h, 2);
+	crc = crc32(crc, data, len);
+	return crc&0xffff;
+}
+
+
+// 从off开始找下一条记录，返回它的偏移，没有了返回-1。rec里是记录头
+static int kv_next(int base, int off, u8 *rec)
+{
+	if(off+4>KV_SECTOR)
+		return -1;
+	sf_read(base+off, 4, rec);
+	if(rec[0]==0xff || off+4+kv_align(rec[1])>KV_SECTOR)
+		return -1;
+	return off;
+}
+
+
+// 在扇区里找key的最后一条有效记录，找到后把数据读进buf(KV_DATA_MAX字节)，返回数据长度。
+// 校验也用buf，读到坏记录后要把前面那条好的重新读一次
+static int kv_find(int base, int end, int key, u8 *buf)
+{
+	u8 rec[4];
+	int off, good = -1, len = -1, dirty = 0;
+
+	for(off=KV_HDR_SIZE; off<end; off+=4+kv_align(rec[1])){
+		if(kv_next(base, off, rec)<0)
+			break;
+		if(rec[0]!=key || rec[1]>KV_DATA_MAX)
+			continue;
+		sf_read(base+off+4, rec[1], buf);
+		if((rec[2]|(rec[3]<<8))!=kv_check(key, rec[1], buf)){
+			dirty = 1;
+			continue;
+		}
+		good = off;
+		len = rec[1];
+		dirty = 0;
+	}
+
+	if(good>=0 && dirty)
+		sf_read(base+good+4, len, buf);
+	return len;
+}
+
+
+// 追加一条记录。读回来还是空的说明没写进去，kv_end不动，返回-1
+static int kv_append(int base, int key, const void *buf, int len)
+{
+	u8 rec[4+KV_DATA_MAX];
+	u16 check = kv_check(key, len, buf);
+
+	rec[0] = key;
+	rec[1] = len;
+	rec[2] = check&0xff;
+	rec[3] = check>>8;
+	memcpy(rec+4, buf, len);
+	sf_write(base+kv_end, rec, 4+len);
+	sf_read(base+kv_end, 1, rec);
+	if(rec[0]==0xff)
+		return -1;
+	kv_end += 4+kv_align(len);
+	return 0;
+}
+
+
+// 把每个key的最新值搬到另一个扇区
+static void kv_compact(void)
+{
+	u8 data[KV_DATA_MAX];
+	u8 keys[32];
+	u8 rec[4];
+	u32 hdr[2];
+	int old = kv_base;
+	int old_end = kv_end;
+	int key, len, off;
+
+	// 先记下用到了哪些key，每个key再找一遍最新值。key只有几个，不用每个都找
+	memset(keys, 0, sizeof(keys));
+	for(off=KV_HDR_SIZE; off<old_end && kv_next(old, off, rec)>=0; off+=4+kv_align(rec[1]))
+		keys[rec[0]>>3] |= 1<<(rec[0]&7);
+
+	kv_base = (old==KV_ADDR0)? KV_ADDR1 : KV_ADDR0;
+	kv_end = KV_HDR_SIZE;
+	sf_erase(kv_base, KV_SECTOR, 1);
+
+	for(key=0; key<0xff; key++){
+		if((keys[key>>3]&(1<<(key&7)))==0)
+			continue;
+		len = kv_find(old, old_end, key, data);
+		if(len>=0)
+			kv_append(kv_base, key, data, len);
+	}
+
+	kv_seq += 1;
+	hdr[0] = KV_MAGIC;
+	hdr[1] = kv_seq;
+	sf_write(kv_base, (u8*)hdr, KV_HDR_SIZE);
+	printk("KV: compact to %05x, %d bytes used\n", kv_base, kv_end);
+}
+
+
+static void kv_format(void)
+{
+	u32 hdr[2];
+
+	kv_base = KV_ADDR0;
+	kv_end = KV_HDR_SIZE;
+	kv_seq = 1;
+	sf_erase(kv_base, KV_SECTOR, 1);
+	hdr[0] = KV_MAGIC;
+	hdr[1] = kv_seq;
+	sf_write(kv_base, (u8*)hdr, KV_HDR_SIZE);
+}
+
+
+/******************************************************************************/
+
+
+// 找到当前扇区和它的末尾。两个扇区都没有头时格式化
+void kv_init(void)
+{
+	u32 h0[2], h1[2];
+	u8 rec[4], gap[KV_GAP_CHECK];
+	int off, i;
+
+	fspi_init();
+	sf_wait();
+
+	sf_read(KV_ADDR0, KV_HDR_SIZE, (u8*)h0);
+	sf_read(KV_ADDR1, KV_HDR_SIZE, (u8*)h1);
+	if(h0[0]==KV_MAGIC && (h1[0]!=KV_MAGIC || (int)(h0[1]-h1[1])>0)){
+		kv_base = KV_ADDR0;
+		kv_seq = h0[1];
+	}else if(h1[0]==KV_MAGIC){
+		kv_base = KV_ADDR1;
+		kv_seq = h1[1];
+	}else{
+		kv_format();
+	}
+
+	for(off=KV_HDR_SIZE; kv_next(kv_base, off, rec)>=0; off+=4+kv_align(rec[1]))
+		;
+	kv_end = off;
+
+	// 末尾后面还有数据就是有空洞，当作扇区已满，下一次写时先搬走
+	if(off+KV_GAP_CHECK>KV_SECTOR)
+		off = KV_SECTOR-KV_GAP_CHECK;
+	sf_read(kv_base+off, KV_GAP_CHECK, gap);
+	for(i=kv_end-off; i<KV_GAP_CHECK; i++){
+		if(gap[i]!=0xff){
+			printk("KV: data after the end at %05x\n", kv_base+off+i);
+			kv_end = KV_SECTOR;
+			break;
+		}
+	}
+
+	fspi_exit();
+	printk("KV: sector %05x  seq %d  %d bytes used\n", kv_base, kv_seq, kv_end);
+}
+
+
+// 读key的最新值，返回数据长度，没有时返回-1
+int kv_get(int key, void *buf, int len)
+{
+	u8 data[KV_DATA_MAX];
+	int n;
+
+	if(kv_base<0)
+		return -1;
+
+	fspi_init();
+	sf_wait();
+	n = kv_find(kv_base, kv_end, key, data);
+	fspi_exit();
+
+	if(n<0)
+		return -1;
+	if(n>len)
+		n = len;
+	memcpy(buf, data, n);
+	return n;
+}
+
+
+// 写key。和最新值相同时不写，扇区满了先搬到另一个扇区。OTA升级中不写
+int kv_set(int key, const void *buf, int len)
+{
+	u8 data[KV_DATA_MAX];
+	int ret;
+
+	if(kv_base<0 || key<0 || key>=0xff || len>KV_DATA_MAX || ota_state)
+		return -1;
+
+	fspi_init();
+	sf_wait();
+	if(kv_find(kv_base, kv_end, key, data)==len && memcmp(data, buf, len)==0){
+		fspi_exit();
+		return 0;
+	}
+	if(kv_end+4+kv_align(len)>KV_SECTOR)
+		kv_compact();
+	if(kv_end+4+kv_align(len)>KV_SECTOR){
+		fspi_exit();
+		return -1;
+	}
+	ret = kv_append(kv_base, key, buf, len);
+	fspi_exit();
+
+	return ret;
+}
+
+
+/******************************************************************************/
+
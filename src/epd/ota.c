@@ -0,0 +1,348 @@
+
+
+#include "epd.h"
+#include "app_easy_timer.h"
+#include "user_custs1_impl.h"
+
+
+/******************************************************************************/
+
+// OTA升级
+//
+// 固件按256字节的page传输，每个page分两个包。收齐一个page就开始写flash，但不在BLE消息
+// 里等它写完: 写操作在后台进行，收到下一个包时或者定时器到时查询flash的状态。写的同时
+// 下一个page可以收到另一个缓冲里。每写完一个page更新一次状态，主机最多比它超前两个page。
+//
+// 第一个page的前64字节是image header，其中有固件长度和CRC32。每写完一个page就从flash
+// 读回来累加CRC，校验的是flash里实际的内容。全部写完后和header比较，一致才写入image
+// 的flag让bootloader选用它。flag在此之前保持0xff(-1)，传了一半或者校验失败的image
+// 不会被启动。
+//
+//   a0 xx size_lo size_hi        开始，擦除非活动的image
+//   a2 xx page_lo page_hi .. [8-135]   第page个page的前128字节
+//   a3 xx page_lo page_hi .. [8-135]   后128字节，收齐后排队写入
+//   a4                           结束，所有page写完并校验通过后复位
+//   a5                           续传，连接断开后重新连上时用。收齐的page写完后回复
+//                                已经写完的page数
+//
+// 状态(写进long value特征值，主机订阅了通知时同时通知它): a1 status pages_lo pages_hi
+//   status 0: 正常，pages是已经写完的page数
+//   status 1: 溢出，主机超前太多或者丢了包，从第pages个page开始的包都被丢掉，
+//             主机从它重发。每丢一个包都报告一次，重发的page收到以后状态回到0
+//   status 2: 续传的回复，从第pages个page接着发。不在升级中时pages为0xffff
+//   status 3: 校验失败，image没有启用，需要重新开始
+//   status 4: 没有在升级(没有a0或者已经结束)，a2/a3/a4被丢掉，pages为0xffff
+
+#define OTA_BUFS      2
+#define OTA_POLL      1   // 查询间隔，单位10ms
+
+#define OTA_OK        0
+#define OTA_OVERRUN   1
+#define OTA_RESUME    2
+#define OTA_BADCRC    3
+#define OTA_IDLE      4
+
+// 缓冲状态
+#define BUF_FREE      0
+#define BUF_READY     1   // 收齐了，等待写入
+#define BUF_PROG      2   // 正在写
+
+int ota_state = 0;
+static u8  ota_buf[OTA_BUFS][256];
+static u8  buf_state[OTA_BUFS];
+static int firm_addr;
+static int firm_size;
+static int firm_flag;
+
+static int rx_page;       // 正在接收的page
+static int rx_half;       // 这个page已经收到的半个数
+static int rx_lost;       // 丢过包，在等主机重发rx_page
+static int done_pages;    // 已经写完的page数，也是下一个要写的page
+static int ota_finish;
+static int ota_resuming;  // 收到了a5，等缓冲里的page写完再回复
+
+static u32 hdr_size;      // header里的固件长度和CRC，从flash里读回
+static u32 hdr_crc;
+static u32 rx_bytes;      // 已经累加到CRC里的固件字节数
+static u32 rx_crc;
+static timer_hnd ota_timer = EASY_TIMER_INVALID_TIMER;
+
+
+/******************************************************************************/
+
+
+static void ota_reset(void)
+{
+	arch_set_sleep_mode(ARCH_EXT_SLEEP_ON);
+	// Remap addres 0x00 to ROM and force execution
+	SetWord16(SYS_CTRL_REG, (GetWord16(SYS_CTRL_REG) & ~REMAP_ADR0) | SW_RESET );
+}
+
+
+// 所有page都写完了，校验通过就写入flag并复位
+static void ota_commit(void)
+{
+	u8 flag = firm_flag;
+
+	ota_finish = 0;
+	printk("OTA: %d bytes  crc %08x  header %d bytes  crc %08x\n", rx_bytes, rx_crc, hdr_size, hdr_crc);
+	if(rx_bytes!=hdr_size || rx_crc!=hdr_crc){
+		ota_push(OTA_BADCRC, done_pages);
+		ota_state = 0;
+		arch_set_sleep_mode(ARCH_EXT_SLEEP_ON);
+		return;
+	}
+
+	// flag原来是0xff，写flash只会把1变成0，可以单独写这一个字节
+	sf_page_write(firm_addr+3, &flag, 1);
+	sf_wait();
+	ota_push(OTA_OK, done_pages);
+	ota_reset();
+}
+
+
+// 累加一个page里的固件数据，最后一个page的填充部分不算
+static void ota_crc(u8 *buf, int len)
+{
+	if(rx_bytes+len>hdr_size)
+		len = hdr_size-rx_bytes;
+	if(len<=0)
+		return;
+	rx_crc = crc32(rx_crc, buf, len);
+	rx_bytes += len;
+}
+
+
+// 把写完的page读回缓冲，固件部分累加到CRC里。header也用读回的
+static void ota_verify(int page, u8 *buf)
+{
+	sf_read(firm_addr+page*256, 256, buf);
+	if(page==0){
+		hdr_size = *(u32*)(buf+4);
+		hdr_crc  = *(u32*)(buf+8);
+		ota_crc(buf+64, 192);
+	}else{
+		ota_crc(buf, 256);
+	}
+}
+
+
+// 下一个page收齐了而且flash空闲时开始写
+static void ota_program(void)
+{
+	u8 *buf = ota_buf[done_pages&1];
+
+	if(buf_state[done_pages&1]!=BUF_READY)
+		return;
+
+	sf_page_write(firm_addr+done_pages*256, buf, 256);
+	buf_state[done_pages&1] = BUF_PROG;
+}
+
+
+// 查询正在写的page是否完成，完成了就校验、通知主机并开始写下一个。返回1表示还有page在写
+static int ota_poll(void)
+{
+	int i = done_pages&1;
+
+	if(buf_state[i]==BUF_PROG){
+		if(sf_status(0)&1)
+			return 1;
+		ota_verify(done_pages, ota_buf[i]);
+		buf_state[i] = BUF_FREE;
+		done_pages += 1;
+		ota_push(OTA_OK, done_pages);
+		ota_program();
+	}
+
+	if(ota_resuming && done_pages==rx_page){
+		ota_resuming = 0;
+		printk("OTA resume: page %d\n", done_pages);
+		ota_push(OTA_RESUME, done_pages);
+	}
+	if(ota_finish && done_pages==rx_page)
+		ota_commit();
+
+	return buf_state[done_pages&1]==BUF_PROG;
+}
+
+
+static void ota_timer_cb(void)
+{
+	ota_timer = EASY_TIMER_INVALID_TIMER;
+	if(ota_poll())
+		ota_timer = app_easy_timer(OTA_POLL, ota_timer_cb);
+}
+
+
+static void ota_kick(void)
+{
+	if(ota_poll() && ota_timer==EASY_TIMER_INVALID_TIMER)
+		ota_timer = app_easy_timer(OTA_POLL, ota_timer_cb);
+}
+
+
+/******************************************************************************/
+
+
+static void ota_start(u8 *buf)
+{
+	u8 *pbuf = ota_buf[0];
+	u32 *p32 = (u32*)pbuf;
+	int image_addr[2];
+	int image_flag[2];
+
+	// 先擦除非活动固件
+	ota_state = 1;
+
+	firm_size = *(u16*)(buf+2);
+	printk("firm_size: %04x (%d)\n", firm_size, firm_size);
+
+	fspi_init();
+	int id = sf_readid();
+	printk("flash id: %04x\n", id);
+
+	sf_read(0x38000, 16, pbuf);
+	image_addr[0] = p32[1];
+	image_addr[1] = p32[2];
+	printk("image0: %08x   image1: %08x\n", image_addr[0], image_addr[1]);
+
+	// 读image header
+	sf_read(image_addr[0], 32, pbuf+0 );
+	sf_read(image_addr[1], 32, pbuf+32);
+
+	// 获取当前使用的image的id
+	image_flag[0] = -1;
+	image_flag[1] = -1;
+	if(pbuf[ 0]==0x70 && pbuf[ 1]==0x51 && pbuf[ 2]==0xaa){
+		image_flag[0] = (signed char)pbuf[ 3];
+	}
+	if(pbuf[32]==0x70 && pbuf[33]==0x51 && pbuf[34]==0xaa){
+		image_flag[1] = (signed char)pbuf[35];
+	}
+	int active = (image_flag[0]>=image_flag[1]) ? 0 : 1;
+	firm_flag = image_flag[active]+1;
+	int new_id = active^1;
+
+	firm_addr = image_addr[new_id];
+	// 擦除flash
+	printk("Erase %08x - %08x ...\n", firm_addr, firm_addr+firm_size+64);
+	sf_erase(firm_addr, firm_size+64, 1);
+
+	memset(buf_state, BUF_FREE, sizeof(buf_state));
+	rx_page = 0;
+	rx_half = 0;
+	rx_lost = 0;
+	done_pages = 0;
+	ota_finish = 0;
+	ota_resuming = 0;
+	hdr_size = 0;
+	rx_bytes = 0;
+	rx_crc = 0;
+
+	// 清掉上一次升级留下的状态
+	ota_push(OTA_OK, 0);
+	arch_set_sleep_mode(ARCH_SLEEP_OFF);
+}
+
+
+// 收到page的一半。前后两半都放进同一个缓冲，缓冲还没写完就是主机超前太多。
+// 丢掉一个包以后，直到主机从rx_page重发之前的包都不要，否则会把后面page的一半
+// 拼进这个page。序号小于rx_page的是主机在溢出后多发的，已经有了
+static void ota_rx(u8 *buf, int half)
+{
+	int page = buf[2] | (buf[3]<<8);
+	int i = rx_page&1;
+	u8 *dst = ota_buf[i];
+
+	if(ota_state==0){
+		ota_push(OTA_IDLE, 0xffff);
+		return;
+	}
+
+	ota_kick();
+
+	if(page<rx_page)
+		return;
+	if(page>rx_page || buf_state[i]!=BUF_FREE || rx_half!=half){
+		rx_half = 0;
+		rx_lost = 1;
+		ota_push(OTA_OVERRUN, rx_page);
+		return;
+	}
+	if(rx_lost){
+		rx_lost = 0;
+		ota_push(OTA_OK, done_pages);
+	}
+
+	memcpy(dst+half*128, buf+8, 128);
+	if(half==0){
+		rx_half = 1;
+		return;
+	}
+	rx_half = 0;
+
+	if(rx_page==0){
+		printk("Firm Header: %08x %08x %08x %08x\n",
+			*(u32*)(dst+0),
+			*(u32*)(dst+4),
+			*(u32*)(dst+8),
+			*(u32*)(dst+28)
+		);
+		dst[3] = 0xff;
+	}
+
+	buf_state[i] = BUF_READY;
+	rx_page += 1;
+	ota_state = rx_page+1;
+	ota_program();
+	ota_kick();
+}
+
+
+// 续传: 丢掉收了一半的page，已经收齐的page由定时器接着写完，之后在ota_poll里告诉
+// 主机从哪里接着发。会话状态在RAM里，只要没有复位，断开重连后都可以续传
+static void ota_resume(void)
+{
+	if(ota_state==0){
+		ota_push(OTA_RESUME, 0xffff);
+		return;
+	}
+
+	ota_finish = 0;
+	rx_lost = 0;
+	rx_half = 0;
+	ota_resuming = 1;
+	ota_kick();
+}
+
+
+int ota_handle(u8 *buf)
+{
+	if(buf[0]==0xa0){
+		// 升级开始
+		ota_start(buf);
+	}else if(buf[0]==0xa2){
+		// 传输page的前128字节
+		ota_rx(buf, 0);
+	}else if(buf[0]==0xa3){
+		// 传输page的后128字节
+		ota_rx(buf, 1);
+	}else if(buf[0]==0xa4){
+		// 等最后的page写完，校验后复位
+		if(ota_state==0){
+			ota_push(OTA_IDLE, 0xffff);
+			return 0;
+		}
+		ota_finish = 1;
+		ota_kick();
+	}else if(buf[0]==0xa5){
+		ota_resume();
+	}
+
+	return 0;
+}
+
+
+/******************************************************************************/
+
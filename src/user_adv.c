@@ -0,0 +1,159 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_adv.c
+ *
+ * @brief 广播策略：什么时候广播、用多大的间隔、每次广播多久
+ *
+ * 广播是平均电流里最大的一项。开机和连接异常断开后快速广播一段时间(burst)，手机
+ * 马上能搜到；之后改成稀疏广播(beacon)：隔一段时间广播一个短窗口，间隔也长一些。
+ * 窗口结束还没有人连接，下一个窗口前等待的时间加倍，最长ADV_GAP_MAX；连上以后或者
+ * 有新的用户事件时回到最短的等待时间。
+ *
+ * 这里只做决定，不调用协议栈，广播由user_peripheral.c启动。主机上的模拟器用同一份
+ * 代码估算广播的平均电流(epd_sim -a)。
+ *
+ ****************************************************************************************
+ */
+
+/*
+ * 包含头文件
+ ****************************************************************************************
+ */
+
+#include "user_adv.h"
+
+/*
+ * 常量定义
+ ****************************************************************************************
+ */
+
+// 广播间隔单位0.625ms，窗口长度单位10ms(app_easy_timer的单位)
+#define ADV_BURST_INTV  244    // 152.5ms
+#define ADV_BURST_LEN   3000   // 30s
+#define ADV_BEACON_INTV 1636   // 1022.5ms
+#define ADV_BEACON_LEN  1000   // 10s
+#define ADV_GAP_MIN     6000   // 1分钟
+#define ADV_GAP_MAX     96000  // 16分钟
+
+/*
+ * 全局变量定义
+ ****************************************************************************************
+ */
+
+static int adv_mode;   // ADV_IDLE/ADV_BURST/ADV_BEACON/ADV_CONNECTED
+static int adv_misses; // 连续多少个稀疏窗口没有等到连接
+
+/*
+ * 函数定义
+ ****************************************************************************************
+ */
+
+/**
+ ****************************************************************************************
+ * @brief 开机时初始化
+ ****************************************************************************************
+ */
+void adv_policy_init(void)
+{
+	adv_mode = ADV_IDLE;
+	adv_misses = 0;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 根据事件切换广播状态
+ * @param[in] ev  ADV_EV_xxx
+ ****************************************************************************************
+ */
+void adv_policy_event(int ev)
+{
+	switch (ev)
+	{
+	case ADV_EV_BOOT:
+	case ADV_EV_USER:
+	case ADV_EV_DISCONNECT:
+		adv_mode = ADV_BURST;
+		adv_misses = 0;
+		break;
+	case ADV_EV_CONNECT:
+		adv_mode = ADV_CONNECTED;
+		adv_misses = 0;
+		break;
+	case ADV_EV_CLOSE:
+		// 主机用完了，不用急着再让它搜到
+		adv_mode = ADV_BEACON;
+		adv_misses = 0;
+		break;
+	case ADV_EV_TIMEOUT:
+		if (adv_mode == ADV_BURST)
+			adv_mode = ADV_BEACON;
+		else if (adv_mode == ADV_BEACON && (ADV_GAP_MIN << adv_misses) < ADV_GAP_MAX)
+			adv_misses += 1;
+		break;
+	}
+}
+
+/**
+ ****************************************************************************************
+ * @brief 现在开始的广播窗口的参数
+ * @param[out] intv  广播间隔，单位0.625ms
+ * @param[out] len   窗口长度，单位10ms
+ * @return 0表示现在不该广播(已连接)
+ ****************************************************************************************
+ */
+int adv_policy_window(int *intv, int *len)
+{
+	if (adv_mode == ADV_CONNECTED)
+		return 0;
+	if (adv_mode == ADV_IDLE)
+		adv_mode = ADV_BURST;
+
+	if (adv_mode == ADV_BURST)
+	{
+		*intv = ADV_BURST_INTV;
+		*len = ADV_BURST_LEN;
+	}
+	else
+	{
+		*intv = ADV_BEACON_INTV;
+		*len = ADV_BEACON_LEN;
+	}
+	return 1;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 一个窗口结束后，等多久开始下一个窗口
+ * @return 单位10ms，0表示马上开始，-1表示不用广播
+ ****************************************************************************************
+ */
+int adv_policy_gap(void)
+{
+	int gap;
+
+	if (adv_mode == ADV_CONNECTED || adv_mode == ADV_IDLE)
+		return -1;
+	if (adv_mode == ADV_BURST)
+		return 0;
+
+	gap = ADV_GAP_MIN << adv_misses;
+	return gap < ADV_GAP_MAX ? gap : ADV_GAP_MAX;
+}
+
+int adv_policy_state(void)
+{
+	return adv_mode;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 屏幕上是否显示蓝牙图标
+ *        已连接或者正在快速广播时显示。图标只在画面本来就要刷新时跟着更新，
+ *        不为了它单独刷新
+ ****************************************************************************************
+ */
+int adv_policy_icon(void)
+{
+	return adv_mode == ADV_BURST || adv_mode == ADV_CONNECTED;
+}
@@ -0,0 +1,56 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_adv.h
+ *
+ * @brief 广播策略：快速广播、稀疏广播和超时退避
+ *
+ ****************************************************************************************
+ */
+
+#ifndef _USER_ADV_H_
+#define _USER_ADV_H_
+
+/*
+ * DEFINES
+ ****************************************************************************************
+ */
+
+// 广播状态
+enum
+{
+	ADV_IDLE = 0,  // 还没有开始
+	ADV_BURST,     // 快速广播，开机或断开后让手机马上能搜到
+	ADV_BEACON,    // 稀疏广播，隔一段时间广播一个短窗口
+	ADV_CONNECTED, // 已连接，不广播
+};
+
+// 影响广播的事件
+enum
+{
+	ADV_EV_BOOT = 0,   // 开机
+	ADV_EV_USER,       // 需要马上能连上，比如正在显示配对二维码
+	ADV_EV_CONNECT,    // 连上了
+	ADV_EV_DISCONNECT, // 连接异常断开(超时等)，主机可能还要重连
+	ADV_EV_CLOSE,      // 主机主动断开
+	ADV_EV_TIMEOUT,    // 一个窗口结束了，没有等到连接
+};
+
+/*
+ * FUNCTION DECLARATIONS
+ ****************************************************************************************
+ */
+
+void adv_policy_init(void);
+
+void adv_policy_event(int ev);
+
+int adv_policy_window(int *intv, int *len);
+
+int adv_policy_gap(void);
+
+int adv_policy_state(void);
+
+int adv_policy_icon(void);
+
+#endif // _USER_ADV_H_
@@ -0,0 +1,238 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_batt.c
+ *
+ * @brief 电池电压的采样、滤波和低电量判断
+ *
+ * 电池(特别是纽扣电池)快没电时内阻变大，空载电压看起来还很高，只有屏幕刷新、
+ * 升压电路工作的时候才会明显下降，电压跌得太低时芯片会在刷新中途复位。所以每半小时
+ * 在一次刷新的波形期间(BUSY还是高的)采样，测的是带负载的电压；长时间没有刷新
+ * (静态画面)时在时钟定时器里空载采样。
+ *
+ * 带负载的电压比空载低100mV以上，两种采样各用一个指数移动平均滤波，不混在一起。
+ * 电量百分比、电压和低电量(减少刷新)按最近2小时内有采样的那个判断，一般是带负载的；
+ * 开机后还没有刷新过或者静态画面时是空载的。耗尽(低电量画面后停止走时)只按带负载
+ * 的滤波值判断，而且要连续两次带负载的采样都低于阈值，一次刷新的电压偶然偏低不算。
+ * 电压的字符串只在采样时格式化一次，画面里直接使用。
+ *
+ ****************************************************************************************
+ */
+
+/*
+ * 包含头文件
+ ****************************************************************************************
+ */
+
+#include "user_custs1_impl.h" // batt_push
+#include "user_batt.h"
+
+#include "adc.h"
+#include "app_easy_timer.h"
+#include <stdio.h> // sprintf
+#include "epd.h"
+
+/*
+ * 常量定义
+ ****************************************************************************************
+ */
+
+#define BATT_PERIOD     (30 * 60)     // 刷新后采样的最短间隔，秒
+#define BATT_STALE      (2 * 3600)    // 这么久没有刷新，空载采样一次
+#define BATT_LOAD_DELAY 5             // 刷新开始后多久采样，单位10ms，升压已经稳定
+#define BATT_CAL_EVERY  48            // 每采样这么多次重新校准一次ADC偏移
+#define BATT_EMA_SHIFT  2             // 新的采样占1/4
+#define BATT_FRAC       4             // 滤波值多保留4位小数
+
+#define BATT_LOW_PCT    15            // 低于它进入BATT_LOW
+#define BATT_OK_PCT     20            // 回到它以上才退出BATT_LOW
+#define BATT_EMPTY_PCT  4             // 约2.39V，带负载的电压低于它进入BATT_EMPTY
+#define BATT_EMPTY_CNT  2             // 连续这么多次带负载的采样低于BATT_EMPTY_PCT
+
+/*
+ * 全局变量定义
+ ****************************************************************************************
+ */
+
+static int batt_rest;      // 空载采样ADC值的移动平均，左移了BATT_FRAC位
+static int batt_load;      // 带负载采样的移动平均
+static int batt_rest_n;    // 空载采样次数
+static int batt_load_n;    // 带负载采样次数
+static int batt_age;       // 距离上次采样的秒数
+static int batt_load_age;  // 距离上次带负载采样的秒数
+static int batt_count;     // 采样次数
+static int batt_empty_n;   // 连续几次带负载的采样低于BATT_EMPTY_PCT
+static int batt_st;
+static char batt_str[12];
+static timer_hnd batt_load_hnd = EASY_TIMER_INVALID_TIMER;
+
+/*
+ * 函数定义
+ ****************************************************************************************
+ */
+
+// ADC值换算成电量百分比
+static int batt_cal(int adc_sample)
+{
+	if (adc_sample > 1705)
+		return 100;
+	if (adc_sample > 1584)
+		return 28 + (((((adc_sample - 1584) << 16) / (1705 - 1584)) * 72) >> 16);
+	if (adc_sample > 1360)
+		return 4 + (((((adc_sample - 1360) << 16) / (1584 - 1360)) * 24) >> 16);
+	if (adc_sample > 1136)
+		return ((((adc_sample - 1136) << 16) / (1360 - 1136)) * 4) >> 16;
+	return 0;
+}
+
+// 加入一次采样。第一次采样作为滤波的初值
+static void batt_filter(int *ema, int *n, int adc)
+{
+	if (*n == 0)
+		*ema = adc;
+	else
+		*ema += (adc - *ema) >> BATT_EMA_SHIFT;
+	*n += 1;
+}
+
+// 报告的滤波值: 最近有带负载的采样时用它，否则用空载的
+static int batt_ema(void)
+{
+	if (batt_load_n && batt_load_age < BATT_STALE)
+		return batt_load;
+	return batt_rest;
+}
+
+static void batt_sample(int loaded)
+{
+	int adc;
+
+	if (batt_count % BATT_CAL_EVERY == 0)
+		adc_offset_calibrate(ADC_INPUT_MODE_SINGLE_ENDED);
+	adc = adc_get_vbat_sample(false) << BATT_FRAC;
+
+	if (loaded)
+	{
+		batt_filter(&batt_load, &batt_load_n, adc);
+		batt_load_age = 0;
+		if (batt_cal(batt_load >> BATT_FRAC) < BATT_EMPTY_PCT)
+			batt_empty_n += 1;
+		else
+			batt_empty_n = 0;
+	}
+	else
+	{
+		batt_filter(&batt_rest, &batt_rest_n, adc);
+	}
+	batt_count += 1;
+	batt_age = 0;
+
+	sprintf(batt_str, "%d.%03dV", batt_volt() / 1000, batt_volt() % 1000);
+
+	// 耗尽以后不再恢复，换了电池会复位
+	if (batt_st != BATT_EMPTY)
+	{
+		int pct = batt_percent();
+		if (batt_empty_n >= BATT_EMPTY_CNT)
+			batt_st = BATT_EMPTY;
+		else if (pct < BATT_LOW_PCT)
+			batt_st = BATT_LOW;
+		else if (pct >= BATT_OK_PCT)
+			batt_st = BATT_OK;
+	}
+
+	printk("Battery: %d mV %s  %d%%  state %d\n", batt_volt(), loaded ? "load" : "rest", batt_percent(), batt_st);
+	batt_push();
+}
+
+/**
+ ****************************************************************************************
+ * @brief 开机时空载采样一次，作为滤波的初值
+ ****************************************************************************************
+ */
+void batt_init(void)
+{
+	batt_count = 0;
+	batt_rest_n = 0;
+	batt_load_n = 0;
+	batt_empty_n = 0;
+	batt_st = BATT_OK;
+	batt_sample(0);
+}
+
+// 刷新开始后不久，波形还在进行时采样
+static void batt_load_timer(void)
+{
+	batt_load_hnd = EASY_TIMER_INVALID_TIMER;
+	if (epd_busy())
+		batt_sample(1);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 屏幕刷新已经启动(BUSY拉高)时调用。到了采样间隔就在波形期间采一次
+ ****************************************************************************************
+ */
+void batt_refresh_start(void)
+{
+	if (batt_age >= BATT_PERIOD && batt_load_hnd == EASY_TIMER_INVALID_TIMER)
+		batt_load_hnd = app_easy_timer(BATT_LOAD_DELAY, batt_load_timer);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 屏幕刷新结束时调用。刷新比采样的延时还短时不采样，下一次刷新再试
+ ****************************************************************************************
+ */
+void batt_refresh_done(void)
+{
+	if (batt_load_hnd != EASY_TIMER_INVALID_TIMER)
+	{
+		app_easy_timer_cancel(batt_load_hnd);
+		batt_load_hnd = EASY_TIMER_INVALID_TIMER;
+	}
+}
+
+/**
+ ****************************************************************************************
+ * @brief 时钟定时器每个周期调用
+ * @param[in] sec  这个周期的秒数
+ ****************************************************************************************
+ */
+void batt_tick(int sec)
+{
+	batt_age += sec;
+	batt_load_age += sec;
+	if (batt_age >= BATT_STALE)
+		batt_sample(0);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 滤波后的电池电压，单位mV
+ ****************************************************************************************
+ */
+int batt_volt(void)
+{
+	return (batt_ema() * 225) >> (7 + BATT_FRAC);
+}
+
+int batt_percent(void)
+{
+	return batt_cal(batt_ema() >> BATT_FRAC);
+}
+
+int batt_state(void)
+{
+	return batt_st;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 电压的字符串，格式"3.012V"
+ ****************************************************************************************
+ */
+const char *batt_volt_str(void)
+{
+	return batt_str;
+}
@@ -0,0 +1,48 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_batt.h
+ *
+ * @brief 电池电压的采样、滤波和低电量判断
+ *
+ ****************************************************************************************
+ */
+
+#ifndef _USER_BATT_H_
+#define _USER_BATT_H_
+
+/*
+ * DEFINES
+ ****************************************************************************************
+ */
+
+// 电量状态
+enum
+{
+	BATT_OK = 0,
+	BATT_LOW,   // 电量低，减少刷新次数
+	BATT_EMPTY, // 电量耗尽，显示低电量画面后停止走时
+};
+
+/*
+ * FUNCTION DECLARATIONS
+ ****************************************************************************************
+ */
+
+void batt_init(void);
+
+void batt_refresh_start(void);
+
+void batt_refresh_done(void);
+
+void batt_tick(int sec);
+
+int batt_volt(void);
+
+int batt_percent(void);
+
+int batt_state(void);
+
+const char *batt_volt_str(void);
+
+#endif // _USER_BATT_H_
@@ -45,8 +45,13 @@
 #include "user_custs1_def.h"   // 自定义服务1定义
 #include "user_custs1_impl.h"  // 自定义服务1实现
 #include "user_peripheral.h"   // 用户外设相关
+#include "user_timekeep.h"	   // 走时修正
+#include "user_adv.h"		   // 广播策略，蓝牙图标
+#include "user_batt.h"		   // 电池电压
 #include "user_periph_setup.h" // 用户外设设置
 #include "adc.h"			   // ADC(模数转换)相关
+#include "wkupct_quadec.h"	   // 唤醒控制器，用于BUSY中断
+#include "app_easy_msg_utils.h" // app_easy_wakeup
 
 #include "epd.h" // 电子墨水屏驱动
 
@@ -62,11 +67,11 @@ ke_msg_id_t timer_used __SECTION_ZERO("retention_mem_area0"); //@RETENTION MEMOR
 uint16_t indication_counter __SECTION_ZERO("retention_mem_area0"); //@RETENTION MEMORY
 // 非数据库值计数器
 uint16_t non_db_val_counter __SECTION_ZERO("retention_mem_area0"); //@RETENTION MEMORY
-// ADC采样值，用于电池电量检测
-int adcval;
 
 int Update_Mode=QR_MODE;
 int Default_Update_Mode=CLOCK_MODE;
+static int static_shown; // STATIC_MODE的画面已经在屏幕上了
+static u32 drawn_key;	 // 屏幕上per_min_draw()画的画面的静态层key，别的刷新清零
 
 static uint8_t h24_format = 1; // 24小时制标志
 
@@ -84,24 +89,13 @@ uint8_t redraw_dirty_mark=0;
  */
 
 /**
- * @brief 更新ADC采样值并通过BLE发送电池电压数据
+ * @brief 通过BLE发送电池电压(滤波后的值，单位mV，低字节在前)
  *
- * 该函数执行以下操作：
- * 1. 校准ADC偏移量
- * 2. 获取电池电压采样值
- * 3. 将采样值转换为实际电压值
- * 4. 通过BLE发送电压值给连接的设备
- *
- * @return 返回计算后的电压值
+ * user_batt.c每次采样后调用
  */
-int adc1_update(void)
+void batt_push(void)
 {
-	// 校准ADC偏移，使用单端输入模式
-	adc_offset_calibrate(ADC_INPUT_MODE_SINGLE_ENDED);
-	// 获取电池电压采样值
-	adcval = adc_get_vbat_sample(false);
-	// 将ADC值转换为实际电压值 (单位: mV)
-	int volt = (adcval * 225) >> 7;
+	int volt = batt_volt();
 
 	// 分配内存并构造BLE消息
 	struct custs1_val_set_req *req = KE_MSG_ALLOC_DYN(CUSTS1_VAL_SET_REQ,
@@ -120,8 +114,6 @@ int adc1_update(void)
 	req->value[1] = volt >> 8;
 	// 发送BLE消息
 	KE_MSG_SEND(req);
-
-	return volt;
 }
 
 /****************************************************************************************/
@@ -174,6 +166,20 @@ static const uint16_t lunar_year_info[32] =
 // 额外的农历年份信息，用于标记特殊年份的闰月情况
 static const uint32_t lunar_year_info2 = 0x48010000;
 
+/**
+ * 每个农历年正月初一距2020年1月1日的天数（2020-2052年）
+ * 由lunar_year_info逐年累加得到，最后一项是2052年的春节，作为表的结束。
+ * 公历转农历时先用它定位农历年，不需要逐日推算。
+ */
+#define DAYS_2020  18262 // 2020-01-01距1970-01-01的天数
+static const uint16_t lunar_newyear_days[33] =
+	{
+		24, 408, 762, 1117, 1501, 1855, 2239, 2593, 2947, 3331, // 2020-2029
+		3686, 4040, 4424, 4779, 5163, 5517, 5871, 6255, 6609, 6963, // 2030-2039
+		7347, 7702, 8057, 8441, 8795, 9179, 9533, 9887, 10271, 10625, // 2040-2049
+		10980, 11364, 11719, // 2050-2052
+};
+
 /**
  * 24节气时间数据表
  * 存储了一年中24个节气相对于"小寒"的时间间隔（以秒为单位）
@@ -317,11 +323,12 @@ const unsigned char LB_31x31[31][4] = {
 /**
  * 获取农历月份的天数
  *
+ * @param ly 农历年在lunar_year_info数组中的索引
  * @param mon 月份编号，最高位为1表示闰月
  * @param yinfo_out 输出参数，用于返回年份信息
  * @return 返回该月的天数（29或30）
  */
-static int get_lunar_mdays(int mon, int *yinfo_out)
+static int lunar_mdays(int ly, int mon, int *yinfo_out)
 {
 	// 获取闰月标志（最高位）
 	int lflag = mon & 0x80;
@@ -329,8 +336,8 @@ static int get_lunar_mdays(int mon, int *yinfo_out)
 	mon &= 0x7f;
 
 	// 取得当年的信息
-	int yinfo = lunar_year_info[l_year];
-	if (lunar_year_info2 & (1 << l_year))
+	int yinfo = lunar_year_info[ly];
+	if (lunar_year_info2 & (1 << ly))
 		yinfo |= 0x10000;
 
 	// 取得当月的天数
@@ -351,55 +358,79 @@ static int get_lunar_mdays(int mon, int *yinfo_out)
 	return mdays;
 }
 
-// 农历增加一天
-void ldate_inc(void)
+
+/**
+ * @brief 公历转农历
+ * @param year/month/day 公历日期，格式同days_from_civil(月份0-11，日期从0开始)
+ * @param ly_out/lm_out/ld_out 农历年索引、月份(最高位为闰月标志)、日期，格式同l_year/l_month/l_date
+ * @return 0 成功，-1 超出农历表的范围(2020-01-25 到 2052-01-31)
+ * @note 先用lunar_newyear_days定位农历年，再按月减去天数，最多循环13次。
+ *       超出范围时按表的第一天(2020年正月初一)或最后一天(2051年腊月三十)给出结果，
+ *       保证输出总能用来查表，但不再随日期变化。需要区分的调用者检查返回值
+ */
+int lunar_from_date(int year, int month, int day, int *ly_out, int *lm_out, int *ld_out)
 {
-	int lflag = l_month & 0x80;
-	int mon = l_month & 0x7f;
-	int yinfo;
+	int days = days_from_civil(year, month, day) - DAYS_2020;
+	int ly, mon, mdays, yinfo;
+	int ret = 0;
 
-	int mdays = get_lunar_mdays(l_month, &yinfo);
+	if (days < lunar_newyear_days[0])
+	{
+		days = lunar_newyear_days[0];
+		ret = -1;
+	}
+	else if (days >= lunar_newyear_days[32])
+	{
+		days = lunar_newyear_days[32] - 1;
+		ret = -1;
+	}
 
-	l_date += 1;
-	if (l_date == mdays)
+	// 农历年的长度在354到384天之间，按365天估计最多差一年
+	ly = (days - lunar_newyear_days[0]) / 365;
+	if (ly > 31)
+		ly = 31;
+	if (days < lunar_newyear_days[ly])
+		ly -= 1;
+	else if (days >= lunar_newyear_days[ly + 1])
+		ly += 1;
+
+	days -= lunar_newyear_days[ly];
+	for (mon = 0; mon < 12; mon++)
 	{
-		l_date = 0;
-		mon += 1;
-		if (lflag == 0 && mon == (yinfo & 0x0f))
-		{
-			lflag = 0x80;
-			mon -= 1;
-		}
-		else
-		{
-			lflag = 0;
-		}
-		if (mon == 12)
+		mdays = lunar_mdays(ly, mon, &yinfo);
+		if (days < mdays)
+			break;
+		days -= mdays;
+
+		// 闰月紧跟在同名的月份后面
+		if (mon + 1 == (yinfo & 0x0f))
 		{
-			mon = 0;
-			l_year += 1;
+			mdays = lunar_mdays(ly, mon | 0x80, NULL);
+			if (days < mdays)
+			{
+				mon |= 0x80;
+				break;
+			}
+			days -= mdays;
 		}
-		l_month = lflag | mon;
 	}
+
+	*ly_out = ly;
+	*lm_out = mon;
+	*ld_out = days;
+	return ret;
 }
 
-// 给出年月日，返回是否是节气日
-int jieqi(int year, int month, int date)
-{
-	uint8_t d2m[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-	int is_leap = (year % 4) ? 0 : (year % 100) ? 1
-							   : (year % 400)	? 0
-												: 1;
-	d2m[1] += is_leap;
-
-	// 计算当前日期是本年第几天
-	int i, d = 0;
-	for (i = 0; i < month; i++)
-	{
-		d += d2m[i];
-	}
-	d += date;
+/**
+ * 节气表缓存：当年每个节气落在当月的第几天(0-based)
+ * 每个公历月恰好有两个节气，第i个节气在i/2月，查找时只需比较两项。
+ * 年份变化时重新计算一次。
+ */
+static int jieqi_year = -1;
+static uint8_t jieqi_mday[24];
 
+static void jieqi_build(int year)
+{
 	// 计算闰年的天数。因为只考虑2020-2052年，这里做了简化。
 	int Y = year - 2020;
 	int L = (Y) ? (Y - 1) / 4 + 1 : 0;
@@ -407,132 +438,221 @@ int jieqi(int year, int month, int date)
 	int xiaohan_sec = xiaohan_2020 + 20950 * Y - L * 86400;
 	//    20926是一个回归年(365.2422)不足一天的秒数(.2422*86400).
 	//    直接用有明显的误差。这里稍微增大了一点(20926+24)。
+	int year_start = days_from_civil(year, 0, 0);
+	int i;
 
 	for (i = 0; i < 24; i++)
 	{
-		int sec = xiaohan_sec + jieqi_info[i];
-		int day = sec / 86400;
-		if (day == d)
-			return i;
+		int day = (xiaohan_sec + jieqi_info[i]) / 86400;
+		jieqi_mday[i] = day - (days_from_civil(year, i / 2, 0) - year_start);
 	}
+	jieqi_year = year;
+}
+
+// 给出年月日，返回节气的序号，不是节气日返回-1
+int jieqi(int year, int month, int date)
+{
+	if (year != jieqi_year)
+		jieqi_build(year);
 
+	if (jieqi_mday[month * 2] == date)
+		return month * 2;
+	if (jieqi_mday[month * 2 + 1] == date)
+		return month * 2 + 1;
 	return -1;
 }
 
-/****************************************************************************************/
-
-static int get_month_day(int mon)
+// 按当前公历日期重新计算星期、农历日期和节日。超出农历表范围时农历停在表的边界
+void date_sync(void)
 {
-	uint8_t d2m[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-	int is_leap = (year % 4) ? 0 : (year % 100) ? 1
-							   : (year % 400)	? 0
-												: 1;
-	d2m[1] += is_leap;
-
-	return d2m[month];
+	wday = weekday_from_days(days_from_civil(year, month, date));
+	lunar_from_date(year, month, date, &l_year, &l_month, &l_date);
+	get_holiday();
 }
+
 /**
- * @brief 判断是否为闰年
- * @param year 年份
- * @return 1 表示闰年，0 表示平年
+ * @brief 计算天数差
  */
-static int is_leap_year(int year)
+int days_until(int target_year, int target_month, int target_day)
 {
-    return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+    // 使用全局变量 year, month, date 作为起点
+    int current_days = days_from_civil(year, month, date);
+    int target_days  = days_from_civil(target_year, target_month, target_day);
+    
+    return target_days - current_days;
 }
 
 /**
- * @brief 获取某个月的天数
+ * 倒计时目标，由0x9d命令设置，year为0表示未使用
+ * 日历界面显示最近的一个还没到的目标
  */
-static int days_in_month(int year, int month)
+#define COUNTDOWN_NUM 4
+#define COUNTDOWN_NAME_LEN 13
+
+typedef struct
 {
-    const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    int d = days[month];
-    if (month == 1 && is_leap_year(year))
-        d = 29;
-    return d;
+	uint16_t year;
+	uint8_t month; // 0-11
+	uint8_t date;  // 0-based
+	char name[COUNTDOWN_NAME_LEN];
+} COUNTDOWN_INFO;
+
+static COUNTDOWN_INFO countdown[COUNTDOWN_NUM] = {
+	{2026, 5, 6, "end"},
+};
+
+// 0x9d idx yl yh month date(1-31) name...，年份为0时删除这个目标
+static void countdown_set(uint8_t *buf, int len)
+{
+	int idx, year;
+	COUNTDOWN_INFO *cd;
+
+	if (len < 4)
+		return;
+	idx = buf[1];
+	year = buf[2] | (buf[3] << 8);
+	if (idx >= COUNTDOWN_NUM)
+		return;
+	cd = &countdown[idx];
+	if (year == 0 || len < 6 || buf[4] > 11 || buf[5] < 1 || buf[5] > days_in_month(year, buf[4]))
+	{
+		cd->year = 0;
+		return;
+	}
+
+	cd->year = year;
+	cd->month = buf[4];
+	cd->date = buf[5] - 1;
+	len -= 6;
+	if (len > COUNTDOWN_NAME_LEN - 1)
+		len = COUNTDOWN_NAME_LEN - 1;
+	memcpy(cd->name, buf + 6, len);
+	cd->name[len] = 0;
 }
 
-/**
- * @brief 将公历日期转换为从 2020-01-01 起的绝对天数
- * @note 基准日 2020-01-01 为第 0 天
- */
-static int date_to_abs_days(int year, int month, int day)
+// 返回最近的目标和剩余天数，没有时返回NULL
+static COUNTDOWN_INFO *countdown_next(int *days_out)
 {
-    int days = 0;
-    int y;
-
-    // 累加自 2020 年起的完整年份天数
-    // 如果输入年份小于 2020，结果会是负数
-    if (year >= 2020) {
-        for (y = 2020; y < year; y++) {
-            days += is_leap_year(y) ? 366 : 365;
-        }
-    } else {
-        for (y = year; y < 2020; y++) {
-            days -= is_leap_year(y) ? 366 : 365;
-        }
-    }
+	COUNTDOWN_INFO *next = NULL;
+	int i, days, min = 0x7fffffff;
 
-    // 累加当年已过月份的天数
-    for (int m = 0; m < month; m++) {
-        days += days_in_month(year, m);
-    }
+	for (i = 0; i < COUNTDOWN_NUM; i++)
+	{
+		if (countdown[i].year == 0)
+			continue;
+		days = days_until(countdown[i].year, countdown[i].month, countdown[i].date);
+		if (days >= 0 && days < min)
+		{
+			min = days;
+			next = &countdown[i];
+		}
+	}
 
-    // 加上当月日期 (day 是 0-based)
-    days += day;
+	*days_out = min;
+	return next;
+}
 
-    return days;
+static void countdown_save(void)
+{
+	kv_set(KV_COUNTDOWN, countdown, sizeof(countdown));
 }
 
 /**
- * @brief 计算天数差
+ * 掉电保存的设置和时间检查点，存在flash的键值存储里(kvs.c)
+ * 复位或换电池后从这里恢复，不用重新配对
  */
-int days_until(int target_year, int target_month, int target_day)
+typedef struct
 {
-    // 使用全局变量 year, month, date 作为起点
-    int current_days = date_to_abs_days(year, month, date);
-    int target_days  = date_to_abs_days(target_year, target_month, target_day);
-    
-    return target_days - current_days;
+	uint8_t mode;	// Default_Update_Mode
+	uint8_t h24;	// h24_format
+	uint16_t rsv;
+} SETTINGS_INFO;
+
+typedef struct
+{
+	uint16_t year;
+	uint8_t month;
+	uint8_t date;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	uint8_t wday;
+	int32_t cal_minute;
+} TIME_CHECKPOINT;
+
+void settings_save(void)
+{
+	SETTINGS_INFO s;
+
+	memset(&s, 0, sizeof(s));
+	s.mode = Default_Update_Mode;
+	s.h24 = h24_format;
+	kv_set(KV_SETTINGS, &s, sizeof(s));
 }
-// 增加1天
-void date_inc(void)
+
+// 对时以后每小时记一次时间。只记分钟以上的部分也够用，写相同的值不会占flash
+void time_checkpoint(void)
 {
-	wday += 1;
-	if (wday >= 7)
-		wday = 0;
+	TIME_CHECKPOINT t;
+
+	t.year = year;
+	t.month = month;
+	t.date = date;
+	t.hour = hour;
+	t.minute = minute;
+	t.second = second;
+	t.wday = wday;
+	t.cal_minute = cal_minute;
+	kv_set(KV_TIME, &t, sizeof(t));
+}
 
-	date += 1;
-	if (date == get_month_day(month))
+// 开机时调用，在date_sync()之前。恢复了时间返回1，这时可以直接显示时钟而不是二维码。
+// 恢复的时间停在最后一个检查点，比实际慢，等下次对时纠正
+int settings_load(void)
+{
+	SETTINGS_INFO s;
+	TIME_CHECKPOINT t;
+	int restored = 0;
+
+	if (kv_get(KV_SETTINGS, &s, sizeof(s)) == sizeof(s))
 	{
-		date = 0;
-		month += 1;
-		if (month >= 12)
-		{
-			month = 0;
-			year += 1;
-		}
+		if (s.mode == CLOCK_MODE || s.mode == CALENDAR_MODE || s.mode == CUSTOM_CLOCK_MODE || s.mode == STATIC_MODE)
+			Default_Update_Mode = s.mode;
+		h24_format = s.h24 ? 1 : 0;
 	}
-}
 
-// 0: 状态不变
-// 1: 分钟改变
-// 2: 分钟改变10分钟
-// 3: 小时改变
-// 4: 天数改变
+	kv_get(KV_COUNTDOWN, countdown, sizeof(countdown));
 
-int clock_update(int inc)
+	if (kv_get(KV_TIME, &t, sizeof(t)) == sizeof(t) && t.month < 12 && t.hour < 24 && t.minute < 60)
+	{
+		year = t.year;
+		month = t.month;
+		date = t.date;
+		hour = t.hour;
+		minute = t.minute;
+		second = t.second;
+		wday = t.wday;
+		cal_minute = t.cal_minute;
+		restored = 1;
+		printk("Time restored from checkpoint\n");
+	}
+
+	return restored;
+}
+
+// 增加1天
+void date_inc(void)
 {
-	int retv = 0;
+	civil_from_days(days_from_civil(year, month, date) + 1, &year, &month, &date);
+	wday = (wday + 1) % 7;
+}
 
-	second += inc;
-	if (second < 60)
-		return retv;
-	second -= 60;
+// 走过一分钟
+static int clock_minute_inc(void)
+{
+	int retv = 1;
 
 	minute += 1;
-	retv = 1;
 	if ((minute % 10) == 0)
 		retv = 2;
 
@@ -548,8 +668,7 @@ int clock_update(int inc)
 		{
 			hour = 0;
 			date_inc();
-			ldate_inc();
-			get_holiday();
+			date_sync();
 			retv = 4;
 		}
 	}
@@ -557,8 +676,76 @@ int clock_update(int inc)
 	return retv;
 }
 
+// 0: 状态不变
+// 1: 分钟改变
+// 2: 分钟改变10分钟
+// 3: 小时改变
+// 4: 天数改变
+// inc可以跨过多个分钟，返回其中最大的状态
+
+int clock_update(int inc)
+{
+	int retv = 0, r;
+
+	second += inc;
+	while (second >= 60)
+	{
+		second -= 60;
+		r = clock_minute_inc();
+		if (r > retv)
+			retv = r;
+	}
+
+	return retv;
+}
+
+// 各显示模式的画面下一次在什么时候变化
+static int mode_next_change(int mode)
+{
+	switch (mode)
+	{
+	case CUSTOM_CLOCK_MODE:
+	case LB_MODE:
+	case STATIC_MODE:
+		return NEXT_NEVER;
+	default:
+		// 时钟和二维码每分钟都变，日历的状态栏也有时间
+		return NEXT_MINUTE;
+	}
+}
+
+/**
+ * 距离当前画面下一次变化还有多少秒，时钟定时器按它唤醒，中间的分钟不用醒
+ * NEXT_NEVER也在整点醒一次：每小时的时间检查点和广播还要继续
+ * 电量低时每分钟变化的画面改成每10分钟刷新一次
+ */
+int clock_next_change(void)
+{
+	int sec = 60 - second;
+	int next = mode_next_change(Update_Mode);
+
+	if (next == NEXT_MINUTE && batt_state() != BATT_OK)
+		sec += (9 - minute % 10) * 60;
+
+	switch (next)
+	{
+	case NEXT_DAY:
+		sec += (23 - hour) * 3600;
+		// fall through
+	case NEXT_HOUR:
+	case NEXT_NEVER:
+		sec += (59 - minute) * 60;
+		break;
+	}
+
+	return sec;
+}
+
 void clock_set(uint8_t *buf)
 {
+	// 先和本地时间比较，用来校准走时
+	timekeep_sync(buf);
+
 	year = buf[1] + buf[2] * 256;
 	month = buf[3];
 	date = buf[4] - 1;
@@ -566,20 +753,63 @@ void clock_set(uint8_t *buf)
 	minute = buf[6];
 	second = buf[7];
 	wday = buf[8];
-	l_year = buf[9];
-	l_month = buf[10];
-	l_date = buf[11] - 1;
-
-	get_holiday();
+	// 农历由本地计算，主机给的农历(buf[9-11])不再使用。它的年份索引可能超出农历表
+	date_sync();
 
 	cal_minute = 0;
 
 	app_clock_timer_restart();
+	time_checkpoint();
+}
+
+// 最近几次刷新的耗时统计，客户端可以读取trace特征值
+void trace_push(void)
+{
+	struct custs1_val_set_req *req = KE_MSG_ALLOC_DYN(CUSTS1_VAL_SET_REQ, prf_get_task_from_id(TASK_ID_CUSTS1), TASK_APP, custs1_val_set_req, DEF_SVC1_TRACE_CHAR_LEN);
+
+	req->conidx = app_env->conidx;
+	req->handle = SVC1_IDX_TRACE_VAL;
+	req->length = epd_trace_pack(req->value, DEF_SVC1_TRACE_CHAR_LEN);
+	KE_MSG_SEND(req);
+}
+
+// 主机订阅了long value的通知(写了CCC)。断开连接时清零
+int long_val_ntf;
+
+// OTA的状态，格式见ota.c。写进long value特征值给不订阅的主机读取，
+// 主机订阅了通知时同时通知它，不用每个page都读一次
+void ota_push(int status, int pages)
+{
+	struct custs1_val_set_req *req = KE_MSG_ALLOC_DYN(CUSTS1_VAL_SET_REQ, prf_get_task_from_id(TASK_ID_CUSTS1), TASK_APP, custs1_val_set_req, 4);
+	struct custs1_val_ntf_ind_req *ntf;
+	u8 value[4] = {0xa1, status, pages & 0xff, pages >> 8};
+
+	req->conidx = app_env->conidx;
+	req->handle = SVC1_IDX_LONG_VALUE_VAL;
+	req->length = 4;
+	memcpy(req->value, value, 4);
+	KE_MSG_SEND(req);
+
+	if (!long_val_ntf)
+		return;
+	ntf = KE_MSG_ALLOC_DYN(CUSTS1_VAL_NTF_REQ, prf_get_task_from_id(TASK_ID_CUSTS1), TASK_APP, custs1_val_ntf_ind_req, 4);
+	ntf->conidx = app_env->conidx;
+	ntf->notification = true;
+	ntf->handle = SVC1_IDX_LONG_VALUE_VAL;
+	ntf->length = 4;
+	memcpy(ntf->value, value, 4);
+	KE_MSG_SEND(ntf);
 }
 
 void clock_push(void)
 {
-	struct custs1_val_set_req *req = KE_MSG_ALLOC_DYN(CUSTS1_VAL_SET_REQ, prf_get_task_from_id(TASK_ID_CUSTS1), TASK_APP, custs1_val_set_req, 11);
+	struct custs1_val_set_req *req;
+
+	// 升级时long value特征值里是OTA的状态，不能覆盖
+	if (ota_state)
+		return;
+
+	req = KE_MSG_ALLOC_DYN(CUSTS1_VAL_SET_REQ, prf_get_task_from_id(TASK_ID_CUSTS1), TASK_APP, custs1_val_set_req, 11);
 
 	req->conidx = app_env->conidx;
 	req->handle = SVC1_IDX_LONG_VALUE_VAL;
@@ -612,7 +842,7 @@ static char *jieqi_name[] = {
 	"小寒",
 	"大寒",
 	"立春",
-	"水月",
+	"雨水",
 	"惊蛰",
 	"春分",
 	"清明",
@@ -638,7 +868,6 @@ static char *wday_str[] = {"日", "一", "二", "三", "四", "五", "六"};
 static char *lday_str_lo[] = {"一", "二", "三", "四", "五", "六", "七", "八", "九", "十", "冬", "腊", "正"};
 static char *lday_str_hi[] = {"初", "十", "廿", "二", "三"};
 
-static int epd_wait_state;
 static timer_hnd epd_wait_hnd;
 
 typedef struct
@@ -700,7 +929,7 @@ HOLIDAY_INFO hday_info[] = {
 	// 特殊周期性节日
 	{"母亲节", 5, 0x97},  // 5月第二个周日
 	{"父亲节", 6, 0xa7},  // 6月第三个周日
-	{"感恩节", 11, 0xa4}, // 11月第四个周四
+	{"感恩节", 11, 0xb4}, // 11月第四个周四
 
 	{"", 0, 0} // 结束标记
 };
@@ -731,17 +960,17 @@ static void ldate_str(char *buf)
 	sprintf(buf, "%s%s月%s%s", lflag, lday_str_lo[lm], lday_str_hi[hi], lday_str_lo[lo]);
 }
 
-static void set_holiday(int index)
+static void set_holiday(char **jq, char **hd, char *name)
 {
-	if (holiday_str == NULL)
+	if (*hd == NULL)
 	{
-		holiday_str = hday_info[index].name;
+		*hd = name;
 	}
-	else if (jieqi_str == NULL)
+	else if (*jq == NULL)
 	{
 		// 已经有一个农历节日了，将其转移到节气位置。
-		jieqi_str = holiday_str;
-		holiday_str = hday_info[index].name;
+		*jq = *hd;
+		*hd = name;
 	}
 	else
 	{
@@ -749,40 +978,48 @@ static void set_holiday(int index)
 	}
 }
 
-void get_holiday(void)
+/**
+ * 查找公历某一天的节气和节日
+ *
+ * @param year/mon/day/wd 公历年、月、日(0-based)和星期
+ * @param ly/lm/ld 当天的农历，格式同l_year/l_month/l_date
+ * @param jq 输出节气名，没有时为NULL。节日有两个时，第一个也放在这里
+ * @param hd 输出节日名，没有时为NULL
+ */
+static void find_holiday(int year, int mon, int day, int wd, int ly, int lm, int ld, char **jq, char **hd)
 {
 	int i;
 
-	jieqi_str = NULL;
-	holiday_str = NULL;
+	*jq = NULL;
+	*hd = NULL;
 
-	i = jieqi(year, month, date);
+	i = jieqi(year, mon, day);
 	if (i >= 0)
 	{
-		jieqi_str = jieqi_name[i];
+		*jq = jieqi_name[i];
 	}
 
 	i = 0;
 	while (hday_info[i].mon)
 	{
-		int mon = hday_info[i].mon;
-		int day = hday_info[i].day;
-		int mflag = mon & 0xc0;
-		int dflag = day;
-		mon = (mon & 0x0f) - 1;
-		day = (day & 0x1f) - 1;
+		int hmon = hday_info[i].mon;
+		int hday = hday_info[i].day;
+		int mflag = hmon & 0xc0;
+		int dflag = hday;
+		hmon = (hmon & 0x0f) - 1;
+		hday = (hday & 0x1f) - 1;
 		if (mflag & 0x80)
 		{
 			// 农历节日
 			if (mflag & 0x40)
 			{
 				// 当月最后一天
-				int mdays = get_lunar_mdays(l_month, NULL);
-				day = mdays - 1;
+				int mdays = lunar_mdays(ly, lm, NULL);
+				hday = mdays - 1;
 			}
-			if (l_month == mon && l_date == day)
+			if (lm == hmon && ld == hday)
 			{
-				set_holiday(i);
+				set_holiday(jq, hd, hday_info[i].name);
 			}
 		}
 		else
@@ -790,49 +1027,30 @@ void get_holiday(void)
 			// 公历节日
 			if (dflag & 0x80)
 			{
-				// 第几个周天
-				int wc = date / 7;
+				// 第几个星期几：bit4-5是第几个(0-based)，低4位是星期(7表示周日)
+				int wc = day / 7;
 				int hwc = (dflag >> 4) & 0x03;
-				day &= 0x07;
-				if (month == mon && wc == hwc && wday == day)
+				hday = (dflag & 0x0f) % 7;
+				if (mon == hmon && wc == hwc && wd == hday)
 				{
-					set_holiday(i);
+					set_holiday(jq, hd, hday_info[i].name);
 				}
 			}
-			else if (month == mon && date == day)
+			else if (mon == hmon && day == hday)
 			{
-				set_holiday(i);
+				set_holiday(jq, hd, hday_info[i].name);
 			}
 		}
 		i += 1;
 	}
-
-	return;
 }
 
-/****************************************************************************************/
-
-static uint8_t batt_cal(uint16_t adc_sample)
+void get_holiday(void)
 {
-	uint8_t batt_lvl;
-
-	if (adc_sample > 1705)
-		batt_lvl = 100;
-	else if (adc_sample <= 1705 && adc_sample > 1584)
-		batt_lvl = 28 + (uint8_t)(((((adc_sample - 1584) << 16) / (1705 - 1584)) * 72) >> 16);
-	else if (adc_sample <= 1584 && adc_sample > 1360)
-		batt_lvl = 4 + (uint8_t)(((((adc_sample - 1360) << 16) / (1584 - 1360)) * 24) >> 16);
-	else if (adc_sample <= 1360 && adc_sample > 1136)
-		batt_lvl = (uint8_t)(((((adc_sample - 1136) << 16) / (1360 - 1136)) * 4) >> 16);
-	else
-		batt_lvl = 0;
-
-	return batt_lvl;
+	find_holiday(year, month, date, wday, l_year, l_month, l_date, &jieqi_str, &holiday_str);
 }
 
-static int get_batt_volt(){
-	return (adcval * 225) >> 7;
-}
+/****************************************************************************************/
 
 /**
  * 绘制电池电量图标
@@ -847,12 +1065,10 @@ static int get_batt_volt(){
  */
 static void draw_batt(int x, int y)
 {
-	char str[8];
-	sprintf(str, "%d", get_batt_volt()); // 将整数格式化为字符串
-	char str2[8]={str[0],'.',str[1],str[2],str[3],'V'};
-	draw_text(x,y,str2,BLACK);
+	// 电压字符串在采样时已经格式化好了
+	draw_text(x,y,(char *)batt_volt_str(),BLACK);
 	// 获取电池电量百分比并转换为显示段数（0-10）
-	//int p = batt_cal(adcval);
+	//int p = batt_percent();
 	//p /= 10;
 
 	// 绘制电池外框
@@ -915,6 +1131,20 @@ typedef struct
 	int font_dseg;
 	u16 x[8];
 	u16 y[8];
+
+	// 日历界面
+	u8 cal_font;      // 大号日期、星期和月历的字体
+	u8 cal_grid_x;    // 月历表格的左边，左边放当天的大号日期
+	u8 cal_col_w;     // 月历的列宽
+	u8 cal_row_h;     // 月历的行高
+	u8 cal_scale;     // 大号日期的放大倍数
+	u8 cal_wday_y;    // 左边星期几的位置
+	u8 cal_status_y;  // 底部状态行的位置
+	u8 cal_ink_top;   // 数字在字符格里的上下边界，用于高亮框和初一的下划线
+	u8 cal_ink_bottom;
+
+	// 二维码界面
+	u8 qr_x, qr_y;
 } LAYOUT;
 
 // 坐标0: 公历日期
@@ -926,64 +1156,171 @@ typedef struct
 // 坐标6: 节日
 // 坐标7: 上下午
 
-LAYOUT layouts[3] = {
-	{
-		212,
-		104,
-		0,
-		1,
-		{15, 172, 190, 16, 12, 98, 150, 12},
-		{6, 7, 14, 27, 82, 82, 82, 44},
-	},
-	{
-		250,
-		122,
-		2,
-		3,
-		{15, 206, 210, 12, 12, 118, 176, 15},
-		{6, 8, 98, 28, 98, 98, 98, 50},
-	},
-	{
-		296,
-		128,
-		2,
-		3,
-		{
-			15,
-			246,
-			268,
-			30,
-			12,
-			140,
-			220,
-			15,
-		},
-		{
-			6,
-			8,
-			15,
-			30,
-			102,
-			102,
-			102,
-			52,
-		},
-	},
+/*
+ * 布局用锚点描述，由宏在编译时展开成各分辨率的坐标表，运行时不需要计算。
+ *   W/H    逻辑分辨率(横屏)
+ *   FC/FD  文字字体和时间的数码管字体
+ *   RH     文字的行高。底部一行(农历、节气、节日、电量)贴着下边
+ *   TW/TH  时间"00:00"的宽高。水平居中，垂直放在顶行和底行之间
+ *   INK0/INK1  数字在字符格里的上下边界
+ *   CF     日历的字体，SCALE 日历大号日期的放大倍数
+ * 时钟: 顶行左边是日期，右上角蓝牙；底行左边农历，中间节气，右边节日和电量。
+ * 日历: 左边约1/3放年月、大号日期和星期，右边是7列的月历；表头加6行日期放在状态行上面。
+ * 二维码: 2倍大小(62x62)放在左下角。矮屏左上的标题会压住它，改放右下角。
+ */
+#define ROW_Y(H, RH)        ((H) - (RH) - 8)
+#define TIME_X(W, TW)       (((W) - (TW)) / 2)
+#define TIME_Y(H, RH, TH)   ((6 + (RH) + ROW_Y(H, RH) - (TH)) / 2)
+#define CAL_GRID_X(W)       ((W) * 80 / 250)
+
+#define LAYOUT_DEF(W, H, FC, FD, RH, TW, TH, CF, INK0, INK1, SCALE) \
+	{ \
+		W, H, FC, FD, \
+		{15, (W) - 44, (W) - 40, TIME_X(W, TW), 12, (W) / 2 - 7, (W) - 74, TIME_X(W, TW) + 3}, \
+		{6, 8, ROW_Y(H, RH), TIME_Y(H, RH, TH), ROW_Y(H, RH), ROW_Y(H, RH), ROW_Y(H, RH), TIME_Y(H, RH, TH) + 22}, \
+		CF, CAL_GRID_X(W), ((W) - CAL_GRID_X(W)) / 7, ((H) - (RH) - 8) / 7, SCALE, (H) - 42, (H) - (RH), INK0, INK1, \
+		((H) < 122) ? (W) - 67 : 5, (H) - 66, \
+	}
+
+// 字体尺寸: 时间"00:00"的宽度是4个数字加一个冒号
+#define DSEG50_TW  (4 * 41 + 10)
+#define DSEG50_TH  50
+#define DSEG66_TW  (4 * 54 + 13)
+#define DSEG66_TH  66
+
+#define LAYOUT_NUM 3
+
+LAYOUT layouts[LAYOUT_NUM] = {
+	LAYOUT_DEF(212, 104, 0, 1, 14, DSEG50_TW, DSEG50_TH, 0, 5, 13, 2),
+	LAYOUT_DEF(250, 122, 2, 3, 16, DSEG66_TW, DSEG66_TH, 4, 3, 15, 3),
+	LAYOUT_DEF(296, 128, 2, 3, 16, DSEG66_TW, DSEG66_TH, 4, 3, 15, 3),
 };
 
 int current_layout = 0;
 
+// 没有完全相同的分辨率时，用能放进屏幕的最大布局
 void select_layout(int xres, int yres)
 {
-	int i;
+	int i, best = 0;
 
-	for (i = 0; i < 3; i++)
+	for (i = 0; i < LAYOUT_NUM; i++)
 	{
 		if (layouts[i].xres == xres && layouts[i].yres == yres)
 		{
 			current_layout = i;
 			return;
 		}
+		if (layouts[i].xres <= xres && layouts[i].yres <= yres)
+			best = i;
+	}
+	current_layout = best;
+}
+
+// 连续刷新(灰度分层、自定义绘画传输)之间保持屏幕上电的时间，单位10ms
+#define EPD_RETAIN_TIME  1000
+
+static timer_hnd epd_off_hnd;
+
+// 两级流水线：屏幕刷新第N帧时，CPU可以继续往fb里画第N+1帧。
+// 屏幕忙时提交的刷新先挂起，BUSY拉低后由epd_refresh_done()立即上传。
+static int epd_next_mode = -1;	// 已画好、等待上传的帧的刷新模式
+static int epd_next_flags;		// 等待上传的帧的来源(TRACE_F_FLASH)
+static int epd_next_draw = -1;	// 屏幕忙时错过的每分钟绘制
+
+// fb里有一帧在排队时，主机发来的会改动fb的命令先按顺序存在这里，排队的帧上传以后
+// 再执行。BLE消息里不等屏幕。每条命令前面是一个字节的长度
+#define EPD_DEFER_SIZE 1024
+static u8 epd_defer_buf[EPD_DEFER_SIZE];
+static int epd_defer_len;
+static int epd_replaying;
+
+static void epd_defer_replay(void);
+
+static void epd_refresh_start(int mode, int flags);
+
+u32 boot_t0;
+int boot_timing;
+
+// 开机时跳过的固件检查，等第一帧显示出来以后再做
+static void boot_verify_timer(void)
+{
+	if (ota_state)
+		return; // OTA会重写image，检查没有意义
+	selflash_verify();
+}
+
+// 保持时间内没有新的刷新，给屏幕断电
+static void epd_off_timer(void)
+{
+	epd_off_hnd = EASY_TIMER_INVALID_TIMER;
+	epd_power_off();
+}
+
+// 屏幕刷新完成后的收尾：保持上电或断电，然后允许系统睡眠
+static void epd_refresh_done(void)
+{
+	epd_trace_phase(TRACE_BUSY);
+
+	if (epd_wait_hnd != EASY_TIMER_INVALID_TIMER)
+	{
+		app_easy_timer_cancel(epd_wait_hnd);
+		epd_wait_hnd = EASY_TIMER_INVALID_TIMER;
+	}
+#if EPD_BUSY_IRQ
+	wkupct_disable_irq();
+#endif
+	// 断电之前读出这次刷新测到的温度，走时修正要用
+	epd_temp_read();
+	// 带负载的电池采样只在波形期间有意义，还没采的这次不采了
+	batt_refresh_done();
+
+	if (epd_next_mode >= 0)
+	{
+		// 下一帧已经在fb里了，保持上电直接上传
+		int mode = epd_next_mode;
+		epd_next_mode = -1;
+		epd_retain();
+		epd_trace_end();
+		epd_refresh_start(mode, epd_next_flags | TRACE_F_QUEUED);
+		// fb已经上传，可以接着执行等着它的命令了
+		epd_defer_replay();
+		return;
+	}
+
+	if (isTransing || update_mode == UPDATE_GRAY)
+	{
+		// 后面很可能紧跟着下一次刷新
+		epd_retain();
+		epd_off_hnd = app_easy_timer(EPD_RETAIN_TIME, epd_off_timer);
+	}
+	else
+	{
+		epd_power_off();
+	}
+	epd_trace_phase(TRACE_SLEEP);
+	epd_trace_end();
+	trace_push();
+
+	if (boot_timing)
+	{
+		// 第一帧已经在屏幕上了
+		boot_timing = 0;
+		printk("Boot: first pixel %d ms\n", (((epd_ticks() - boot_t0) & 0x07ffffff) * 5) >> 3);
+	}
+	if (boot_verify_pending && ota_state == 0)
+	{
+		boot_verify_pending = 0;
+		app_easy_timer(100, boot_verify_timer);
+	}
+
+	// 设置系统进入扩展睡眠模式
+	arch_set_sleep_mode(ARCH_EXT_SLEEP_ON);
+
+	if (epd_next_draw >= 0)
+	{
+		int flags = epd_next_draw;
+		epd_next_draw = -1;
+		per_min_draw(flags);
 	}
 }
 
@@ -992,68 +1329,220 @@ void select_layout(int xres, int yres)
  *
  * 功能说明：
  * - 检查电子墨水屏是否处于忙状态
- * - 如果忙，则40ms后再次检查
+ * - 如果忙，则再次检查(轮询模式40ms，中断模式下只作为超时保护)
  * - 如果空闲，则完成更新流程并进入省电模式
- *
- * 电子墨水屏更新完成后的处理：
- * 1. 发送深度睡眠命令(0x10, 0x01)
- * 2. 关闭电源
- * 3. 关闭硬件接口
- * 4. 设置系统进入扩展睡眠模式
  */
 static void epd_wait_timer(void)
 {
+	epd_wait_hnd = EASY_TIMER_INVALID_TIMER;
 	if (epd_busy())
 	{
-		// 屏幕仍在忙，40ms后再次检查
-		epd_wait_hnd = app_easy_timer(40, epd_wait_timer);
+		// 屏幕仍在忙，稍后再次检查
+		epd_wait_hnd = app_easy_timer(EPD_BUSY_IRQ ? 100 : 40, epd_wait_timer);
 	}
-	else
+	else if (epd_state == EPD_STATE_BUSY)
 	{
-		// 屏幕更新完成
-		epd_wait_hnd = EASY_TIMER_INVALID_TIMER;
-		// 发送深度睡眠命令
-		epd_cmd1(0x10, 0x01);
-		// 关闭电源
-		epd_power(0);
-		// 关闭硬件接口
-		epd_hw_close();
-		// 设置系统进入扩展睡眠模式
-		arch_set_sleep_mode(ARCH_EXT_SLEEP_ON);
+		epd_refresh_done();
+	}
+}
+
+#if EPD_BUSY_IRQ
+// BUSY下降沿唤醒后在应用任务中执行
+static void epd_busy_wakeup(void)
+{
+	if (epd_state != EPD_STATE_BUSY)
+		return;
+
+	if (epd_busy())
+	{
+		// 在控制器拉高BUSY之前就触发了，重新等待
+		wkupct_enable_irq(WKUPCT_PIN_SELECT(epd_busy_gpio() >> 4, epd_busy_gpio() & 0x0f),
+						  WKUPCT_PIN_POLARITY(epd_busy_gpio() >> 4, epd_busy_gpio() & 0x0f, WKUPCT_PIN_POLARITY_LOW),
+						  1, 0);
+		return;
 	}
+	epd_refresh_done();
 }
+
+// 唤醒控制器中断，不能在这里操作屏幕，只把处理交给应用任务
+static void epd_busy_irq(void)
+{
+	wkupct_disable_irq();
+	app_easy_wakeup();
+}
+#endif
+
+// 刷新已经启动，等待BUSY拉低。
+// 中断模式下CPU在整个波形期间都可以睡眠，由BUSY下降沿唤醒。
+static void epd_wait_start(void)
+{
+#if EPD_BUSY_IRQ
+	int port = epd_busy_gpio() >> 4;
+	int pin = epd_busy_gpio() & 0x0f;
+
+	app_easy_wakeup_set(epd_busy_wakeup);
+	wkupct_register_callback(epd_busy_irq);
+	wkupct_enable_irq(WKUPCT_PIN_SELECT(port, pin),
+					  WKUPCT_PIN_POLARITY(port, pin, WKUPCT_PIN_POLARITY_LOW),
+					  1, 0);
+	arch_set_sleep_mode(ARCH_EXT_SLEEP_ON);
+	// 超时保护，以防错过中断
+	epd_wait_hnd = app_easy_timer(500, epd_wait_timer);
+#else
+	// 更新时如果深度休眠，会花屏。 这里暂时关闭休眠。
+	arch_set_sleep_mode(ARCH_SLEEP_OFF);
+	epd_wait_hnd = app_easy_timer(40, epd_wait_timer);
+#endif
+}
+
+// 会改动fb或者提交刷新的命令，有帧排队时要排在它后面
+static int epd_fb_cmd(int cmd)
+{
+	switch (cmd)
+	{
+	case 0x93: case 0x94: case 0x95: case 0x96:
+	case 0x97: case 0x98: case 0x9a: case 0x9e:
+		return 1;
+	}
+	return 0;
+}
+
+// 命令要等排队的帧上传时存起来，返回1。存不下时放弃排队的那一帧(主机画完后还会
+// 再刷新)，把存着的命令直接执行掉
+static int epd_defer(const u8 *value, int len)
+{
+	if (epd_replaying || !epd_fb_cmd(value[0]))
+		return 0;
+
+	while (epd_next_mode >= 0 || epd_defer_len > 0)
+	{
+		if (epd_defer_len + 1 + len <= EPD_DEFER_SIZE)
+		{
+			epd_defer_buf[epd_defer_len] = len;
+			memcpy(epd_defer_buf + epd_defer_len + 1, value, len);
+			epd_defer_len += 1 + len;
+			return 1;
+		}
+		printk("EPD: command queue full, queued frame skipped\n");
+		epd_next_mode = -1;
+		epd_defer_replay();
+	}
+	return 0;
+}
+
+// 按顺序执行存着的命令，直到其中一条又让一帧排队
+static void epd_defer_replay(void)
+{
+	u32 buf[(sizeof(struct custs1_val_write_ind) + DEF_SVC1_LONG_VALUE_CHAR_LEN + 3) / 4];
+	struct custs1_val_write_ind *ind = (struct custs1_val_write_ind *)buf;
+	int pos = 0;
+
+	while (pos < epd_defer_len && epd_next_mode < 0)
+	{
+		ind->conidx = app_env->conidx;
+		ind->handle = SVC1_IDX_LONG_VALUE_VAL;
+		ind->length = epd_defer_buf[pos];
+		memcpy(ind->value, epd_defer_buf + pos + 1, ind->length);
+		pos += 1 + ind->length;
+
+		epd_replaying = 1;
+		user_svc1_long_val_wr_ind_handler(CUSTS1_VAL_WRITE_IND, ind, TASK_APP, TASK_ID_CUSTS1);
+		epd_replaying = 0;
+	}
+	epd_defer_len -= pos;
+	memmove(epd_defer_buf, epd_defer_buf + pos, epd_defer_len);
+}
+
+// 把fb里画好的一帧送到屏幕并启动刷新，各阶段计入trace
+static void epd_refresh_start(int mode, int flags)
+{
+	if (epd_off_hnd != EASY_TIMER_INVALID_TIMER)
+	{
+		app_easy_timer_cancel(epd_off_hnd);
+		epd_off_hnd = EASY_TIMER_INVALID_TIMER;
+	}
+	if (epd_state == EPD_STATE_RETAIN)
+		flags |= TRACE_F_RETAIN;
+	epd_trace_begin(mode, flags);
+
+	epd_hw_open();
+	epd_update_mode(mode);
+	epd_init();
+	epd_trace_phase(TRACE_INIT);
+	if (flags & TRACE_F_FLASH)
+		epd_image_upload();
+	else
+		epd_screen_update();
+	epd_trace_phase(TRACE_UPLOAD);
+	epd_update();
+	epd_trace_phase(TRACE_LUT);
+	epd_wait_start();
+	// 波形期间电池的负载最重，这时采样最能反映剩余电量
+	batt_refresh_start();
+}
+
 // 适用于快速刷新的阻塞式等待（带超时保护）
 //辅助函数：清空画布
 void setFB(){
 	
 	memset(fb_bw, 0xff, scr_h * line_bytes);
-	memset(fb_rr, 0x00, scr_h * line_bytes);
+	if(fb_rr)
+		memset(fb_rr, 0x00, scr_h * line_bytes);
 	
 }
 //“刷新屏幕的”
 void gray_mode_refresh(){//使用和黑白一样的fb
-		epd_cmd(0x24); 
-		for(int i=0; i<(scr_w * scr_h / 8); i++) epd_data(0xFF); // 填充全白数据清空缓存
 		refresh_screen(UPDATE_GRAY);
 }
-void refresh_screen(int UPDATE_MODE){
-	
+static void epd_refresh_submit(int mode, int flags)
+{
+	drawn_key = 0;
+	if (epd_state == EPD_STATE_BUSY)
+	{
+		// 上一帧还在刷新，这一帧已经画好在fb里(或者在flash里)，等BUSY拉低后再上传
+		epd_next_mode = mode;
+		epd_next_flags = flags;
+		return;
+	}
 // 墨水屏更新显示
-	epd_hw_open();
-	epd_update_mode(UPDATE_MODE);
-	arch_set_sleep_mode(ARCH_SLEEP_OFF);
-	epd_init();
-	epd_screen_update();
-	epd_update();
-	// 更新时如果深度休眠，会花屏。 这里暂时关闭休眠。
-	epd_wait_hnd = app_easy_timer(40, epd_wait_timer);
-	
+	epd_refresh_start(mode, flags);
+}
+void refresh_screen(int UPDATE_MODE){
+	epd_refresh_submit(UPDATE_MODE, 0);
+}
+// 显示flash图片槽里的画面，fb保持不变。槽里没有合适的画面返回-1
+int refresh_image(int UPDATE_MODE){
+	if (!epd_image_valid())
+		return -1;
+	if (epd_next_mode >= 0)
+		return -1; // 排队的帧还在fb里，不能覆盖它。主机的命令不会走到这里(见epd_defer)
+	epd_refresh_submit(UPDATE_MODE, TRACE_F_FLASH);
+	return 0;
+}
+
+/**
+ * 静态层缓存的key：显示模式、屏幕布局和公历日期
+ * 静态层还依赖其它状态时，调用者再用layer_hash_int()加进去
+ */
+static u32 layer_key(int mode)
+{
+	u32 key = LAYER_HASH_INIT;
+
+	key = layer_hash_int(key, mode);
+	key = layer_hash_int(key, current_layout);
+	key = layer_hash_int(key, scr_mode);
+	key = layer_hash_int(key, year);
+	key = layer_hash_int(key, month);
+	key = layer_hash_int(key, date);
+	return key;
 }
 
 void QR_draw()
 {
+	LAYOUT *lt = &layouts[current_layout];
+
 	epd_update_mode(UPDATE_FAST);
-	draw_qr_code(5, 56, 2, QR_31x31);
+	draw_qr_code(lt->qr_x, lt->qr_y, 2, QR_31x31);
 	/*
 	draw_text(100, 5, "Bluetooth", BLACK);
 	draw_text(100, 20, "DLG-CLOCK ", BLACK);
@@ -1062,13 +1551,13 @@ void QR_draw()
 	draw_text(110, 40, "-------------", BLACK);
 */
 	
-	draw_hline(20,0,layouts[current_layout].xres,BLACK);
+	draw_hline(20,0,lt->xres,BLACK);
 	fb_set_scale(2);
 	draw_text_filled(1,0, "S\nbrowser", WHITE);
 	fb_set_scale(1);
-	draw_text_filled(112,5,"AAAYYY\n=_=",WHITE);
+	draw_text_filled(lt->xres/2-13,5,"AAAYYY\n=_=",WHITE);
 		
-	draw_line(0,layouts[current_layout].yres,layouts[current_layout].xres,0,SWAP);
+	draw_line(0,lt->yres,lt->xres,0,SWAP);
 	draw_text_filled(0,0,bt_id,3);
 	redraw_dirty_mark=1;
 }
@@ -1078,8 +1567,7 @@ void LB_draw()
 	
 	epd_update_mode(UPDATE_FULL);
 
-	memset(fb_bw, 0xff, scr_h * line_bytes);
-	memset(fb_rr, 0x00, scr_h * line_bytes);
+	setFB();
 
 	draw_qr_code(60, 10, 4, LB_31x31);
 	redraw_dirty_mark=1;
@@ -1104,10 +1592,39 @@ void LB_draw()
 void draw_clock(int flags){
 	char tbuf[64];
 	LAYOUT *lt = &layouts[current_layout];
-		// 显示电池电量
+	u32 key = layer_key(CLOCK_MODE);
+
+	// 静态层：日期、农历、节气和节日，一天只画一次
+	key = layer_hash_int(key, l_year);
+	key = layer_hash_int(key, l_month);
+	key = layer_hash_int(key, l_date);
+	if (!layer_restore(key))
+	{
+		// 显示公历日期
+		sprintf(tbuf, "%4d年%2d月%2d日   星期%s", year, month + 1, date + 1, wday_str[wday]);
+		select_font(lt->font_char);
+		draw_text(lt->x[0], lt->y[0], tbuf, BLACK);
+
+		// 显示农历日期(不显示年)
+		ldate_str(tbuf);
+		draw_text(lt->x[4], lt->y[4], tbuf, BLACK);
+		// 显示节气和节日，三色屏上用红色，黑白屏上RED按黑色画
+		if (jieqi_str){
+			draw_text_box(lt->x[5], lt->y[5], jieqi_str, WHITE, RED);
+		}
+		
+		if (holiday_str)
+		{
+			draw_text(lt->x[6], lt->y[6], holiday_str, RED);
+		}
+		layer_save(key);
+	}
+
+		// 显示电池电量(字体不能依赖上一帧留下的状态)
+	select_font(lt->font_char);
 	draw_batt(lt->x[2], lt->y[2]);
 	
-	if ((flags & DRAW_BT)||boot_debug)//debug在头文件
+	if (adv_policy_icon())//已连接或者正在快速广播
 	{
 		// 显示蓝牙图标
 		draw_bt(lt->x[1], lt->y[1]);
@@ -1153,23 +1670,6 @@ void draw_clock(int flags){
 		draw_text(lt->x[7], lt->y[7], tbuf, BLACK);
 	}
 
-	// 显示公历日期
-	sprintf(tbuf, "%4d年%2d月%2d日   星期%s", year, month + 1, date + 1, wday_str[wday]);
-	select_font(lt->font_char);
-	draw_text(lt->x[0], lt->y[0], tbuf, BLACK);
-
-	// 显示农历日期(不显示年)
-	ldate_str(tbuf);
-	draw_text(lt->x[4], lt->y[4], tbuf, BLACK);
-	// 显示节气
-	if (jieqi_str){
-		draw_text_filled(lt->x[5], lt->y[5], jieqi_str, WHITE);
-	}
-	
-	if (holiday_str)
-	{
-		draw_text(lt->x[6], lt->y[6], holiday_str, BLACK);
-	}
 		redraw_dirty_mark=1;
 
 	// 墨水屏更新显示
@@ -1179,23 +1679,24 @@ void custom_clock_draw(int flag){//drawclock同款flag
 			
 			redraw_dirty_mark=1;
 			
+			u32 key = layer_key(CUSTOM_CLOCK_MODE);
+			if (layer_restore(key))
+				return;
 			draw_text_filled(5,5,"CUSTOM CLOCK MODE : \n   I AM DEVELOPING!",WHITE);
+			layer_save(key);
 			
 }
 
 
 
 
-int last_hour=2000;
-int last_day=2000;
-static u8 calbuf[3813];
 /**
- * 绘制日历界面（使用了第四个字体而且仅支持250*122）
+ * 绘制日历界面，坐标来自布局表
  */
 void calendar_draw(int flags) {
 	  LAYOUT *lt = &layouts[current_layout];
-		if(last_day!=date){
-		last_day=date;
+		u32 key = layer_key(CALENDAR_MODE);
+		if(!layer_restore(key)){
 		epd_update_mode(UPDATE_FAST);
 		int maxX = lt->xres;
     int maxY = lt->yres;
@@ -1212,38 +1713,38 @@ void calendar_draw(int flags) {
     // Draw Year and Month
     sprintf(buf, "%d年%d月", year-2000, month + 1);
     draw_text(10, 5, buf, BLACK);
+    int grid_x = lt->cal_grid_x;
 
     // Draw the Current Day (Large Scale)
     //fb_set_scale(3); // Scale up the font 3x
 		
-		select_font(4);
-		fb_set_scale(3);
+		select_font(lt->cal_font);
+		fb_set_scale(lt->cal_scale);
     sprintf(buf, "%d", date + 1);
     draw_text(15, 25, buf, BLACK);
-		//select_font(lt->font_char);
     fb_set_scale(1); // Reset scale to normal
 
     // Draw the Weekday
 		
     sprintf(buf, "星期%s", wday_str[wday]);
-    draw_text(15, 80, buf, BLACK);
+    draw_text(15, lt->cal_wday_y, buf, BLACK);
 
     // Draw a vertical separator line
-    int grid_x = 80; // Start the calendar grid at X=80
     draw_vline(grid_x - 5, 5, maxY - 10, BLACK);
 
     // ==========================================
     // 2. Draw Right Panel (Calendar Grid)
     // ==========================================
     
-    int col_w = (maxX - grid_x) / 7; // Calculate column width based on remaining space
-    int row_h = 16; // 16x16 font height
+    int col_w = lt->cal_col_w;
+    int row_h = lt->cal_row_h;
     int grid_y = 2; // Top margin
+    int digit_w = fb_get_font_width('0');
 
     // Draw Weekday Header (日 一 二 三 四 五 六)
     for (int i = 0; i < 7; i++) {
-        // Center the 16px character in the column
-        int offset_x = (col_w - 16) / 2; 
+        // Center the character in the column
+        int offset_x = (col_w - fb_get_font_width(0x65e5)) / 2; 
         draw_text(grid_x + i * col_w + offset_x, grid_y, wday_str[i], BLACK);
     }
 
@@ -1252,12 +1753,12 @@ void calendar_draw(int flags) {
 
     // Calculate properties for the current month
     // date % 7 gives the offset of the current day from the 1st
-    int start_wday = (wday - (date % 7) + 7) % 7; // Weekday of the 1st day of the month
-    int days_in_month = get_month_day(month);
+    int start_wday = weekday_from_days(days_from_civil(year, month, 0)); // Weekday of the 1st day of the month
+    int mdays = days_in_month(year, month);
 
     // Draw Days of the month
     int current_row = 1; // Start drawing days on row 1 (below header)
-    for (int day = 0; day < days_in_month; day++) {
+    for (int day = 0; day < mdays; day++) {
         int col = (start_wday + day) % 7; // Calculate column (0-6)
         int row = current_row + (start_wday + day) / 7; // Calculate row 
 
@@ -1266,33 +1767,60 @@ void calendar_draw(int flags) {
 
         sprintf(buf, "%d", day + 1);
         
-        // Approximate centering for 1-digit vs 2-digit numbers
-        int text_offset_x = (day + 1 < 10) ? (col_w - 8) / 2 : (col_w - 16) / 2;
+        // Center 1-digit and 2-digit numbers
+        int text_w = (day + 1 < 10) ? digit_w : digit_w * 2;
+        int text_offset_x = (col_w - text_w) / 2;
+        int ink_top = y + lt->cal_ink_top;
+        int ink_bottom = y + lt->cal_ink_bottom;
+
+        // Underline the first day of each lunar month (初一)
+        int ly, lm, ld;
+        int lunar_ok = (lunar_from_date(year, month, day, &ly, &lm, &ld) == 0);
+        int lunar_first = (lunar_ok && ld == 0);
+
+        // Solar terms and holidays get a dot at the top right of the number
+        // Outside the lunar table only the Gregorian holidays can match
+        char *jq, *hd;
+        if (!lunar_ok) {
+            ly = 0;
+            lm = ld = -1;
+        }
+        find_holiday(year, month, day, col, ly, lm, ld, &jq, &hd);
+        if (jq || hd)
+            draw_box(x + text_offset_x + text_w, ink_top, x + text_offset_x + text_w + 1, ink_top + 1, RED);
 
         if (day == date) {
 						
             // Highlight the current day using filled text (WHITE text on BLACK background)
             draw_text(x + text_offset_x, y, buf, BLACK);
-						draw_box(x + text_offset_x-1,y,x + text_offset_x+17,y+16,SWAP);
+            if (lunar_first)
+                draw_hline(ink_bottom + 1, x + text_offset_x, x + text_offset_x + text_w - 1, BLACK);
+						draw_box(x + text_offset_x - 2, ink_top - 1, x + text_offset_x + text_w + 1, ink_bottom + 1, SWAP);
         } else {
             // Standard day drawing
             draw_text(x + text_offset_x, y, buf, BLACK);
+            if (lunar_first)
+                draw_hline(ink_bottom + 1, x + text_offset_x, x + text_offset_x + text_w - 1, BLACK);
         }
     }
-		memcpy(calbuf,fb_bw,3813);
+		layer_save(key);
 		}
    
-    memcpy(fb_bw,calbuf,3813);
-		if ((flags & DRAW_BT)||boot_debug)//debug在头文件
+		if (adv_policy_icon())//已连接或者正在快速广播
 		{
 			// 显示蓝牙图标
 			draw_bt(lt->xres-8, lt->yres-15);
 		}
-		char str[36];
+		char str[48];
+		int cd_days;
+		COUNTDOWN_INFO *cd = countdown_next(&cd_days);
 		select_font(lt->font_char);
 		
-		sprintf(str,"| %02d:%02d | %dmv | %dD->end",hour,minute,get_batt_volt(),days_until(2026,5,6));// 5 代表 6 月，6 代表 7 号
-		draw_text(5,lt->yres-16,str,BLACK);
+		if (cd)
+			sprintf(str,"| %02d:%02d | %dmv | %dD->%s",hour,minute,batt_volt(),cd_days,cd->name);
+		else
+			sprintf(str,"| %02d:%02d | %dmv",hour,minute,batt_volt());
+		draw_text(5,lt->cal_status_y,str,BLACK);
 		//draw_filled_triangle(0,0,120,0,120,112,SWAP);
 		
 		redraw_dirty_mark=1;
@@ -1311,10 +1839,29 @@ void per_min_draw(int flags)
 	{
 		return;
 	}
-	epd_hw_open();
+	if (epd_state == EPD_STATE_BUSY)
+	{
+		// 屏幕还在刷新上一帧，完成后再画
+		epd_next_draw = flags;
+		return;
+	}
+	if (Update_Mode == STATIC_MODE)
+	{
+		// 画面在图片槽里，只在开机后显示一次。槽是空的就退回时钟
+		if (static_shown)
+			return;
+		if (refresh_image(UPDATE_FULL) == 0)
+		{
+			static_shown = 1;
+			return;
+		}
+		Default_Update_Mode = CLOCK_MODE;
+		Update_Mode = CLOCK_MODE;
+	}
+	static_shown = 0;
+	epd_trace_draw();
 	epd_update_mode(flags & 3);
-	memset(fb_bw, 0xff, scr_h * line_bytes);
-	memset(fb_rr, 0x00, scr_h * line_bytes);
+	setFB();
 	
 	switch(Update_Mode){
 		case QR_MODE:{
@@ -1337,12 +1884,24 @@ void per_min_draw(int flags)
 	//如果执行了操作但是没有重绘，说明它不需要重绘
 	if(!redraw_dirty_mark)return;
 	redraw_dirty_mark=0;
-	epd_init();
-	epd_screen_update();
-	epd_update();
-	// 更新时如果深度休眠，会花屏。 这里暂时关闭休眠。
-	arch_set_sleep_mode(ARCH_SLEEP_OFF);
-	epd_wait_hnd = app_easy_timer(40, epd_wait_timer);
+	refresh_screen(update_mode);
+	drawn_key = layer_key(Update_Mode);
+}
+
+/**
+ * 时钟定时器醒来时画面要不要重画
+ * 每分钟变化的画面总是要。NEXT_NEVER的画面(没有时间和蓝牙图标)只在静态层的key变了
+ * (换了一天、换了布局)或者屏幕上是别的画面时才重画，整点只做时间检查点和广播
+ */
+int clock_screen_changed(void)
+{
+	int mode = Default_Update_Mode;
+
+	if (mode_next_change(mode) != NEXT_NEVER)
+		return 1;
+	if (mode == STATIC_MODE)
+		return !static_shown;
+	return Update_Mode != mode || drawn_key != layer_key(mode);
 }
 
 
@@ -1370,6 +1929,25 @@ void user_svc1_ctrl_wr_ind_handler(ke_msg_id_t const msgid,
 	printk("Control Point: %02x\n", param->value[0]);
 }
 
+/**
+ * long value的CCC写入指示处理函数
+ *
+ * @param msgid 消息ID
+ * @param param 写入参数，value是CCC的值
+ * @param dest_id 目标任务ID
+ * @param src_id 源任务ID
+ *
+ * 主机写01 00订阅通知，00 00取消。订阅后OTA的状态用通知发出
+ */
+void user_svc1_long_val_cfg_ind_handler(ke_msg_id_t const msgid,
+										struct custs1_val_write_ind const *param,
+										ke_task_id_t const dest_id,
+										ke_task_id_t const src_id)
+{
+	long_val_ntf = (param->length >= 1) && (param->value[0] & 0x01);
+	printk("Long Value NTF: %d\n", long_val_ntf);
+}
+
 /**
  * 根据索引获取替换字符串
  * @param index 标记中的数字
@@ -1379,8 +1957,8 @@ void user_svc1_ctrl_wr_ind_handler(ke_msg_id_t const msgid,
 
 void get_replacement(const char *key, char *out, int max_len) {
 			if (strcmp(key, "U") == 0) {
-					int volt=get_batt_volt();
-					snprintf(out, max_len, "%d.%03dV", volt / 1000, volt % 1000);
+					strncpy(out,batt_volt_str(),max_len-1);
+					out[max_len - 1] = '\0';
 			} else if (strcmp(key, "B") == 0) {
 					strncpy(out,adv_name+2,max_len-1);
 				out[max_len - 1] = '\0'; // 确保终止
@@ -1488,6 +2066,11 @@ void custom_draws_prase(uint8_t drawBuffer[64]){
 			//0是指令代表，1，2为位置，3，4为索引，5，6为图块边长7之后为图块数据（最大32x32），
 				draw_bitmap(drawBuffer[1]+(drawBuffer[3]*drawBuffer[5]),drawBuffer[2]+(drawBuffer[4]*drawBuffer[6]),drawBuffer[5],drawBuffer[6],&drawBuffer[7]);
 			}		
+		break;
+		case 0x10:  // 接收红色平面的图片数据块，格式同0x0f，为1的点画成红色，为0的点不变
+		{
+				draw_bitmap_mask(drawBuffer[1]+(drawBuffer[3]*drawBuffer[5]),drawBuffer[2]+(drawBuffer[4]*drawBuffer[6]),drawBuffer[5],drawBuffer[6],&drawBuffer[7],RED);
+			}
 		break;
 				case 0x1a:{//画三角形
 				if(drawBuffer[8]) draw_triangle(drawBuffer[1],drawBuffer[2],drawBuffer[3],drawBuffer[4],drawBuffer[5],drawBuffer[6],drawBuffer[7]);
@@ -1528,6 +2111,10 @@ if (param == NULL||isTransing==0) {
  *
  * 处理命令：
  * - 0x91: 时钟设置命令
+ * - 0x9b: 打印刷新耗时统计
+ * - 0x9c: 绘图基准测试
+ * - 0x9d: 设置倒计时目标
+ * - 0x9e: 图片槽，00保存当前画面，01显示保存的画面
  * - 0xA0及以上: OTA升级相关命令
  */
 
@@ -1538,6 +2125,10 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 									   ke_task_id_t const dest_id,
 									   ke_task_id_t const src_id)
 {
+	// 有帧在fb里排队时，改动fb的命令等它上传以后再执行
+	if (epd_defer(param->value, param->length))
+		return;
+
 	if (param->value[0] == 0x91)
 	{
 		// 设置时钟
@@ -1552,7 +2143,9 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 	{
 		// 修改24-12小时制
 		h24_format = !h24_format;
+		settings_save();
 		Update_Mode=CLOCK_MODE;
+		app_clock_timer_reschedule();
 		per_min_draw(DRAW_BT | UPDATE_FAST);
 	}
 	else if (param->value[0] == 0x92)
@@ -1562,13 +2155,14 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 		diff_sec |= param->value[2] << 8;
 		diff_sec = (diff_sec << 16) >> 16;
 		printk("Calibration: %02x\n", diff_sec);
-		clock_fixup_set(diff_sec, cal_minute);
+		timekeep_manual(diff_sec, cal_minute);
 		cal_minute = 0;
 	}
 	else if (param->value[0] == 0x93)//启动空传输
 	{
 		isTransing=1;
     setFB();
+		epd_trace_draw();
 	}
 		else if (param->value[0] == 0x94)//进行传输
 	{
@@ -1579,9 +2173,32 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 		refresh_screen(UPDATE_FAST);
 		isTransing=0;
 	}
-	else if (param->value[0] == 0x96)//截断显示模式（固定显示这个画面）
+	else if (param->value[0] == 0x96)//截断显示模式（固定显示这个画面）：00当前画面，01图片槽里的画面
 	{
-		
+		if (ota_state || isTransing)
+			return;
+		if (param->value[1] == 0x00 && epd_image_save() < 0)
+		{
+			printk("Image too large for the slot\n");
+			return;
+		}
+		if (param->value[1] == 0x01 && refresh_image(UPDATE_FULL) < 0)
+		{
+			printk("No image in the slot\n");
+			return;
+		}
+		if (param->value[1] > 0x01 && !epd_image_valid())
+		{
+			// 其它参数不刷新，直接用槽里的画面，槽是空的就不切换
+			printk("No image in the slot\n");
+			return;
+		}
+		// 存进槽里，复位后还能显示。之后时钟定时器每小时才醒一次
+		static_shown = 1;
+		Default_Update_Mode = STATIC_MODE;
+		Update_Mode = STATIC_MODE;
+		settings_save();
+		app_clock_timer_reschedule();
 	}
 	else if (param->value[0] == 0x97)//快速刷新,可以接着传
 	{
@@ -1591,6 +2208,7 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 	else if (param->value[0] == 0x98)//启动传输,但是不清空画布
 	{
 		isTransing=1;
+		epd_trace_draw();
 	}
 	else if (param->value[0] == 0x99)//更换模式：日历模式，时钟模式，用户时钟模式
 	{
@@ -1600,12 +2218,16 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 			if(Default_Update_Mode==buf[i]){
 				Default_Update_Mode=buf[(i+1)%3];
 				Update_Mode=Default_Update_Mode;
+				settings_save();
+				app_clock_timer_reschedule();
 				per_min_draw_default();
 				return;
 			}
 		}
 		Default_Update_Mode=CLOCK_MODE;
 		Update_Mode=Default_Update_Mode;
+		settings_save();
+		app_clock_timer_reschedule();
 		per_min_draw_default();
 		
 	}
@@ -1613,6 +2235,41 @@ void user_svc1_long_val_wr_ind_handler(ke_msg_id_t const msgid,
 		// 在 epd_load_lut 或刷新逻辑中
 		gray_mode_refresh();
 	}
+	else if(param->value[0] == 0x9b){//打印最近几次刷新的耗时统计
+		epd_trace_dump();
+		trace_push();
+	}
+	else if(param->value[0] == 0x9c){//绘图基准测试，结果打印在调试串口
+		if (isTransing || epd_state == EPD_STATE_BUSY || epd_state == EPD_STATE_READY)
+			return;
+		epd_bench_run();
+		// 基准测试把fb画乱了，重画当前画面
+		Update_Mode = Default_Update_Mode;
+		per_min_draw(DRAW_BT | UPDATE_FAST);
+	}
+	else if(param->value[0] == 0x9d){//设置倒计时目标
+		countdown_set((uint8_t *)param->value, param->length);
+		countdown_save();
+		if (Default_Update_Mode == CALENDAR_MODE)
+		{
+			Update_Mode = Default_Update_Mode;
+			per_min_draw(DRAW_BT | UPDATE_FAST);
+		}
+	}
+	else if(param->value[0] == 0x9e){//图片槽：00把当前画面存进flash，01从flash直接显示
+		if (ota_state || isTransing)
+			return;
+		if (param->value[1] == 0x00)
+		{
+			if (epd_image_save() < 0)
+				printk("Image too large for the slot\n");
+		}
+		else if (param->value[1] == 0x01)
+		{
+			if (refresh_image(UPDATE_FULL) < 0)
+				printk("No image in the slot\n");
+		}
+	}
 	else if(param->value[0] == 0x9f){
 			
 	}
@@ -52,6 +52,7 @@
 extern int year , month , date, wday;
 extern int l_year, l_month, l_date;
 extern int hour, minute, second;
+extern int long_val_ntf;
 enum
 {
     CUSTS1_CP_ADC_VAL1_DISABLE = 0,
@@ -81,11 +82,19 @@ enum
  */
 
 
-int adc1_update(void);
+void batt_push(void);
 int clock_update(int inc);
+int clock_next_change(void);
+int clock_screen_changed(void);
 void clock_print(void);
 void clock_set(uint8_t *buf);
+void date_sync(void);
+int lunar_from_date(int year, int month, int day, int *ly_out, int *lm_out, int *ld_out);
 void clock_push(void);
+void settings_save(void);
+int settings_load(void);
+void time_checkpoint(void);
+void trace_push(void);
 void per_min_draw(int full);
 void per_min_draw_default(void);
 /**
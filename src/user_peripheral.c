@@ -31,6 +31,9 @@
 #include "user_peripheral.h"  // 本文件接口声明
 #include "user_custs1_impl.h" // 自定义服务1实现
 #include "user_custs1_def.h"  // 自定义服务1定义
+#include "user_timekeep.h"	  // 走时修正
+#include "user_adv.h"		  // 广播策略
+#include "user_batt.h"		  // 电池电压
 #include "co_bt.h"			  // 蓝牙协议协议相关定义
 #include "hw_otpc.h"		  // OTP控制器硬件接口
 
@@ -49,15 +52,15 @@
 int app_connection_idx __SECTION_ZERO("retention_mem_area0");						 // 连接索引，使用 retention 内存区域保存
 timer_hnd app_clock_timer_used __SECTION_ZERO("retention_mem_area0");				 // 时钟定时器句柄，retention内存保存
 timer_hnd app_param_update_request_timer_used __SECTION_ZERO("retention_mem_area0"); // 参数更新请求定时器句柄，retention内存保存
+timer_hnd app_adv_timer_used __SECTION_ZERO("retention_mem_area0");				 // 两个广播窗口之间的定时器句柄
 
 int adv_state = 0;			 // 广播状态：0-未广播，1-正在广播
 static int otp_btaddr[2];	 // 从OTP读取的蓝牙地址
 static int otp_boot;		 // 从OTP读取的启动相关数据
 char adv_name[20];	 // 广播名称缓冲区
 char *bt_id = adv_name + 12; // 蓝牙ID在广播名称中的起始位置
-int clock_interval;			 // 时钟更新间隔（秒）
-int clock_fixup_value;		 // 时钟修正值
-int clock_fixup_count;		 // 时钟修正计数器
+int clock_interval;			 // 当前定时周期的秒数，由clock_next_change()决定
+static int time_restored;	 // 开机时从flash恢复了时间
 
 // EPD版本信息（volatile确保不被优化，用于版本检测）
 const volatile u32 epd_version[3] = {0xF9A51379, ~0xF9A51379, EPD_VERSION};
@@ -168,74 +171,52 @@ extern int Region$$Table$$Base;
  */
 void user_app_init(void)
 {
+	static const u32 epd_gpio[2][2] = {
+		{0x23200700, 0x05210006},
+		{0x23111000, 0x07210120},
+	};
+	int i, w, h, mode;
+
+	boot_t0 = epd_ticks(); // 开机计时的起点
+	boot_timing = 1;
 	read_otp_value(); // 读取OTP数据，初始化广播名称
 
 	printk("\n\nuser_app_init! %s %08x\n", __TIME__, epd_version[2]);
 	app_param_update_request_timer_used = EASY_TIMER_INVALID_TIMER; // 初始化参数更新定时器
 	app_clock_timer_used = EASY_TIMER_INVALID_TIMER;				// 初始化时钟定时器
+	app_adv_timer_used = EASY_TIMER_INVALID_TIMER;					// 初始化广播间隙定时器
 
-	clock_interval = 60;   // 时钟更新间隔设置为60秒
-	clock_fixup_value = 0; // 初始化时钟修正值
-	clock_fixup_count = 0; // 初始化时钟修正计数器
+	clock_interval = 60; // 第一个周期在user_app_on_db_init_complete()中按画面重新计算
 
 	adv_state = 0;			 // 初始化为未广播状态
+	adv_policy_init();		 // 广播策略
 	fspi_config(0x00030605); // 配置FSPI接口
 
 	selflash(otp_boot); // 根据OTP启动数据执行自闪存操作
 
-	//
-	//
-	//*****
-	//注意！这里因为个人屏幕特性固定了分辨率
-	//*****
-	//
-	// 初始化EPD屏幕（2.13黑白屏，6个测试点）
-	epd_hw_init(0x23200700, 0x05210006, 122, 250, EPD_BW | ROTATE_3);
-	if (epd_detect() == 0)
-	{ // 如果检测不到屏幕，尝试另一种配置（5个测试点）
-		epd_hw_init(0x23111000, 0x07210120, 122, 250, EPD_BW | ROTATE_3);
-		epd_detect();
+	kv_init();						  // flash键值存储
+	time_restored = settings_load(); // 恢复设置和最后一次的时间检查点
+	timekeep_init();				  // 走时误差和温度系数
+
+	// 依次尝试两种引脚配置（2.13黑白屏6个测试点 / 5个测试点），检测到屏幕后
+	// 探测控制器的LUT长度和RAM大小，再按探测结果选分辨率、布局和颜色
+	for (i = 0; i < 2; i++)
+	{
+		epd_hw_init(epd_gpio[i][0], epd_gpio[i][1], 122, 250, EPD_BW | ROTATE_3);
+		if (epd_detect())
+			break;
 	}
+	if (i == 2)
+		i = 1; // 都检测不到时保持原来的做法，使用最后一种配置
+	epd_panel_select(&w, &h, &mode);
+	epd_hw_init(epd_gpio[i][0], epd_gpio[i][1], w, h, mode | ROTATE_3);
+
+	date_sync(); // 没有对时前，按默认日期算出农历和节日
 
 	app_connection_idx = -1; // 初始化连接索引为无效值
 	default_app_on_init();	 // 执行默认应用初始化
 }
 
-/**
- ****************************************************************************************
- * @brief 时钟快慢修正函数
- * @param[in] diff_sec  自上次对时后的误差秒数（正数表示快了，负数表示慢了）
- * @param[in] minutes   自上次对时后经过的分钟数
- * @note 计算并累积时钟修正值，用于调整定时器间隔，补偿时钟误差
- ****************************************************************************************
- */
-void clock_fixup_set(int diff_sec, int minutes)
-{
-	// 计算新的修正值（基于4096精度的分数计算）
-	int new_fixup_value = diff_sec * 100 * 4096 / minutes;
-	clock_fixup_value += new_fixup_value; // 累积修正值
-}
-
-/**
- ****************************************************************************************
- * @brief 应用时钟修正值
- * @return 本次需要调整的毫秒数
- * @note 从累积的修正计数器中提取整数部分作为本次调整值，保留余数
- ****************************************************************************************
- */
-static int clock_fixup(void)
-{
-	int value;
-
-	clock_fixup_count += clock_fixup_value; // 累积修正计数
-
-	value = clock_fixup_count >> 12; // 右移12位（除以4096）得到整数部分
-	clock_fixup_count &= 0xfff;		 // 保留低12位作为余数
-
-	return value; // 返回本次调整的毫秒数
-}
-
-extern int adcval; // ADC电压值变量
 /**
  ****************************************************************************************
  * @brief 应用时钟定时器回调函数
@@ -244,16 +225,25 @@ extern int adcval; // ADC电压值变量
  */
 static void app_clock_timer_cb(void)
 {
-	int adj = clock_fixup(); // 获取时钟修正值
-	// 重启定时器，应用修正后的间隔（单位：10ms，故乘以100）
-	app_clock_timer_used = app_easy_timer(clock_interval * 100 + adj, app_clock_timer_cb);
-
 	// 确定屏幕更新标志（根据时钟状态）
 	int flags = UPDATE_FLY; // 默认快速更新
-	// 更新时钟并打印
-	
+	// 走过刚结束的周期并打印
 	int stat = clock_update(clock_interval);
 	clock_print();
+	batt_tick(clock_interval);
+
+	// 电量耗尽(按滤波后的电压)：显示低电量画面，不再重启定时器
+	if (batt_state() == BATT_EMPTY)
+	{
+		Update_Mode=LB_MODE;
+		per_min_draw_default();
+		app_clock_timer_used = EASY_TIMER_INVALID_TIMER;
+		return;
+	}
+
+	// 按当前画面下一次变化的时刻重启定时器，间隔已经加上走时误差的补偿（单位：10ms）
+	clock_interval = clock_next_change();
+	app_clock_timer_used = app_easy_timer(timekeep_next(clock_interval), app_clock_timer_cb);
 
 	// 如果已连接，则推送时钟数据
 	if (app_connection_idx != -1)
@@ -265,32 +255,17 @@ static void app_clock_timer_cb(void)
 	if (year == 2025 && month <= 5)
 	{
 		// 在2024年2月执行特定操作（占位符）
+		adv_policy_event(ADV_EV_USER); // 等待配对，持续快速广播
 		Update_Mode=QR_MODE;
 		per_min_draw_default();
 		
-		user_app_adv_start(); // 持续开启广播
+		user_app_adv_start();
 		return;
 	}
 
-	// 如果是快速更新，更新ADC数据,若电量不足则不继续执行任务
-	if (flags == 4)
-	{
-		adc1_update();
-		// ADC电压小于2.6V
-		if (adcval < 1360)
-		{
-			// 绘制低电量图标
-			Update_Mode=LB_MODE;
-			per_min_draw_default();
-			// 清除定时器唤醒任务
-			app_easy_timer_cancel(app_clock_timer_used);
-			
-			return;
-		}
-	}
-
 	if (stat >= 3)
 	{
+		time_checkpoint();			   // 每小时记一次时间，复位后从这里恢复
 		flags = DRAW_BT | UPDATE_FULL; // 需要蓝牙图标+全量更新
 	}
 	else if (stat >= 2)
@@ -298,14 +273,8 @@ static void app_clock_timer_cb(void)
 		flags = DRAW_BT | UPDATE_FAST; // 需要蓝牙图标+快速更新
 	}
 
-	// 如果需要显示蓝牙图标，启动广播
-	if (flags & DRAW_BT || boot_debug)
-	{
-		user_app_adv_start();
-	}
-
-	// 根据状态或标志更新屏幕显示
-	if (stat > 0 || flags & DRAW_BT)
+	// 根据状态或标志更新屏幕显示。不随时间变化的画面整点不重画
+	if ((stat > 0 || flags & DRAW_BT) && clock_screen_changed())
 	{
 				Update_Mode=Default_Update_Mode;
 				per_min_draw(flags);
@@ -320,8 +289,26 @@ static void app_clock_timer_cb(void)
 void app_clock_timer_restart(void)
 {
 	app_easy_timer_cancel(app_clock_timer_used); // 取消当前定时器
-	// 以默认间隔重启定时器
-	app_clock_timer_used = app_easy_timer(clock_interval * 100, app_clock_timer_cb);
+	// 时间刚设置过，从现在开始等到画面下一次变化
+	clock_interval = clock_next_change();
+	app_clock_timer_used = app_easy_timer(timekeep_next(clock_interval), app_clock_timer_cb);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 显示模式改变后重新安排时钟定时器
+ *        当前周期提前结束，走过的时间计入时钟，再按新模式的下一次变化时刻重启
+ ****************************************************************************************
+ */
+void app_clock_timer_reschedule(void)
+{
+	// 低电量时定时器已经停了，不再启动
+	if (app_clock_timer_used == EASY_TIMER_INVALID_TIMER)
+		return;
+	app_easy_timer_cancel(app_clock_timer_used);
+	clock_update(timekeep_cut());
+	clock_interval = clock_next_change();
+	app_clock_timer_used = app_easy_timer(timekeep_next(clock_interval), app_clock_timer_cb);
 }
 
 /**
@@ -334,9 +321,8 @@ void user_app_on_db_init_complete(void)
 {
 	printk("\nuser_app_on_db_init_complete!\n");
 
-	// 更新ADC值并打印电压
-	int adcval = adc1_update();
-	printk("Voltage: %d\n", adcval);
+	// 电池电压的第一次采样，作为滤波的初值
+	batt_init();
 
 	// 打印并推送时钟数据
 	clock_print();
@@ -344,31 +330,81 @@ void user_app_on_db_init_complete(void)
 
 	// 绘制时钟（带蓝牙图标+全量更新）并启动广播
 	// clock_draw(DRAW_BT|UPDATE_FULL);
-	Update_Mode=QR_MODE;
+	// 恢复了时间就直接显示时钟，否则显示配对用的二维码
+	adv_policy_event(ADV_EV_BOOT); // 开机后先快速广播
+	Update_Mode = time_restored ? Default_Update_Mode : QR_MODE;
 	per_min_draw_default();
 	user_app_adv_start();
 
 	// 启动时钟定时器
-	app_clock_timer_used = app_easy_timer(clock_interval * 100, app_clock_timer_cb);
+	clock_interval = clock_next_change();
+	app_clock_timer_used = app_easy_timer(timekeep_next(clock_interval), app_clock_timer_cb);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 广播间隙定时器回调函数，开始下一个广播窗口
+ ****************************************************************************************
+ */
+static void app_adv_timer_cb(void)
+{
+	app_adv_timer_used = EASY_TIMER_INVALID_TIMER;
+	user_app_adv_start();
+}
+
+/**
+ ****************************************************************************************
+ * @brief 按广播策略安排下一个广播窗口
+ ****************************************************************************************
+ */
+static void app_adv_schedule(void)
+{
+	int gap = adv_policy_gap();
+
+	// 电量耗尽后不再广播
+	if (batt_state() == BATT_EMPTY)
+		gap = -1;
+	if (app_adv_timer_used != EASY_TIMER_INVALID_TIMER)
+	{
+		app_easy_timer_cancel(app_adv_timer_used);
+		app_adv_timer_used = EASY_TIMER_INVALID_TIMER;
+	}
+	if (gap == 0)
+		user_app_adv_start();
+	else if (gap > 0)
+		app_adv_timer_used = app_easy_timer(gap, app_adv_timer_cb);
 }
 
 /**
  ****************************************************************************************
  * @brief 启动应用广播
- *        构造广播数据（包含设备名称和EPD版本），并启动带超时的无向广播
+ *        构造广播数据（包含设备名称和EPD版本），按广播策略的间隔和时长启动带超时的无向广播
  ****************************************************************************************
  */
 void user_app_adv_start(void)
 {
 	u8 vbuf[4]; // 版本信息AD结构缓冲区
+	int intv, len;
 
 	// 如果已在广播状态，直接返回
 	if (adv_state)
 		return;
+	// 已连接时不广播
+	if (!adv_policy_window(&intv, &len))
+		return;
 	adv_state = 1; // 标记为正在广播
 
+	// 提前开始了，取消等待中的窗口
+	if (app_adv_timer_used != EASY_TIMER_INVALID_TIMER)
+	{
+		app_easy_timer_cancel(app_adv_timer_used);
+		app_adv_timer_used = EASY_TIMER_INVALID_TIMER;
+	}
+
 	// 获取广播命令结构
 	struct gapm_start_advertise_cmd *cmd = app_easy_gap_undirected_advertise_get_active();
+	cmd->intv_min = intv;
+	cmd->intv_max = intv;
 	// 添加设备名称AD结构
 	app_add_ad_struct(cmd, adv_name, adv_name[0] + 1, 1);
 
@@ -380,8 +416,8 @@ void user_app_adv_start(void)
 	app_add_ad_struct(cmd, vbuf, vbuf[0] + 1, 1);
 
 	// 启动带超时的无向广播
-	app_easy_gap_undirected_advertise_with_timeout_start(user_default_hnd_conf.advertise_period, NULL);
-	printk("\nuser_app_adv_start! %s\n", adv_name + 2);
+	app_easy_gap_undirected_advertise_with_timeout_start(len, NULL);
+	printk("\nuser_app_adv_start! %s  %d x %d\n", adv_name + 2, intv, len);
 }
 
 /**
@@ -400,6 +436,8 @@ void user_app_connection(uint8_t connection_idx, struct gapc_connection_req_ind
 	if (app_env[connection_idx].conidx != GAP_INVALID_CONIDX)
 	{
 		app_connection_idx = connection_idx; // 更新连接索引
+		adv_policy_event(ADV_EV_CONNECT);
+		app_adv_schedule();					 // 取消等待中的广播窗口
 
 		// 打印连接参数
 		printk("  interval: %d\n", param->con_interval);
@@ -437,20 +475,13 @@ void user_app_connection(uint8_t connection_idx, struct gapc_connection_req_ind
 void user_app_adv_undirect_complete(uint8_t status)
 {
 	printk("user_app_adv_undirect_complete: %02x\n", status);
-	// 状态非0表示异常结束，更新广播状态并刷新屏幕
+	// 状态非0表示窗口超时结束，没有等到连接，按策略安排下一个窗口。
+	// 蓝牙图标在画面下一次刷新时跟着更新，这里不单独刷新
 	if (status != 0)
 	{
 		adv_state = 0;
-		// 未进行初始化,则始终展示二维码
-		if (year == 2025 && month <= 5)
-		{
-			// 在2024年2月执行特定操作（占位符）
-			Update_Mode=QR_MODE;
-			per_min_draw_default();
-		}
-		else
-			Update_Mode=Default_Update_Mode;
-			per_min_draw(UPDATE_FLY);
+		adv_policy_event(ADV_EV_TIMEOUT);
+		app_adv_schedule();
 	}
 }
 
@@ -474,25 +505,11 @@ void user_app_disconnect(struct gapc_disconnect_ind const *param)
 
 	app_connection_idx = -1; // 重置连接索引为无效值
 	adv_state = 0;			 // 标记为未广播
+	long_val_ntf = 0;		 // 主机的订阅随连接失效
 
-	// 非远程用户主动断开时，重启广播；否则仅刷新屏幕
-	if (param->reason != CO_ERROR_REMOTE_USER_TERM_CON || boot_debug)
-	{
-		user_app_adv_start();
-	}
-	else
-	{
-		// 未进行初始化,则始终展示二维码
-		if (year == 2025 && month <= 5)
-		{
-			// 在2024年2月执行特定操作（占位符）
-			Update_Mode=QR_MODE;
-			per_min_draw_default();
-		}
-		else
-			Update_Mode=Default_Update_Mode;//这里Default_Update_Mode是在另一边界定的
-			per_min_draw(UPDATE_FLY);
-		}
+	// 非远程用户主动断开时马上快速广播，主机可能要重连；否则稀疏广播
+	adv_policy_event(param->reason != CO_ERROR_REMOTE_USER_TERM_CON ? ADV_EV_DISCONNECT : ADV_EV_CLOSE);
+	app_adv_schedule();
 }
 
 /**
@@ -528,6 +545,10 @@ void user_catch_rest_hndl(ke_msg_id_t const msgid,
 			user_svc1_long_val_wr_ind_handler(msgid, msg_param, dest_id, src_id);
 			break;
 
+		case SVC1_IDX_LONG_VALUE_NTF_CFG:
+			user_svc1_long_val_cfg_ind_handler(msgid, msg_param, dest_id, src_id);
+			break;
+
 		default:
 			break;
 		}
@@ -100,7 +100,7 @@ void user_app_before_sleep(void);
 
 void app_clock_timer_restart(void);
 
-void clock_fixup_set(int diff_sec, int minutes);
+void app_clock_timer_reschedule(void);
 
 /**
  ****************************************************************************************
@@ -0,0 +1,267 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_timekeep.c
+ *
+ * @brief 走时修正：晶振误差和温度系数的自动校准
+ *
+ * 时钟靠app_easy_timer每分钟走一次，定时器的时钟源本身有误差，还随温度变化。
+ * 这里把误差表示成ppb(十亿分之一)：drift = base + coef*(T-25度)，T是屏幕控制器
+ * 内置传感器最近一次测到的温度。每个定时周期按当前的drift算出要补偿的时间，
+ * 以ns为单位累加，满10ms(定时器的最小单位)才加到下一个周期上，余数留到以后。
+ *
+ * 每次0x91对时，比较本地时间和主机时间，误差累加到当前的统计窗口里。窗口够长
+ * (至少6小时)时算出窗口内实际的drift和平均温度，用来修正base或coef：平均温度
+ * 接近25度时修正base，离得远时修正coef。主机的时间只精确到秒，窗口越长越可信，
+ * 所以修正的比例随窗口长度增大。学到的参数存在flash里，复位后继续使用。
+ *
+ ****************************************************************************************
+ */
+
+/*
+ * 包含头文件
+ ****************************************************************************************
+ */
+
+#include "user_custs1_impl.h" // year/month/date等时间变量
+#include "user_timekeep.h"
+
+#include "epd.h" // epd_ticks、epd_temp、kv_set
+
+/*
+ * 常量定义
+ ****************************************************************************************
+ */
+
+#define TK_REF_TEMP   (25 * 16)    // 参考温度，单位1/16度
+#define TK_TEMP_BAND  (3 * 16)     // 平均温度离参考温度3度以内时修正base
+#define TK_LEARN_SEC  (6 * 3600)   // 窗口至少这么长才学习
+#define TK_TAU_SEC    (3 * 86400)  // 窗口长度等于它时，新的测量值占一半
+#define TK_STEP_NS    10000000     // 定时器的单位10ms
+#define TK_BASE_MAX   500000       // 500ppm
+#define TK_COEF_MAX   20000        // 20ppm/度
+
+/*
+ * 全局变量定义
+ ****************************************************************************************
+ */
+
+typedef struct
+{
+	int32_t base;  // 参考温度下的误差，ppb，正数表示本地走快了
+	int32_t coef;  // 温度系数，ppb/度
+	uint8_t calibrated;
+	uint8_t rsv[3];
+} TIMEKEEP_INFO;
+
+static TIMEKEEP_INFO tk;
+
+static long long tk_acc_ns; // 还没有补偿的时间
+static u32 tk_tick;			// 当前定时周期开始的时刻
+static int tk_cur_sec;		// 当前定时周期的秒数
+static int tk_cur_ppb;		// 当前定时周期使用的drift
+static int tk_cur_adj;		// 当前定时周期加上的补偿，单位10ms
+
+// 统计窗口，从某次对时开始。tk_win_valid为0表示本地时间还不可信
+static int tk_win_valid;
+static int tk_win_sec;
+static long long tk_win_err_ms;	 // 各次对时的误差之和
+static long long tk_win_comp_ns; // 这段时间里已经补偿掉的时间
+static long long tk_win_temp;	 // 温度对时间的积分
+static int tk_win_temp_sec;
+
+/*
+ * 函数定义
+ ****************************************************************************************
+ */
+
+static int tk_clamp(long long v, int max)
+{
+	if (v > max)
+		return max;
+	if (v < -max)
+		return -max;
+	return (int)v;
+}
+
+// 当前温度下的drift
+static int tk_drift(void)
+{
+	if (epd_temp == EPD_TEMP_NONE)
+		return tk.base;
+	return tk.base + tk.coef * (epd_temp - TK_REF_TEMP) / 16;
+}
+
+static void tk_win_reset(void)
+{
+	tk_win_valid = 1;
+	tk_win_sec = 0;
+	tk_win_err_ms = 0;
+	tk_win_comp_ns = 0;
+	tk_win_temp = 0;
+	tk_win_temp_sec = 0;
+}
+
+// 把已经走过的sec秒计入窗口
+static void tk_win_add(int sec)
+{
+	tk_win_sec += sec;
+	tk_win_comp_ns += (long long)sec * tk_cur_ppb;
+	if (epd_temp != EPD_TEMP_NONE)
+	{
+		tk_win_temp += (long long)epd_temp * sec;
+		tk_win_temp_sec += sec;
+	}
+}
+
+// 窗口内实际的drift和平均温度，修正base或coef
+static void tk_learn(void)
+{
+	int drift, temp, dt, resid;
+	long long gain_num = tk_win_sec;
+	long long gain_den = tk_win_sec + TK_TAU_SEC;
+
+	drift = (int)((tk_win_comp_ns + tk_win_err_ms * 1000000) / tk_win_sec);
+	temp = tk_win_temp_sec ? (int)(tk_win_temp / tk_win_temp_sec) : TK_REF_TEMP;
+	dt = temp - TK_REF_TEMP;
+	resid = drift - (tk.base + tk.coef * dt / 16);
+
+	if (!tk.calibrated)
+	{
+		// 第一次，全部算到base上
+		tk.base = tk_clamp(drift - (long long)tk.coef * dt / 16, TK_BASE_MAX);
+		tk.calibrated = 1;
+	}
+	else if (dt > -TK_TEMP_BAND && dt < TK_TEMP_BAND)
+	{
+		tk.base = tk_clamp(tk.base + resid * gain_num / gain_den, TK_BASE_MAX);
+	}
+	else
+	{
+		tk.coef = tk_clamp(tk.coef + (long long)resid * 16 / dt * gain_num / gain_den, TK_COEF_MAX);
+	}
+
+	printk("Timekeep: %d s  drift %d ppb at %d/16 C  base %d  coef %d\n",
+		   tk_win_sec, drift, temp, tk.base, tk.coef);
+	kv_set(KV_TIMEKEEP, &tk, sizeof(tk));
+}
+
+/**
+ ****************************************************************************************
+ * @brief 开机时读取学到的参数
+ ****************************************************************************************
+ */
+void timekeep_init(void)
+{
+	if (kv_get(KV_TIMEKEEP, &tk, sizeof(tk)) != sizeof(tk))
+		memset(&tk, 0, sizeof(tk));
+	tk_win_valid = 0;
+	tk_cur_sec = 0;
+	tk_tick = epd_ticks();
+	printk("Timekeep: base %d ppb  coef %d ppb/C\n", tk.base, tk.coef);
+}
+
+/**
+ ****************************************************************************************
+ * @brief 开始下一个定时周期
+ * @param[in] sec  周期的秒数
+ * @return 定时器的长度，单位10ms，已经加上误差补偿
+ ****************************************************************************************
+ */
+int timekeep_next(int sec)
+{
+	int adj;
+
+	tk_win_add(tk_cur_sec);
+
+	tk_cur_sec = sec;
+	tk_cur_ppb = tk_drift();
+	tk_tick = epd_ticks();
+
+	// 本地走快时定时器要加长
+	tk_acc_ns += (long long)sec * tk_cur_ppb;
+	adj = (int)(tk_acc_ns / TK_STEP_NS);
+	tk_acc_ns -= (long long)adj * TK_STEP_NS;
+	tk_cur_adj = adj;
+
+	return sec * 100 + adj;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 当前定时周期被提前取消(换了显示模式)，之后马上会调用timekeep_next()
+ * @return 已经走过的整秒数，调用者把它加到时钟上。不足一秒的部分让下一个周期短一些
+ ****************************************************************************************
+ */
+int timekeep_cut(void)
+{
+	int ms, sec;
+
+	ms = (((epd_ticks() - tk_tick) & 0x07ffffff) * 5) >> 3;
+	sec = ms / 1000;
+	if (sec > tk_cur_sec)
+		sec = tk_cur_sec;
+
+	// 这个周期的补偿没有用上，没走完的秒数也不该算drift，退回去重新算
+	tk_acc_ns += (long long)tk_cur_adj * TK_STEP_NS - (long long)(tk_cur_sec - sec) * tk_cur_ppb;
+	tk_acc_ns -= (long long)(ms - sec * 1000) * 1000000;
+	tk_cur_adj = 0;
+	tk_cur_sec = sec;
+
+	return sec;
+}
+
+/**
+ ****************************************************************************************
+ * @brief 0x91对时，在改写本地时间之前调用
+ * @param[in] buf  0x91命令，格式见clock_set()
+ ****************************************************************************************
+ */
+void timekeep_sync(uint8_t *buf)
+{
+	long long local_ms, host_ms, err_ms;
+	int part_ms;
+
+	part_ms = (((epd_ticks() - tk_tick) & 0x07ffffff) * 5) >> 3;
+	local_ms = ((long long)days_from_civil(year, month, date) * 86400 + hour * 3600 + minute * 60 + second) * 1000 + part_ms;
+	host_ms = ((long long)days_from_civil(buf[1] + buf[2] * 256, buf[3], buf[4] - 1) * 86400 + buf[5] * 3600 + buf[6] * 60 + buf[7]) * 1000;
+	err_ms = local_ms - host_ms;
+
+	// 当前周期被对时打断，走过的部分计入窗口。clock_set()会重新开始定时器
+	tk_win_add(part_ms / 1000);
+	tk_cur_sec = 0;
+
+	if (!tk_win_valid || err_ms > 3600000 || err_ms < -3600000)
+	{
+		// 本地时间本来就不对(刚开机或者手动改过)，从这次对时开始统计
+		printk("Timekeep: new window\n");
+		tk_win_reset();
+		return;
+	}
+
+	tk_win_err_ms += err_ms;
+	printk("Timekeep: error %d ms after %d s\n", (int)err_ms, tk_win_sec);
+	if (tk_win_sec >= TK_LEARN_SEC)
+	{
+		tk_learn();
+		tk_win_reset();
+	}
+}
+
+/**
+ ****************************************************************************************
+ * @brief 0x92手动校准
+ * @param[in] diff_sec  自上次对时后的误差秒数（正数表示快了，负数表示慢了）
+ * @param[in] minutes   自上次对时后经过的分钟数
+ ****************************************************************************************
+ */
+void timekeep_manual(int diff_sec, int minutes)
+{
+	if (minutes <= 0)
+		return;
+	tk.base = tk_clamp(tk.base + (long long)diff_sec * 1000000000 / (minutes * 60), TK_BASE_MAX);
+	tk.calibrated = 1;
+	kv_set(KV_TIMEKEEP, &tk, sizeof(tk));
+	// 手动校准前的误差已经算过了，重新统计
+	tk_win_reset();
+}
@@ -0,0 +1,29 @@
+/**
+ ****************************************************************************************
+ *
+ * @file user_timekeep.h
+ *
+ * @brief 走时修正：晶振误差和温度系数的自动校准
+ *
+ ****************************************************************************************
+ */
+
+#ifndef _USER_TIMEKEEP_H_
+#define _USER_TIMEKEEP_H_
+
+/*
+ * FUNCTION DECLARATIONS
+ ****************************************************************************************
+ */
+
+void timekeep_init(void);
+
+int timekeep_next(int sec);
+
+int timekeep_cut(void);
+
+void timekeep_sync(uint8_t *buf);
+
+void timekeep_manual(int diff_sec, int minutes);
+
+#endif // _USER_TIMEKEEP_H_
@@ -0,0 +1,128 @@
+import re
+import sys
+
+# 刷新耗时统计的直方图
+#
+# 输入可以是:
+#   1. 调试串口日志，固件收到 0x9b 命令后打印的 "TRACE ..." 行(单位ms)
+#   2. 从 trace 特征值(0xff04)读到的十六进制数据(单位625us)，可以多次读取后逐行粘贴
+#
+# 用法:
+#   python trace_hist.py uart.log
+#   python trace_hist.py trace_hex.txt
+#   cat uart.log | python trace_hist.py
+
+PHASES = ["draw", "init", "upload", "lut", "busy", "sleep"]
+MODES = {0: "full", 1: "fast", 2: "fly", 3: "gray"}
+F_RETAIN = 0x01
+F_QUEUED = 0x02
+
+# 直方图分桶上限(ms)
+BUCKETS = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000]
+BAR_WIDTH = 40
+
+
+def parse_uart(line):
+    m = re.search(r"TRACE((?:\s+\d+)+)\s*$", line)
+    if not m:
+        return None
+    v = [int(x) for x in m.group(1).split()]
+    if len(v) != 4 + len(PHASES):
+        return None
+    return {"seq": v[0], "mode": v[1], "flags": v[2], "bytes": v[3],
+            "ms": dict(zip(PHASES, v[4:])), "polled": None}
+
+
+def parse_hex(line):
+    h = re.sub(r"0x|[^0-9a-fA-F]", "", line)
+    if len(h) < 8 or len(h) % 2:
+        return []
+    b = bytes.fromhex(h)
+    ver, n, size, polled = b[0], b[1], b[2], b[3]
+    if ver != 1 or len(b) < 4 + n * size:
+        return []
+
+    recs = []
+    for i in range(n):
+        p = b[4 + i * size: 4 + (i + 1) * size]
+        t = [p[6 + j * 2] | (p[7 + j * 2] << 8) for j in range(len(PHASES))]
+        recs.append({"seq": p[0], "mode": p[1], "flags": p[2], "bytes": p[4] | (p[5] << 8),
+                     "ms": dict(zip(PHASES, [x * 0.625 for x in t])), "polled": polled})
+    return recs
+
+
+def load(lines):
+    recs = {}
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith("TRACE seq"):
+            continue
+        r = parse_uart(line)
+        found = [r] if r else parse_hex(line)
+        # 同一条记录会在多次读取中重复出现，按seq去重
+        for r in found:
+            recs[r["seq"]] = r
+    return list(recs.values())
+
+
+def histogram(name, values):
+    counts = [0] * (len(BUCKETS) + 1)
+    for v in values:
+        for i, top in enumerate(BUCKETS):
+            if v <= top:
+                counts[i] += 1
+                break
+        else:
+            counts[-1] += 1
+
+    total = sum(values)
+    print("%-7s n=%d  mean %.1f ms  max %.1f ms  sum %.1f ms" %
+          (name, len(values), total / len(values), max(values), total))
+    peak = max(counts)
+    for i, c in enumerate(counts):
+        label = "<=%d" % BUCKETS[i] if i < len(BUCKETS) else ">%d" % BUCKETS[-1]
+        if c:
+            print("  %7s ms %4d %s" % (label, c, "#" * max(1, c * BAR_WIDTH // peak)))
+    print()
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], encoding="utf-8", errors="ignore") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    recs = load(lines)
+    if not recs:
+        print("没有找到TRACE记录")
+        return
+
+    print("%d 次刷新\n" % len(recs))
+    for name in PHASES:
+        histogram(name, [r["ms"][name] for r in recs])
+
+    # CPU醒着的时间: 中断模式下busy期间睡眠，轮询模式下一直醒着
+    polled = recs[0]["polled"]
+    awake = [p for p in PHASES if p not in ("draw", "busy")]
+    if polled:
+        awake.append("busy")
+    wake_total = sum(sum(r["ms"][p] for p in awake) for r in recs)
+    print("CPU醒着的时间分布%s:" % ("" if polled is not None else "(假定BUSY中断模式)"))
+    for p in awake:
+        s = sum(r["ms"][p] for r in recs)
+        pct = 100.0 * s / wake_total if wake_total else 0
+        print("  %-7s %5.1f%%  %s" % (p, pct, "#" * int(pct * BAR_WIDTH / 100)))
+
+    print("\n按模式:")
+    for mode in sorted(set(r["mode"] for r in recs)):
+        sub = [r for r in recs if r["mode"] == mode]
+        print("  %-5s %3d 次  平均SPI %5d 字节  保持上电 %d 次  流水线 %d 次" % (
+            MODES.get(mode, str(mode)), len(sub),
+            sum(r["bytes"] for r in sub) // len(sub),
+            sum(1 for r in sub if r["flags"] & F_RETAIN),
+            sum(1 for r in sub if r["flags"] & F_QUEUED)))
+
+
+if __name__ == "__main__":
+    main()